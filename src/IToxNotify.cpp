@@ -35,6 +35,18 @@
 
 @class IToxProfileNotifier
 @brief Interface for Tox profile notifications.
+
+
+@class IToxTransferNotifier
+@brief Interface for Tox file transfer notifications.
+
+
+@class IToxConferenceNotifier
+@brief Interface for Tox conference notifications.
+
+
+@class IToxCallNotifier
+@brief Interface for Tox call notifications.
 */
 
 /**
@@ -78,3 +90,66 @@ IToxProfileNotifier::~IToxProfileNotifier()
         profile->removeNotificationObserver(this);
     }
 }
+
+/**
+@brief IToxTransferNotifier (abstract) constructor
+*/
+IToxTransferNotifier::IToxTransferNotifier()
+{
+    ToxProfilePrivate* profile = ToxProfilePrivate::current();
+    Q_ASSERT(profile);
+    profile->addNotificationObserver(this);
+}
+
+/**
+@brief IToxTransferNotifier destructor
+*/
+IToxTransferNotifier::~IToxTransferNotifier()
+{
+    ToxProfilePrivate* profile = ToxProfilePrivate::current();
+    if (profile) {
+        profile->removeNotificationObserver(this);
+    }
+}
+
+/**
+@brief IToxConferenceNotifier (abstract) constructor
+*/
+IToxConferenceNotifier::IToxConferenceNotifier()
+{
+    ToxProfilePrivate* profile = ToxProfilePrivate::current();
+    Q_ASSERT(profile);
+    profile->addNotificationObserver(this);
+}
+
+/**
+@brief IToxConferenceNotifier destructor
+*/
+IToxConferenceNotifier::~IToxConferenceNotifier()
+{
+    ToxProfilePrivate* profile = ToxProfilePrivate::current();
+    if (profile) {
+        profile->removeNotificationObserver(this);
+    }
+}
+
+/**
+@brief IToxCallNotifier (abstract) constructor
+*/
+IToxCallNotifier::IToxCallNotifier()
+{
+    ToxProfilePrivate* profile = ToxProfilePrivate::current();
+    Q_ASSERT(profile);
+    profile->addNotificationObserver(this);
+}
+
+/**
+@brief IToxCallNotifier destructor
+*/
+IToxCallNotifier::~IToxCallNotifier()
+{
+    ToxProfilePrivate* profile = ToxProfilePrivate::current();
+    if (profile) {
+        profile->removeNotificationObserver(this);
+    }
+}
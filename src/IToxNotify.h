@@ -28,6 +28,7 @@
 #define TOXER_INTERFACE_TOX_NOTIFY_H
 
 #include <QString>
+#include <QStringList>
 
 class ToxProfilePrivate;
 
@@ -46,6 +47,7 @@ public:
     virtual void on_is_online_changed(int index, bool online) = 0;
     virtual void on_is_typing_changed(int index, bool typing) = 0;
     virtual void on_message(int index, const QString& message) = 0;
+    virtual void on_avatar_changed(int index) = 0;
 };
 
 class IToxProfileNotifier
@@ -61,4 +63,59 @@ public:
     virtual void on_status_changed(int status) = 0;
 };
 
+class IToxTransferNotifier
+{
+protected:
+    IToxTransferNotifier();
+    virtual ~IToxTransferNotifier();
+
+public:
+    virtual void on_transfer_started(int index, quint32 fileIndex,
+                                     const QString& fileName, quint64 size,
+                                     bool incoming) = 0;
+    virtual void on_transfer_progress(int index, quint32 fileIndex,
+                                      quint64 bytes, quint64 size,
+                                      quint64 bytesPerSecond) = 0;
+    virtual void on_transfer_finished(int index, quint32 fileIndex,
+                                      bool completed) = 0;
+};
+
+class IToxConferenceNotifier
+{
+protected:
+    IToxConferenceNotifier();
+    virtual ~IToxConferenceNotifier();
+
+public:
+    virtual void on_conference_invited(int friendIndex,
+                                       const QString& cookie) = 0;
+    virtual void on_conference_added(int index) = 0;
+    virtual void on_conference_removed(int index) = 0;
+    virtual void on_conference_title_changed(int index,
+                                             const QString& title) = 0;
+    virtual void on_conference_message(int index, const QString& peerKey,
+                                       const QString& peerName,
+                                       const QString& message,
+                                       quint8 type) = 0;
+    virtual void on_conference_peers_changed(int index,
+                                             const QStringList& added,
+                                             const QStringList& names,
+                                             const QStringList& removed) = 0;
+    virtual void on_conference_peer_name_changed(int index,
+                                                 const QString& peerKey,
+                                                 const QString& name) = 0;
+};
+
+class IToxCallNotifier
+{
+protected:
+    IToxCallNotifier();
+    virtual ~IToxCallNotifier();
+
+public:
+    virtual void on_call_incoming(int index) = 0;
+    virtual void on_call_state_changed(int index, quint32 state) = 0;
+    virtual void on_call_finished(int index) = 0;
+};
+
 #endif
@@ -0,0 +1,111 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "SecureBuffer.h"
+
+#include <sodium.h>
+
+/**
+@class SecureBuffer
+@brief Owns a block of memory for secret data.
+
+The memory is allocated with sodium_malloc: it is locked into RAM, surrounded
+by guard pages and wiped when the buffer is released. A buffer is move-only,
+so there is never more than one owner of the secret.
+*/
+
+/**
+@brief Constructs a null buffer.
+*/
+SecureBuffer::SecureBuffer()
+    : data_(nullptr)
+    , size_(0)
+{
+}
+
+/**
+@brief Allocates a secure buffer.
+@param[in] size     the buffer size in bytes
+
+The buffer is null, if the allocation failed.
+*/
+SecureBuffer::SecureBuffer(size_t size)
+    : data_(static_cast<uint8_t*>(sodium_malloc(size)))
+    , size_(data_ ? size : 0)
+{
+    if (!data_) {
+        qWarning("Failed to allocate %zu bytes of secure memory.", size);
+    }
+}
+
+/**
+@brief move constructor
+*/
+SecureBuffer::SecureBuffer(SecureBuffer&& other)
+    : data_(other.data_)
+    , size_(other.size_)
+{
+    other.data_ = nullptr;
+    other.size_ = 0;
+}
+
+/**
+@brief destructor
+
+Wipes and releases the memory.
+*/
+SecureBuffer::~SecureBuffer()
+{
+    clear();
+}
+
+/**
+@brief move assignment
+*/
+SecureBuffer& SecureBuffer::operator=(SecureBuffer&& other)
+{
+    if (this != &other) {
+        clear();
+        data_ = other.data_;
+        size_ = other.size_;
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+
+    return *this;
+}
+
+/**
+@brief Wipes and releases the memory; the buffer becomes null.
+*/
+void SecureBuffer::clear()
+{
+    if (data_) {
+        sodium_free(data_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
@@ -0,0 +1,71 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef TOXER_PRIVATE_SECUREBUFFER_H
+#define TOXER_PRIVATE_SECUREBUFFER_H
+
+#include <QtGlobal>
+
+#include <cstddef>
+#include <cstdint>
+
+class SecureBuffer final
+{
+public:
+    SecureBuffer();
+    explicit SecureBuffer(size_t size);
+    SecureBuffer(SecureBuffer&& other);
+    ~SecureBuffer();
+
+    SecureBuffer& operator=(SecureBuffer&& other);
+
+    SecureBuffer(const SecureBuffer& other) = delete;
+    SecureBuffer& operator=(const SecureBuffer& other) = delete;
+
+    inline bool isNull() const {
+        return data_ == nullptr;
+    }
+
+    inline uint8_t* data() {
+        return data_;
+    }
+
+    inline const uint8_t* constData() const {
+        return data_;
+    }
+
+    inline size_t size() const {
+        return size_;
+    }
+
+    void clear();
+
+private:
+    uint8_t* data_;
+    size_t size_;
+};
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "SettingsSchema.h"
+
+/**
+@namespace SettingsSchema
+@brief The declaration of all Toxer settings.
+
+Each setting is a struct that defines its key, value type, default value and
+change signal in one place. The SettingsStore and the Settings accessors are
+generated from these declarations, so keys, types and signals cannot drift
+apart. Settings are addressed by their compile-time SettingsSchema::Id.
+
+Enumerations are stored by name. The names are listed in EnumNames next to
+a static assertion that checks the name of every enumerator, so a renamed
+or reordered enumerator fails to compile. The conversion is a plain table
+lookup and only runs when the settings file is read or written.
+
+AllSettings is concatenated from the lists of ToxSettings and UiSettings,
+so a setting added to either list is always visited by forEach().
+*/
+
+namespace SettingsSchema {
+
+constexpr const char* EnumNames<ToxTypes::Proxy>::names[];
+constexpr const char* EnumNames<UiSettings::AppLayout>::names[];
+
+}
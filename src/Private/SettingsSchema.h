@@ -0,0 +1,353 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef TOXER_PRIVATE_SETTINGSSCHEMA_H
+#define TOXER_PRIVATE_SETTINGSSCHEMA_H
+
+#include <Settings.h>
+
+#include <QRect>
+#include <QString>
+#include <QVariant>
+
+#include <limits>
+#include <type_traits>
+
+namespace SettingsSchema {
+
+template<typename... S>
+struct List {};
+
+template<typename A, typename B>
+struct Concat;
+
+template<typename... A, typename... B>
+struct Concat<List<A...>, List<B...>>
+{
+    using Type = List<A..., B...>;
+};
+
+template<typename F>
+inline void forEach(List<>, F&) {}
+
+template<typename S, typename... R, typename F>
+inline void forEach(List<S, R...>, F& f)
+{
+    f(S());
+    forEach(List<R...>(), f);
+}
+
+template<typename E>
+struct EnumNames;
+
+constexpr bool equal(const char* a, const char* b)
+{
+    return *a == *b && (*a == '\0' || equal(a + 1, b + 1));
+}
+
+template<typename E>
+constexpr bool named(E value, const char* name)
+{
+    return static_cast<int>(value) < EnumNames<E>::count &&
+           equal(EnumNames<E>::names[static_cast<int>(value)], name);
+}
+
+template<>
+struct EnumNames<ToxTypes::Proxy>
+{
+    static constexpr const char* names[] = { "None", "HTTP", "SOCKS5" };
+    static constexpr int count = sizeof(names) / sizeof(*names);
+};
+static_assert(EnumNames<ToxTypes::Proxy>::count == 3 &&
+              named(ToxTypes::Proxy::None, "None") &&
+              named(ToxTypes::Proxy::HTTP, "HTTP") &&
+              named(ToxTypes::Proxy::SOCKS5, "SOCKS5"),
+              "ToxTypes::Proxy names out of sync");
+
+template<>
+struct EnumNames<UiSettings::AppLayout>
+{
+    static constexpr const char* names[] = { "Slim", "Split" };
+    static constexpr int count = sizeof(names) / sizeof(*names);
+};
+static_assert(EnumNames<UiSettings::AppLayout>::count == 2 &&
+              named(UiSettings::AppLayout::Slim, "Slim") &&
+              named(UiSettings::AppLayout::Split, "Split"),
+              "UiSettings::AppLayout names out of sync");
+
+enum CodecKind { GenericCodec, EnumCodec, IntegerCodec };
+
+template<typename T>
+constexpr CodecKind codecKind()
+{
+    return std::is_enum<T>::value
+            ? EnumCodec
+            : std::is_integral<T>::value && !std::is_same<T, bool>::value
+              ? IntegerCodec
+              : GenericCodec;
+}
+
+template<typename T, CodecKind = codecKind<T>()>
+struct Codec
+{
+    static QVariant encode(const T& value)
+    {
+        return QVariant::fromValue(value);
+    }
+
+    static T decode(const QVariant& stored, const T& fallback)
+    {
+        return stored.canConvert<T>() ? stored.value<T>() : fallback;
+    }
+};
+
+template<typename T>
+struct Codec<T, IntegerCodec>
+{
+    static QVariant encode(const T& value)
+    {
+        return QVariant::fromValue(static_cast<qlonglong>(value));
+    }
+
+    static T decode(const QVariant& stored, const T& fallback)
+    {
+        bool ok = false;
+        const qlonglong v = stored.toLongLong(&ok);
+        return ok && v >= std::numeric_limits<T>::min() &&
+                v <= std::numeric_limits<T>::max() ? static_cast<T>(v)
+                                                   : fallback;
+    }
+};
+
+template<typename T>
+struct Codec<T, EnumCodec>
+{
+    static QVariant encode(const T& value)
+    {
+        const int i = static_cast<int>(value);
+        return i >= 0 && i < EnumNames<T>::count
+                ? QVariant(QLatin1String(EnumNames<T>::names[i]))
+                : QVariant(i);
+    }
+
+    static T decode(const QVariant& stored, const T& fallback)
+    {
+        const QByteArray name = stored.toByteArray();
+        for (int i = 0; i < EnumNames<T>::count; i++) {
+            if (name == EnumNames<T>::names[i]) {
+                return static_cast<T>(i);
+            }
+        }
+
+        bool ok = false;
+        const int i = stored.toInt(&ok);
+        return ok && i >= 0 && i < EnumNames<T>::count ? static_cast<T>(i)
+                                                       : fallback;
+    }
+};
+
+enum Id : int {
+    Ipv6EnabledId,
+    UdpEnabledId,
+    ProxyTypeId,
+    ProxyPortId,
+    ProxyAddrId,
+    StandbyProfilesId,
+    TransferRateLimitId,
+    FriendRateLimitId,
+    AudioInputId,
+    AudioOutputId,
+    NotificationOutputId,
+    AppLayoutId,
+    FullscreenId,
+    GeometryId,
+    Count
+};
+
+struct Ipv6Enabled
+{
+    using Type = bool;
+    static constexpr Id id() { return Ipv6EnabledId; }
+    static constexpr const char* key() { return "tox/ipv6_enabled"; }
+    static Type defaultValue() { return true; }
+    static constexpr void (ToxSettings::*signal())(bool) {
+        return &ToxSettings::ipv6_enabled_changed;
+    }
+};
+
+struct UdpEnabled
+{
+    using Type = bool;
+    static constexpr Id id() { return UdpEnabledId; }
+    static constexpr const char* key() { return "tox/udp_enabled"; }
+    static Type defaultValue() { return false; }
+    static constexpr void (ToxSettings::*signal())(bool) {
+        return &ToxSettings::udp_enabled_changed;
+    }
+};
+
+struct ProxyType
+{
+    using Type = ToxTypes::Proxy;
+    static constexpr Id id() { return ProxyTypeId; }
+    static constexpr const char* key() { return "tox/proxy_type"; }
+    static Type defaultValue() { return ToxTypes::Proxy::None; }
+    static constexpr void (ToxSettings::*signal())(ToxTypes::Proxy) {
+        return &ToxSettings::proxy_type_changed;
+    }
+};
+
+struct ProxyPort
+{
+    using Type = quint16;
+    static constexpr Id id() { return ProxyPortId; }
+    static constexpr const char* key() { return "tox/proxy_port"; }
+    static Type defaultValue() { return 0; }
+    static constexpr void (ToxSettings::*signal())(quint16) {
+        return &ToxSettings::proxy_port_changed;
+    }
+};
+
+struct ProxyAddr
+{
+    using Type = QString;
+    static constexpr Id id() { return ProxyAddrId; }
+    static constexpr const char* key() { return "tox/proxy_addr"; }
+    static Type defaultValue() { return QString(); }
+    static constexpr void (ToxSettings::*signal())(QString) {
+        return &ToxSettings::proxy_addr_changed;
+    }
+};
+
+struct StandbyProfiles
+{
+    using Type = quint8;
+    static constexpr Id id() { return StandbyProfilesId; }
+    static constexpr const char* key() { return "tox/standby_profiles"; }
+    static Type defaultValue() { return 0; }
+    static constexpr void (ToxSettings::*signal())(quint8) {
+        return &ToxSettings::standby_profiles_changed;
+    }
+};
+
+struct TransferRateLimit
+{
+    using Type = quint32;
+    static constexpr Id id() { return TransferRateLimitId; }
+    static constexpr const char* key() { return "tox/transfer_rate_limit"; }
+    static Type defaultValue() { return 0; }
+    static constexpr void (ToxSettings::*signal())(quint32) {
+        return &ToxSettings::transfer_rate_limit_changed;
+    }
+};
+
+struct FriendRateLimit
+{
+    using Type = quint32;
+    static constexpr Id id() { return FriendRateLimitId; }
+    static constexpr const char* key() { return "tox/friend_rate_limit"; }
+    static Type defaultValue() { return 0; }
+    static constexpr void (ToxSettings::*signal())(quint32) {
+        return &ToxSettings::friend_rate_limit_changed;
+    }
+};
+
+struct AudioInput
+{
+    using Type = QString;
+    static constexpr Id id() { return AudioInputId; }
+    static constexpr const char* key() { return "audio/input"; }
+    static Type defaultValue() { return QStringLiteral("default"); }
+    static constexpr void (ToxSettings::*signal())(QString) {
+        return &ToxSettings::audio_input_changed;
+    }
+};
+
+struct AudioOutput
+{
+    using Type = QString;
+    static constexpr Id id() { return AudioOutputId; }
+    static constexpr const char* key() { return "audio/output"; }
+    static Type defaultValue() { return QStringLiteral("default"); }
+    static constexpr void (ToxSettings::*signal())(QString) {
+        return &ToxSettings::audio_output_changed;
+    }
+};
+
+struct NotificationOutput
+{
+    using Type = QString;
+    static constexpr Id id() { return NotificationOutputId; }
+    static constexpr const char* key() { return "audio/notification_output"; }
+    static Type defaultValue() { return QStringLiteral("default"); }
+    static constexpr void (ToxSettings::*signal())(QString) {
+        return &ToxSettings::notification_output_changed;
+    }
+};
+
+struct AppLayout
+{
+    using Type = UiSettings::AppLayout;
+    static constexpr Id id() { return AppLayoutId; }
+    static constexpr const char* key() { return "ui/app_layout"; }
+    static Type defaultValue() { return UiSettings::AppLayout::Split; }
+    static constexpr void (UiSettings::*signal())(quint8) {
+        return &UiSettings::appLayoutChanged;
+    }
+};
+
+struct Fullscreen
+{
+    using Type = bool;
+    static constexpr Id id() { return FullscreenId; }
+    static constexpr const char* key() { return "ui/fullscreen"; }
+    static Type defaultValue() { return false; }
+    static constexpr void (UiSettings::*signal())(bool) {
+        return &UiSettings::fullscreenChanged;
+    }
+};
+
+struct Geometry
+{
+    using Type = QRect;
+    static constexpr Id id() { return GeometryId; }
+    static constexpr const char* key() { return "ui/geometry"; }
+    static Type defaultValue() { return QRect(); }
+    static constexpr void (UiSettings::*signal())(const QRect&) {
+        return &UiSettings::geometryChanged;
+    }
+};
+
+using ToxSettingsList = List<Ipv6Enabled, UdpEnabled, ProxyType, ProxyPort,
+                             ProxyAddr, StandbyProfiles, TransferRateLimit,
+                             FriendRateLimit, AudioInput, AudioOutput,
+                             NotificationOutput>;
+using UiSettingsList = List<AppLayout, Fullscreen, Geometry>;
+using AllSettings = Concat<ToxSettingsList, UiSettingsList>::Type;
+
+}
+
+#endif
@@ -0,0 +1,272 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "SettingsStore.h"
+
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+
+#include <algorithm>
+
+static_assert(SettingsSchema::Count <= 32,
+              "SettingsStore::dirty_ has a bit per setting");
+
+/**
+@class SettingsStore
+@brief Holds the Toxer settings of a scope in memory.
+
+The settings file is read once, when the store is created. The values are
+decoded into their SettingsSchema types and indexed by their schema id, so
+reads are served from memory without key lookup or conversion. Changes are
+written back in batches, at most every SettingsStore::WriteDelay
+milliseconds and when the application quits. Frequent changes, like the
+window geometry during a resize, therefore don't touch the file system.
+
+There is one store per scope. All Settings instances of the scope share it
+and are notified through SettingsStore::changed. The store is thread-safe.
+
+Other processes sharing the settings file, e.g. further Toxer instances,
+may change it at any time. The store watches the file, reloads it
+SettingsStore::ReloadDelay milliseconds after a modification and reports
+only the settings whose values differ.
+
+
+@var SettingsStore::WriteDelay
+@brief The time in milliseconds changes are collected before writing.
+
+@var SettingsStore::ReloadDelay
+@brief The time in milliseconds file modifications are collected before
+reloading.
+
+
+@fn SettingsStore::get
+@brief Returns the value of a setting.
+@tparam S   the SettingsSchema declaration of the setting
+
+
+@fn SettingsStore::set
+@brief Changes the value of a setting.
+@tparam S   the SettingsSchema declaration of the setting
+@param[in] value    the new value
+
+The change is visible immediately and written to the file later.
+
+
+@fn SettingsStore::changed
+@brief Emitted when a setting was changed.
+@param[in] id   the SettingsSchema::Id of the setting
+*/
+
+constexpr int SettingsStore::WriteDelay;
+constexpr int SettingsStore::ReloadDelay;
+
+namespace {
+
+struct Load
+{
+    const QSettings& settings;
+    QVariant* values;
+    quint32 keep;
+    quint32 changed;
+
+    template<typename S>
+    void operator()(S)
+    {
+        using T = typename S::Type;
+        const quint32 bit = 1u << S::id();
+        if (keep & bit) {
+            return;
+        }
+
+        const QString key = QLatin1String(S::key());
+        const T value = settings.contains(key)
+                ? SettingsSchema::Codec<T>::decode(settings.value(key),
+                                                   S::defaultValue())
+                : S::defaultValue();
+        QVariant& current = values[S::id()];
+        if (!current.isValid() || current.template value<T>() != value) {
+            current = QVariant::fromValue(value);
+            changed |= bit;
+        }
+    }
+};
+
+struct Store
+{
+    QSettings& settings;
+    const QVariant* values;
+    quint32 dirty;
+
+    template<typename S>
+    void operator()(S) const
+    {
+        using T = typename S::Type;
+        if (dirty & (1u << S::id())) {
+            settings.setValue(QLatin1String(S::key()),
+                              SettingsSchema::Codec<T>::encode(
+                                  values[S::id()].template value<T>()));
+        }
+    }
+};
+
+}
+
+/**
+@brief Returns the settings store of a scope.
+@param[in] scope    the settings scope
+*/
+SettingsStore* SettingsStore::instance(QSettings::Scope scope)
+{
+    static SettingsStore user(QSettings::UserScope);
+    static SettingsStore system(QSettings::SystemScope);
+    return scope == QSettings::SystemScope ? &system : &user;
+}
+
+/**
+@brief constructor
+@param[in] scope    the settings scope
+
+Reads the settings file. The store always lives in the main thread, even if
+it was first used by a worker. Watching the file starts in the main thread.
+*/
+SettingsStore::SettingsStore(QSettings::Scope scope)
+    : QObject()
+    , settings_(QSettings::IniFormat, scope, QStringLiteral("Toxer"),
+                QStringLiteral("Settings"))
+    , dirty_(0)
+    , timer_(this)
+    , reload_(this)
+    , watcher_(new QFileSystemWatcher(this))
+{
+    Load load = { settings_, values_, 0, 0 };
+    SettingsSchema::forEach(SettingsSchema::AllSettings(), load);
+
+    reload_.setSingleShot(true);
+    reload_.setInterval(ReloadDelay);
+    connect(&reload_, &QTimer::timeout, this, &SettingsStore::reload);
+
+    connect(watcher_, &QFileSystemWatcher::fileChanged, this, [this]() {
+        watch();
+        reload_.start();
+    });
+    connect(watcher_, &QFileSystemWatcher::directoryChanged,
+            this, &SettingsStore::watch);
+
+    timer_.setSingleShot(true);
+    timer_.setInterval(WriteDelay);
+    connect(&timer_, &QTimer::timeout, this, &SettingsStore::flush);
+
+    QCoreApplication* app = QCoreApplication::instance();
+    if (app) {
+        moveToThread(app->thread());
+        connect(app, &QCoreApplication::aboutToQuit,
+                this, &SettingsStore::flush);
+    }
+
+    QMetaObject::invokeMethod(this, "watch", Qt::QueuedConnection);
+}
+
+/**
+@brief destructor
+
+Writes pending changes.
+*/
+SettingsStore::~SettingsStore()
+{
+    flush();
+}
+
+/**
+@brief Writes pending changes to the settings file.
+*/
+void SettingsStore::flush()
+{
+    QMutexLocker lock(&mutex_);
+    if (!dirty_) {
+        return;
+    }
+
+    QVariant values[SettingsSchema::Count];
+    std::copy(values_, values_ + SettingsSchema::Count, values);
+    Store store = { settings_, values, dirty_ };
+    dirty_ = 0;
+    lock.unlock();
+
+    SettingsSchema::forEach(SettingsSchema::AllSettings(), store);
+    settings_.sync();
+}
+
+/**
+@brief Watches the settings file.
+
+The file is replaced on every write, which drops it from the watcher. The
+directory is watched as well, so the file is picked up again or when it is
+created. Picking up the file schedules a reload.
+*/
+void SettingsStore::watch()
+{
+    const QFileInfo file(settings_.fileName());
+    const QString dir = file.absolutePath();
+    if (QFileInfo::exists(dir) && !watcher_->directories().contains(dir)) {
+        watcher_->addPath(dir);
+    }
+    if (file.exists() && !watcher_->files().contains(file.filePath())) {
+        watcher_->addPath(file.filePath());
+        reload_.start();
+    }
+}
+
+/**
+@brief Reloads the settings file and reports the settings that changed.
+
+Settings with pending local changes keep their local value.
+*/
+void SettingsStore::reload()
+{
+    settings_.sync();
+
+    QMutexLocker lock(&mutex_);
+    Load load = { settings_, values_, dirty_, 0 };
+    SettingsSchema::forEach(SettingsSchema::AllSettings(), load);
+    lock.unlock();
+
+    for (int id = 0; id < SettingsSchema::Count; id++) {
+        if (load.changed & (1u << id)) {
+            emit changed(id);
+        }
+    }
+}
+
+/**
+@brief Opens the write window unless a write is already scheduled.
+*/
+void SettingsStore::schedule()
+{
+    if (!timer_.isActive()) {
+        timer_.start();
+    }
+}
@@ -0,0 +1,102 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef TOXER_PRIVATE_SETTINGSSTORE_H
+#define TOXER_PRIVATE_SETTINGSSTORE_H
+
+#include "SettingsSchema.h"
+
+#include <QMutex>
+#include <QObject>
+#include <QSettings>
+#include <QTimer>
+
+class QFileSystemWatcher;
+
+class SettingsStore final : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr int WriteDelay = 1000;
+    static constexpr int ReloadDelay = 200;
+
+public:
+    static SettingsStore* instance(QSettings::Scope scope);
+
+    ~SettingsStore() override;
+
+    template<typename S>
+    typename S::Type get() const
+    {
+        QMutexLocker lock(&mutex_);
+        return values_[S::id()].template value<typename S::Type>();
+    }
+
+    template<typename S>
+    void set(const typename S::Type& value)
+    {
+        QMutexLocker lock(&mutex_);
+        if (values_[S::id()].template value<typename S::Type>() == value) {
+            return;
+        }
+
+        values_[S::id()] = QVariant::fromValue(value);
+        const bool scheduled = dirty_ != 0;
+        dirty_ |= 1u << S::id();
+        lock.unlock();
+
+        if (!scheduled) {
+            QMetaObject::invokeMethod(this, "schedule", Qt::QueuedConnection);
+        }
+        emit changed(S::id());
+    }
+
+public slots:
+    void flush();
+
+signals:
+    void changed(int id);
+
+private slots:
+    void schedule();
+    void watch();
+    void reload();
+
+private:
+    explicit SettingsStore(QSettings::Scope scope);
+
+private:
+    QSettings settings_;
+    mutable QMutex mutex_;
+    QVariant values_[SettingsSchema::Count];
+    quint32 dirty_;
+    QTimer timer_;
+    QTimer reload_;
+    QFileSystemWatcher* watcher_;
+};
+
+#endif
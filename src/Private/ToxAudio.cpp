@@ -0,0 +1,794 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "ToxAudio.h"
+
+#include <QAudioDeviceInfo>
+#include <QAudioInput>
+#include <QAudioOutput>
+#include <QFile>
+#include <QSemaphore>
+#include <QSysInfo>
+#include <QThread>
+#include <QVector>
+#include <QtEndian>
+
+#include <cstring>
+
+namespace {
+
+constexpr int WavHeaderSize = 44;
+constexpr quint32 DeviceRingSize = ToxAudio::SampleRate / 5;
+constexpr int DeviceBufferMs = 60;
+
+quint32 nextPowerOfTwo(quint32 value)
+{
+    quint32 out = 1;
+    while (out < value) {
+        out <<= 1;
+    }
+    return out;
+}
+
+QByteArray wavHeader(quint32 dataSize)
+{
+    QByteArray out(WavHeaderSize, Qt::Uninitialized);
+    uchar* h = reinterpret_cast<uchar*>(out.data());
+    const quint16 blockAlign = ToxAudio::Channels * sizeof(qint16);
+    std::memcpy(h, "RIFF", 4);
+    qToLittleEndian<quint32>(dataSize + WavHeaderSize - 8, h + 4);
+    std::memcpy(h + 8, "WAVEfmt ", 8);
+    qToLittleEndian<quint32>(16, h + 16);
+    qToLittleEndian<quint16>(1, h + 20);
+    qToLittleEndian<quint16>(ToxAudio::Channels, h + 22);
+    qToLittleEndian<quint32>(ToxAudio::SampleRate, h + 24);
+    qToLittleEndian<quint32>(ToxAudio::SampleRate * blockAlign, h + 28);
+    qToLittleEndian<quint16>(blockAlign, h + 32);
+    qToLittleEndian<quint16>(16, h + 34);
+    std::memcpy(h + 36, "data", 4);
+    qToLittleEndian<quint32>(dataSize, h + 40);
+    return out;
+}
+
+class NullSource final : public IToxAudioSource
+{
+public:
+    bool open() final
+    {
+        return true;
+    }
+
+    quint32 read(qint16* samples, quint32 count) final
+    {
+        std::memset(samples, 0, count * sizeof(qint16));
+        return count;
+    }
+
+    void close() final
+    {
+    }
+};
+
+class NullSink final : public IToxAudioSink
+{
+public:
+    bool open() final
+    {
+        return true;
+    }
+
+    void write(const qint16*, quint32) final
+    {
+    }
+
+    void close() final
+    {
+    }
+};
+
+/**
+Plays a 16 bit PCM WAV file in a loop. The file is read and converted to the
+call format when opened, reading is a copy from memory.
+*/
+class WavSource final : public IToxAudioSource
+{
+public:
+    explicit WavSource(const QString& fileName)
+        : fileName_(fileName)
+        , position_(0)
+    {
+    }
+
+    bool open() final
+    {
+        QFile f(fileName_);
+        if (!f.open(QFile::ReadOnly)) {
+            return false;
+        }
+
+        const QByteArray data = f.readAll();
+        if (data.size() < 12 || !data.startsWith("RIFF") ||
+            data.mid(8, 4) != "WAVE")
+        {
+            return false;
+        }
+
+        const uchar* p = reinterpret_cast<const uchar*>(data.constData());
+        quint16 channels = 0;
+        quint32 sampleRate = 0;
+        int pos = 12;
+        while (pos + 8 <= data.size()) {
+            const QByteArray id = data.mid(pos, 4);
+            const int size = static_cast<int>(
+                        qFromLittleEndian<quint32>(p + pos + 4));
+            pos += 8;
+            if (size < 0 || pos + size > data.size()) {
+                break;
+            }
+
+            if (id == "fmt " && size >= 16) {
+                const quint16 format = qFromLittleEndian<quint16>(p + pos);
+                const quint16 bits = qFromLittleEndian<quint16>(p + pos + 14);
+                if (format != 1 || bits != 16) {
+                    qWarning("Unsupported WAV format in %s.",
+                             qUtf8Printable(fileName_));
+                    return false;
+                }
+                channels = qFromLittleEndian<quint16>(p + pos + 2);
+                sampleRate = qFromLittleEndian<quint32>(p + pos + 4);
+            } else if (id == "data" && channels > 0 && sampleRate > 0) {
+                const quint32 frames = static_cast<quint32>(size) /
+                                       (channels * sizeof(qint16));
+                const quint32 capacity = static_cast<quint32>(
+                            quint64(frames) * ToxAudio::SampleRate /
+                            sampleRate + 1);
+                samples_.resize(static_cast<int>(capacity));
+                const quint32 count = ToxAudio::convert(
+                            reinterpret_cast<const qint16*>(p + pos), frames,
+                            static_cast<quint8>(channels), sampleRate,
+                            samples_.data(), capacity);
+                samples_.resize(static_cast<int>(count));
+                position_ = 0;
+                return count > 0;
+            }
+
+            pos += size + (size & 1);
+        }
+
+        return false;
+    }
+
+    quint32 read(qint16* samples, quint32 count) final
+    {
+        const quint32 size = static_cast<quint32>(samples_.size());
+        quint32 done = 0;
+        while (done < count) {
+            const quint32 n = qMin(count - done, size - position_);
+            std::memcpy(samples + done, samples_.constData() + position_,
+                        n * sizeof(qint16));
+            done += n;
+            position_ = (position_ + n) % size;
+        }
+        return count;
+    }
+
+    void close() final
+    {
+        samples_.clear();
+    }
+
+private:
+    const QString fileName_;
+    QVector<qint16> samples_;
+    quint32 position_;
+};
+
+/**
+Records the audio to a 16 bit PCM WAV file in the call format. The sizes in
+the header are filled in when closed.
+*/
+class WavSink final : public IToxAudioSink
+{
+public:
+    explicit WavSink(const QString& fileName)
+        : file_(fileName)
+        , size_(0)
+    {
+    }
+
+    bool open() final
+    {
+        size_ = 0;
+        return file_.open(QFile::WriteOnly | QFile::Truncate) &&
+               file_.write(wavHeader(0)) == WavHeaderSize;
+    }
+
+    void write(const qint16* samples, quint32 count) final
+    {
+        const qint64 len = count * sizeof(qint16);
+        if (file_.write(reinterpret_cast<const char*>(samples), len) == len) {
+            size_ += static_cast<quint32>(len);
+        }
+    }
+
+    void close() final
+    {
+        if (file_.isOpen()) {
+            file_.seek(0);
+            file_.write(wavHeader(size_));
+            file_.close();
+        }
+    }
+
+private:
+    QFile file_;
+    quint32 size_;
+};
+
+/**
+Connects a Qt Multimedia device to a ring. Captured audio is converted to
+the call format and pushed; played audio is popped and spread over the
+channels of the device, with silence on underruns.
+*/
+class DeviceBuffer final : public QIODevice
+{
+public:
+    DeviceBuffer(ToxAudioRing& ring, const QAudioFormat& format)
+        : ring_(ring)
+        , channels_(static_cast<quint8>(format.channelCount()))
+        , sampleRate_(static_cast<quint32>(format.sampleRate()))
+        , scratch_(ToxAudio::SampleRate / 10)
+    {
+    }
+
+protected:
+    qint64 readData(char* data, qint64 maxlen) final
+    {
+        const qint64 frameSize = channels_ * qint64(sizeof(qint16));
+        const quint32 frames = static_cast<quint32>(
+                    qMin<qint64>(maxlen / frameSize, scratch_.size()));
+        const quint32 n = ring_.pop(scratch_.data(), frames);
+        std::memset(scratch_.data() + n, 0, (frames - n) * sizeof(qint16));
+
+        qint16* out = reinterpret_cast<qint16*>(data);
+        for (quint32 i = 0; i < frames; ++i) {
+            for (quint8 c = 0; c < channels_; ++c) {
+                *out++ = scratch_[static_cast<int>(i)];
+            }
+        }
+        return frames * frameSize;
+    }
+
+    qint64 writeData(const char* data, qint64 len) final
+    {
+        const quint32 capacity = static_cast<quint32>(scratch_.size());
+        const quint32 chunk = qMax<quint32>(1, static_cast<quint32>(
+                    quint64(capacity) * sampleRate_ / ToxAudio::SampleRate));
+        const qint16* in = reinterpret_cast<const qint16*>(data);
+        quint32 frames = static_cast<quint32>(
+                    len / (channels_ * qint64(sizeof(qint16))));
+        while (frames > 0) {
+            const quint32 n = qMin(frames, chunk);
+            const quint32 count = ToxAudio::convert(in, n, channels_,
+                                                    sampleRate_,
+                                                    scratch_.data(),
+                                                    capacity);
+            ring_.push(scratch_.constData(), count);
+            in += n * channels_;
+            frames -= n;
+        }
+        return len;
+    }
+
+private:
+    ToxAudioRing& ring_;
+    const quint8 channels_;
+    const quint32 sampleRate_;
+    QVector<qint16> scratch_;
+};
+
+/**
+Runs a Qt Multimedia device on its own thread. The backends of Qt move the
+audio with timers, which need an event loop; the audio thread of calls only
+touches the lock-free ring.
+*/
+class DeviceThread final : public QThread
+{
+public:
+    DeviceThread(QAudio::Mode mode, const QString& name)
+        : mode_(mode)
+        , name_(name)
+        , ring_(DeviceRingSize)
+        , ok_(false)
+    {
+    }
+
+    ~DeviceThread() override
+    {
+        stopDevice();
+    }
+
+    bool startDevice()
+    {
+        start(QThread::TimeCriticalPriority);
+        ready_.acquire();
+        if (!ok_) {
+            wait();
+        }
+        return ok_;
+    }
+
+    void stopDevice()
+    {
+        if (isRunning()) {
+            quit();
+            wait();
+        }
+    }
+
+    inline ToxAudioRing& ring()
+    {
+        return ring_;
+    }
+
+protected:
+    void run() final
+    {
+        const bool input = mode_ == QAudio::AudioInput;
+        QAudioFormat format;
+        const QAudioDeviceInfo info = device(&format);
+        ok_ = !info.isNull();
+        if (!ok_) {
+            ready_.release();
+            return;
+        }
+
+        DeviceBuffer buffer(ring_, format);
+        buffer.open(input ? QIODevice::WriteOnly : QIODevice::ReadOnly);
+        const int bufferSize = format.bytesForDuration(DeviceBufferMs * 1000);
+        QAudioInput* in = nullptr;
+        QAudioOutput* out = nullptr;
+        if (input) {
+            in = new QAudioInput(info, format);
+            in->setBufferSize(bufferSize);
+            in->start(&buffer);
+            ok_ = in->error() == QAudio::NoError;
+        } else {
+            out = new QAudioOutput(info, format);
+            out->setBufferSize(bufferSize);
+            out->start(&buffer);
+            ok_ = out->error() == QAudio::NoError;
+        }
+
+        const bool ok = ok_;
+        ready_.release();
+        if (ok) {
+            exec();
+        }
+
+        if (in) {
+            in->stop();
+            delete in;
+        }
+        if (out) {
+            out->stop();
+            delete out;
+        }
+    }
+
+private:
+    /**
+    Finds the device and a format the conversions handle: 16 bit samples in
+    host byte order. Captured audio is converted from any rate and channel
+    count, played audio must be at ToxAudio::SampleRate.
+    */
+    QAudioDeviceInfo device(QAudioFormat* format) const
+    {
+        QAudioDeviceInfo info;
+        if (name_.isEmpty()) {
+            info = mode_ == QAudio::AudioInput
+                    ? QAudioDeviceInfo::defaultInputDevice()
+                    : QAudioDeviceInfo::defaultOutputDevice();
+        } else {
+            const auto devices = QAudioDeviceInfo::availableDevices(mode_);
+            for (const QAudioDeviceInfo& d : devices) {
+                if (d.deviceName() == name_) {
+                    info = d;
+                    break;
+                }
+            }
+        }
+        if (info.isNull()) {
+            qWarning("Audio device \"%s\" not found.",
+                     qUtf8Printable(name_));
+            return {};
+        }
+
+        QAudioFormat f;
+        f.setSampleRate(static_cast<int>(ToxAudio::SampleRate));
+        f.setChannelCount(ToxAudio::Channels);
+        f.setSampleSize(16);
+        f.setSampleType(QAudioFormat::SignedInt);
+        f.setByteOrder(static_cast<QAudioFormat::Endian>(QSysInfo::ByteOrder));
+        f.setCodec(QStringLiteral("audio/pcm"));
+        if (!info.isFormatSupported(f)) {
+            f = info.nearestFormat(f);
+        }
+
+        const bool rateOk = mode_ == QAudio::AudioInput ||
+                static_cast<quint32>(f.sampleRate()) == ToxAudio::SampleRate;
+        if (f.sampleSize() != 16 || f.sampleType() != QAudioFormat::SignedInt ||
+            f.byteOrder() != static_cast<QAudioFormat::Endian>(
+                    QSysInfo::ByteOrder) ||
+            f.channelCount() < 1 || f.channelCount() > 255 || !rateOk)
+        {
+            qWarning("Audio device \"%s\" has no usable format.",
+                     qUtf8Printable(info.deviceName()));
+            return {};
+        }
+
+        *format = f;
+        return info;
+    }
+
+private:
+    const QAudio::Mode mode_;
+    const QString name_;
+    ToxAudioRing ring_;
+    QSemaphore ready_;
+    bool ok_;
+};
+
+/**
+Captures from an audio device. Audio beyond twice the requested amount is
+dropped, so a device clock running ahead of the calls does not build up
+latency.
+*/
+class DeviceSource final : public IToxAudioSource
+{
+public:
+    explicit DeviceSource(const QString& name)
+        : thread_(QAudio::AudioInput, name)
+    {
+    }
+
+    bool open() final
+    {
+        return thread_.startDevice();
+    }
+
+    quint32 read(qint16* samples, quint32 count) final
+    {
+        ToxAudioRing& ring = thread_.ring();
+        const quint32 available = ring.available();
+        if (available > 4 * count) {
+            ring.skip(available - 2 * count);
+        }
+
+        const quint32 n = ring.pop(samples, count);
+        std::memset(samples + n, 0, (count - n) * sizeof(qint16));
+        return count;
+    }
+
+    void close() final
+    {
+        thread_.stopDevice();
+    }
+
+private:
+    DeviceThread thread_;
+};
+
+/**
+Plays to an audio device. Audio that does not fit into the ring is dropped.
+*/
+class DeviceSink final : public IToxAudioSink
+{
+public:
+    explicit DeviceSink(const QString& name)
+        : thread_(QAudio::AudioOutput, name)
+    {
+    }
+
+    bool open() final
+    {
+        return thread_.startDevice();
+    }
+
+    void write(const qint16* samples, quint32 count) final
+    {
+        thread_.ring().push(samples, count);
+    }
+
+    void close() final
+    {
+        thread_.stopDevice();
+    }
+
+private:
+    DeviceThread thread_;
+};
+
+}
+
+/**
+@class ToxAudioRing
+@brief A lock-free ring buffer of audio samples for one producer and one
+consumer thread.
+
+The buffer is allocated once, pushing and popping copy the samples without
+locking or allocating. The capacity is rounded up to a power of two.
+Only the consumer may call available(), pop() and skip().
+
+
+@class IToxAudioSource
+@brief Interface of the audio sources of calls.
+
+A source delivers mono samples at ToxAudio::SampleRate. read() is called
+once per frame on the audio thread and must neither block nor allocate.
+
+
+@class IToxAudioSink
+@brief Interface of the audio sinks of calls.
+
+A sink takes mono samples at ToxAudio::SampleRate. write() is called once
+per frame on the audio thread and must neither block nor allocate.
+
+
+@class ToxAudio
+@brief The audio format of calls and the audio backends.
+
+Calls use frames of ToxAudio::FrameDuration milliseconds of mono audio at
+ToxAudio::SampleRate. The backends are selected by a device string:
+- "default": the default audio device of the system
+- "device:<name>": the audio device with the given Qt Multimedia name
+- "null": silence as source, discard as sink
+- "wav:<file>": play a WAV file in a loop as source, record to it as sink
+
+Audio devices run on a thread of their own and exchange the samples with
+the audio thread through a ToxAudioRing. The file backends make it possible
+to run and benchmark calls headless.
+
+
+@var ToxAudio::SampleRate
+@brief The sample rate of the call audio in Hz.
+
+@var ToxAudio::Channels
+@brief The number of channels of the call audio.
+
+@var ToxAudio::FrameDuration
+@brief The duration of an audio frame in milliseconds.
+
+@var ToxAudio::FrameSamples
+@brief The number of samples of an audio frame.
+*/
+
+constexpr quint32 ToxAudio::SampleRate;
+constexpr quint8 ToxAudio::Channels;
+constexpr quint32 ToxAudio::FrameDuration;
+constexpr quint32 ToxAudio::FrameSamples;
+
+/**
+@brief constructor
+@param[in] capacity     the minimum number of samples the ring holds
+*/
+ToxAudioRing::ToxAudioRing(quint32 capacity)
+    : mask_(nextPowerOfTwo(capacity) - 1)
+    , buffer_(new qint16[mask_ + 1])
+    , head_(0)
+    , tail_(0)
+{
+}
+
+/**
+@brief Returns the number of samples the ring holds.
+*/
+quint32 ToxAudioRing::capacity() const
+{
+    return mask_ + 1;
+}
+
+/**
+@brief Returns the number of samples ready to be popped.
+*/
+quint32 ToxAudioRing::available() const
+{
+    return head_.loadAcquire() - tail_.load();
+}
+
+/**
+@brief Appends samples to the ring.
+@param[in] samples  the samples
+@param[in] count    the number of samples
+@return the number of samples appended; less than count, if the ring is full
+*/
+quint32 ToxAudioRing::push(const qint16* samples, quint32 count)
+{
+    const quint32 head = head_.load();
+    const quint32 free = capacity() - (head - tail_.loadAcquire());
+    count = qMin(count, free);
+
+    const quint32 start = head & mask_;
+    const quint32 first = qMin(count, capacity() - start);
+    std::memcpy(buffer_.get() + start, samples, first * sizeof(qint16));
+    std::memcpy(buffer_.get(), samples + first,
+                (count - first) * sizeof(qint16));
+
+    head_.storeRelease(head + count);
+    return count;
+}
+
+/**
+@brief Takes samples from the ring.
+@param[out] samples     the buffer for the samples
+@param[in] count        the number of samples to take
+@return the number of samples taken; less than count, if the ring ran empty
+*/
+quint32 ToxAudioRing::pop(qint16* samples, quint32 count)
+{
+    const quint32 tail = tail_.load();
+    count = qMin(count, head_.loadAcquire() - tail);
+
+    const quint32 start = tail & mask_;
+    const quint32 first = qMin(count, capacity() - start);
+    std::memcpy(samples, buffer_.get() + start, first * sizeof(qint16));
+    std::memcpy(samples + first, buffer_.get(),
+                (count - first) * sizeof(qint16));
+
+    tail_.storeRelease(tail + count);
+    return count;
+}
+
+/**
+@brief Drops samples from the ring.
+@param[in] count    the number of samples to drop
+@return the number of samples dropped
+*/
+quint32 ToxAudioRing::skip(quint32 count)
+{
+    const quint32 tail = tail_.load();
+    count = qMin(count, head_.loadAcquire() - tail);
+    tail_.storeRelease(tail + count);
+    return count;
+}
+
+/**
+@brief IToxAudioSource destructor
+*/
+IToxAudioSource::~IToxAudioSource()
+{
+}
+
+/**
+@brief IToxAudioSink destructor
+*/
+IToxAudioSink::~IToxAudioSink()
+{
+}
+
+/**
+@brief Creates an audio source.
+@param[in] device   the device string
+@return the source; a silent source for unknown devices
+*/
+IToxAudioSource* ToxAudio::createSource(const QString& device)
+{
+    if (device.startsWith(QLatin1String("wav:"))) {
+        return new WavSource(device.mid(4));
+    } else if (device == QLatin1String("default")) {
+        return new DeviceSource(QString());
+    } else if (device.startsWith(QLatin1String("device:"))) {
+        return new DeviceSource(device.mid(7));
+    }
+
+    if (device != QLatin1String("null")) {
+        qWarning("Unknown audio input \"%s\", using silence.",
+                 qUtf8Printable(device));
+    }
+    return new NullSource();
+}
+
+/**
+@brief Creates an audio sink.
+@param[in] device   the device string
+@return the sink; a discarding sink for unknown devices
+*/
+IToxAudioSink* ToxAudio::createSink(const QString& device)
+{
+    if (device.startsWith(QLatin1String("wav:"))) {
+        return new WavSink(device.mid(4));
+    } else if (device == QLatin1String("default")) {
+        return new DeviceSink(QString());
+    } else if (device.startsWith(QLatin1String("device:"))) {
+        return new DeviceSink(device.mid(7));
+    }
+
+    if (device != QLatin1String("null")) {
+        qWarning("Unknown audio output \"%s\", discarding audio.",
+                 qUtf8Printable(device));
+    }
+    return new NullSink();
+}
+
+/**
+@brief Converts interleaved audio to the call format.
+@param[in] in           the interleaved samples
+@param[in] frames       the number of samples per channel
+@param[in] channels     the number of channels
+@param[in] sampleRate   the sample rate in Hz
+@param[out] out         the buffer for the converted samples
+@param[in] size         the size of the buffer in samples
+@return the number of converted samples
+
+The channels are mixed down. When upsampling, the output samples are
+interpolated linearly between the two nearest input samples. When
+downsampling, each output sample is the average of the input samples of its
+period, which filters out most of the frequencies that would alias. Neither
+allocates.
+*/
+quint32 ToxAudio::convert(const qint16* in, quint32 frames, quint8 channels,
+                          quint32 sampleRate, qint16* out, quint32 size)
+{
+    if (channels == 0 || sampleRate == 0 || frames == 0) {
+        return 0;
+    }
+
+    const auto mono = [in, channels](quint64 frame) {
+        const qint16* f = in + frame * channels;
+        int sum = 0;
+        for (quint8 c = 0; c < channels; ++c) {
+            sum += f[c];
+        }
+        return sum / channels;
+    };
+
+    const quint32 count = static_cast<quint32>(
+                qMin<quint64>(quint64(frames) * SampleRate / sampleRate,
+                              size));
+    for (quint32 i = 0; i < count; ++i) {
+        // the position of the output sample in 1/SampleRate input frames
+        const quint64 pos = quint64(i) * sampleRate;
+        const quint64 frame = pos / SampleRate;
+        if (sampleRate > SampleRate) {
+            const quint64 end = qMin<quint64>(
+                        (pos + sampleRate) / SampleRate, frames);
+            qint64 sum = 0;
+            for (quint64 f = frame; f < end; ++f) {
+                sum += mono(f);
+            }
+            out[i] = static_cast<qint16>(
+                        sum / static_cast<qint64>(end - frame));
+        } else {
+            const qint64 frac = static_cast<qint64>(pos % SampleRate);
+            const qint64 a = mono(frame);
+            const qint64 b = frame + 1 < frames ? mono(frame + 1) : a;
+            out[i] = static_cast<qint16>(
+                        a + (b - a) * frac / qint64(SampleRate));
+        }
+    }
+    return count;
+}
@@ -0,0 +1,98 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef TOXER_PRIVATE_TOXAUDIO_H
+#define TOXER_PRIVATE_TOXAUDIO_H
+
+#include <QAtomicInteger>
+#include <QString>
+
+#include <memory>
+
+class ToxAudioRing final
+{
+public:
+    explicit ToxAudioRing(quint32 capacity);
+
+    ToxAudioRing(const ToxAudioRing& other) = delete;
+    ToxAudioRing& operator=(const ToxAudioRing& other) = delete;
+
+    quint32 capacity() const;
+    quint32 available() const;
+
+    quint32 push(const qint16* samples, quint32 count);
+    quint32 pop(qint16* samples, quint32 count);
+    quint32 skip(quint32 count);
+
+private:
+    const quint32 mask_;
+    std::unique_ptr<qint16[]> buffer_;
+    QAtomicInteger<quint32> head_;
+    QAtomicInteger<quint32> tail_;
+};
+
+class IToxAudioSource
+{
+public:
+    virtual ~IToxAudioSource();
+
+    virtual bool open() = 0;
+    virtual quint32 read(qint16* samples, quint32 count) = 0;
+    virtual void close() = 0;
+};
+
+class IToxAudioSink
+{
+public:
+    virtual ~IToxAudioSink();
+
+    virtual bool open() = 0;
+    virtual void write(const qint16* samples, quint32 count) = 0;
+    virtual void close() = 0;
+};
+
+class ToxAudio final
+{
+public:
+    static constexpr quint32 SampleRate = 48000;
+    static constexpr quint8 Channels = 1;
+    static constexpr quint32 FrameDuration = 20;
+    static constexpr quint32 FrameSamples = SampleRate * FrameDuration / 1000;
+
+public:
+    static IToxAudioSource* createSource(const QString& device);
+    static IToxAudioSink* createSink(const QString& device);
+
+    static quint32 convert(const qint16* in, quint32 frames, quint8 channels,
+                           quint32 sampleRate, qint16* out, quint32 size);
+
+private:
+    ToxAudio() = delete;
+    ~ToxAudio() = delete;
+};
+
+#endif
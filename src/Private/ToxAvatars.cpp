@@ -0,0 +1,329 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "ToxAvatars.h"
+
+#include "ToxThumbnails.h"
+#include "ToxerPrivate.h"
+
+#include <tox/tox.h>
+
+#include <QBuffer>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QImageReader>
+#include <QRunnable>
+#include <QStringBuilder>
+
+/**
+@class ToxAvatars
+@brief The content-addressed avatar store.
+
+Avatars are stored in the avatars directory under the hex encoded tox_hash
+of their data, so an avatar shared by several friends or profiles is kept
+once. An index maps the public key of each friend to the hash of the
+current avatar. The index and the list of stored avatars are read once and
+kept in memory, so looking up an avatar costs no file system access.
+
+Decoded avatars are kept in a LRU cache of ToxAvatars::CacheSize bytes,
+scaled to the size they were requested in. Files are written on a worker
+thread. Until then, the data is served from memory.
+
+All functions are thread-safe.
+
+
+@var ToxAvatars::MaxSize
+@brief The maximum size of an avatar file in bytes.
+
+@var ToxAvatars::CacheSize
+@brief The size of the decoded avatar cache in bytes.
+
+
+@class ToxAvatarProvider
+@brief Serves avatars to QML.
+
+The image id is the hash of an avatar as returned by ToxFriendQuery::avatar.
+The avatar is decoded by ToxThumbnails, scaled to the requested sourceSize.
+*/
+
+namespace {
+
+constexpr quint32 IndexMagic = 0x54584156; // "TXAV"
+constexpr quint8 IndexVersion = 1;
+
+}
+
+constexpr quint64 ToxAvatars::MaxSize;
+constexpr int ToxAvatars::CacheSize;
+
+class ToxAvatars::WriteJob final : public QRunnable
+{
+public:
+    WriteJob(const QString& fileName, const QByteArray& data,
+             const QByteArray& hash = QByteArray())
+        : fileName_(fileName)
+        , data_(data)
+        , hash_(hash)
+    {
+    }
+
+    void run() final
+    {
+        QDir().mkpath(ToxAvatars::dir());
+        ToxerPrivate::writeCache(fileName_, data_);
+        if (!hash_.isEmpty()) {
+            ToxAvatars::instance().written(hash_);
+        }
+    }
+
+private:
+    const QString fileName_;
+    const QByteArray data_;
+    const QByteArray hash_;
+};
+
+ToxAvatars& ToxAvatars::instance()
+{
+    static ToxAvatars avatars;
+    return avatars;
+}
+
+/**
+@brief constructor
+
+Reads the index and lists the stored avatars.
+*/
+ToxAvatars::ToxAvatars()
+    : images_(CacheSize)
+{
+    pool_.setMaxThreadCount(1);
+
+    const QDir d(dir());
+    const QStringList names = d.entryList(QDir::Files);
+    for (const QString& name : names) {
+        const QByteArray hash = QByteArray::fromHex(name.toLatin1());
+        if (hash.size() == TOX_HASH_LENGTH) {
+            stored_.insert(hash);
+        }
+    }
+
+    QFile f(d.filePath(QStringLiteral("index")));
+    if (!f.open(QFile::ReadOnly)) {
+        return;
+    }
+
+    QDataStream in(&f);
+    quint32 magic = 0;
+    quint8 version = 0;
+    in >> magic >> version;
+    if (magic != IndexMagic || version != IndexVersion) {
+        return;
+    }
+
+    QHash<QByteArray, QByteArray> index;
+    in >> index;
+    if (in.status() == QDataStream::Ok) {
+        index_ = index;
+    }
+}
+
+/**
+@brief destructor
+
+Waits for pending writes.
+*/
+ToxAvatars::~ToxAvatars()
+{
+    pool_.waitForDone();
+}
+
+/**
+@brief Returns the avatar of a friend.
+@param[in] publicKey    the public key of the friend
+@return the hash of the avatar; empty if the friend has no avatar
+*/
+QByteArray ToxAvatars::avatar(const QByteArray& publicKey) const
+{
+    QMutexLocker lock(&mutex_);
+    return index_.value(publicKey);
+}
+
+/**
+@brief Sets the avatar of a friend.
+@param[in] publicKey    the public key of the friend
+@param[in] hash         the hash of the avatar; empty to remove it
+@return true, if the avatar changed
+*/
+bool ToxAvatars::setAvatar(const QByteArray& publicKey,
+                           const QByteArray& hash)
+{
+    QMutexLocker lock(&mutex_);
+    if (index_.value(publicKey) == hash) {
+        return false;
+    }
+
+    if (hash.isEmpty()) {
+        index_.remove(publicKey);
+    } else {
+        index_.insert(publicKey, hash);
+    }
+    saveIndex();
+    return true;
+}
+
+/**
+@brief Returns, if an avatar is stored.
+@param[in] hash     the hash of the avatar
+*/
+bool ToxAvatars::contains(const QByteArray& hash) const
+{
+    QMutexLocker lock(&mutex_);
+    return stored_.contains(hash) || pending_.contains(hash);
+}
+
+/**
+@brief Stores an avatar.
+@param[in] data     the image data
+@return the hash of the avatar; empty on failure
+
+The file is written in the background.
+*/
+QByteArray ToxAvatars::store(const QByteArray& data)
+{
+    QByteArray hash(TOX_HASH_LENGTH, 0);
+    if (!tox_hash(reinterpret_cast<uint8_t*>(hash.data()),
+                  reinterpret_cast<const uint8_t*>(data.constData()),
+                  static_cast<size_t>(data.size())))
+    {
+        return QByteArray();
+    }
+
+    QMutexLocker lock(&mutex_);
+    if (!stored_.contains(hash) && !pending_.contains(hash)) {
+        pending_.insert(hash, data);
+        pool_.start(new WriteJob(fileName(hash), data, hash));
+    }
+    return hash;
+}
+
+/**
+@brief Returns a decoded avatar.
+@param[in] hash     the hash of the avatar
+@param[in] size     the size to fit the avatar in; invalid for the full size
+@return the avatar; a null image if it is unknown or broken
+
+The avatar is decoded at the fitting size straight away and cached.
+*/
+QImage ToxAvatars::image(const QByteArray& hash, const QSize& size)
+{
+    const QString key = QString::fromLatin1(hash.toHex()) %
+            QLatin1Char('@') % QString::number(size.width()) %
+            QLatin1Char('x') % QString::number(size.height());
+
+    QMutexLocker lock(&mutex_);
+    if (const QImage* cached = images_.object(key)) {
+        return *cached;
+    }
+    const QByteArray data = pending_.value(hash);
+    const bool stored = stored_.contains(hash);
+    lock.unlock();
+
+    QBuffer buffer;
+    QImageReader reader;
+    if (!data.isNull()) {
+        buffer.setData(data);
+        reader.setDevice(&buffer);
+    } else if (stored) {
+        reader.setFileName(fileName(hash));
+    } else {
+        return QImage();
+    }
+
+    const QSize full = reader.size();
+    if (full.isValid() && (size.width() > 0 || size.height() > 0)) {
+        reader.setScaledSize(ToxThumbnails::fit(full, size));
+    }
+
+    const QImage img = reader.read();
+    if (img.isNull()) {
+        return img;
+    }
+
+    lock.relock();
+    images_.insert(key, new QImage(img), img.bytesPerLine() * img.height());
+    return img;
+}
+
+/**
+@brief Moves an avatar from memory to the stored avatars.
+@param[in] hash     the hash of the written avatar
+*/
+void ToxAvatars::written(const QByteArray& hash)
+{
+    QMutexLocker lock(&mutex_);
+    pending_.remove(hash);
+    stored_.insert(hash);
+}
+
+/**
+@brief Writes the index in the background.
+@note The mutex must be locked.
+*/
+void ToxAvatars::saveIndex()
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out << IndexMagic << IndexVersion << index_;
+    pool_.start(new WriteJob(dir() % QStringLiteral("/index"), data));
+}
+
+/**
+@brief Returns the absolute path of the avatars directory.
+*/
+QString ToxAvatars::dir()
+{
+    return ToxerPrivate::profilesDir() % QStringLiteral("/avatars");
+}
+
+/**
+@brief Returns the absolute path of a stored avatar.
+@param[in] hash     the hash of the avatar
+*/
+QString ToxAvatars::fileName(const QByteArray& hash)
+{
+    return dir() % QLatin1Char('/') % QString::fromLatin1(hash.toHex());
+}
+
+QQuickImageResponse* ToxAvatarProvider::requestImageResponse(
+        const QString& id, const QSize& requestedSize)
+{
+    const QByteArray hash = QByteArray::fromHex(id.toLatin1());
+    return ToxThumbnails::instance().request([hash](const QSize& size) {
+        return ToxAvatars::instance().image(hash, size);
+    }, requestedSize);
+}
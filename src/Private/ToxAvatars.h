@@ -0,0 +1,83 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef TOXER_PRIVATE_TOXAVATARS_H
+#define TOXER_PRIVATE_TOXAVATARS_H
+
+#include <QByteArray>
+#include <QCache>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QQuickAsyncImageProvider>
+#include <QSet>
+#include <QThreadPool>
+
+class ToxAvatars final
+{
+public:
+    static constexpr quint64 MaxSize = 64 * 1024;
+    static constexpr int CacheSize = 16 * 1024 * 1024;
+
+public:
+    static ToxAvatars& instance();
+
+    QByteArray avatar(const QByteArray& publicKey) const;
+    bool setAvatar(const QByteArray& publicKey, const QByteArray& hash);
+    bool contains(const QByteArray& hash) const;
+    QByteArray store(const QByteArray& data);
+    QImage image(const QByteArray& hash, const QSize& size);
+
+private:
+    ToxAvatars();
+    ~ToxAvatars();
+
+    void written(const QByteArray& hash);
+    void saveIndex();
+
+    static QString dir();
+    static QString fileName(const QByteArray& hash);
+
+private:
+    class WriteJob;
+
+    mutable QMutex mutex_;
+    QHash<QByteArray, QByteArray> index_;
+    QSet<QByteArray> stored_;
+    QHash<QByteArray, QByteArray> pending_;
+    QCache<QString, QImage> images_;
+    QThreadPool pool_;
+};
+
+class ToxAvatarProvider final : public QQuickAsyncImageProvider
+{
+public:
+    QQuickImageResponse* requestImageResponse(
+            const QString& id, const QSize& requestedSize) override;
+};
+
+#endif
@@ -26,7 +26,536 @@
 
 #include "ToxBootstrap.h"
 
+#include <QDateTime>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRunnable>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QStringBuilder>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <cctype>
+
 /**
 @struct BootstrapNode
 @brief describes a Tox DHT-node
+
+
+@class ToxBootstrapper
+@brief Selects bootstrap nodes by their health record.
+
+The nodes are loaded once from the file "Toxer/nodes.json" in the user's
+configuration directory. The file uses the format of the public Tox node list
+(https://nodes.tox.chat/json), so it may be a download of that list or a list
+of private nodes. Invalid entries are skipped. Without a usable file the
+built-in bootstrap_nodes table is used.
+
+A Tox instance is bootstrapped from the ToxBootstrapper::CachedFanOut most
+recently seen nodes of the ToxNodeCache of its profile first. The static
+nodes are contacted in the same round as fallback.
+
+Each bootstrap round contacts ToxBootstrapper::FanOut nodes at once. A round
+succeeds when the Tox instance reports a connection for the first time; all
+nodes of the round are credited with the time it took. A round that stays
+unanswered for ToxBootstrapper::RoundTimeout counts as failure for its nodes.
+
+Nodes are ranked by success rate and average time to connect. The best
+nodes are preferred, while ToxBootstrapper::Exploration slots are filled
+with random nodes, so new or recovered nodes get a chance. Nodes that failed
+repeatedly are backed off exponentially. The health record is persisted in
+the Toxer "Bootstrap" settings file. Rounds finish on the event loop of a
+profile, so the changed records are only marked there and written by a job
+on the global thread pool.
+
+
+@var ToxBootstrapper::CachedFanOut
+@brief The number of cached nodes contacted per bootstrap round.
+
+@var ToxBootstrapper::FanOut
+@brief The number of nodes contacted per bootstrap round.
+
+@var ToxBootstrapper::Exploration
+@brief The number of randomly selected nodes per bootstrap round.
+
+@var ToxBootstrapper::BackoffBase
+@brief The backoff in milliseconds after the first failure of a node.
+
+@var ToxBootstrapper::BackoffMax
+@brief The maximum backoff in milliseconds.
+
+@var ToxBootstrapper::RoundTimeout
+@brief The time in milliseconds after which a round counts as failed.
+*/
+
+constexpr int ToxBootstrapper::CachedFanOut;
+constexpr int ToxBootstrapper::FanOut;
+constexpr int ToxBootstrapper::Exploration;
+constexpr qint64 ToxBootstrapper::BackoffBase;
+constexpr qint64 ToxBootstrapper::BackoffMax;
+constexpr qint64 ToxBootstrapper::RoundTimeout;
+
+/**
+@brief Writes the changed health records in the background.
+*/
+class ToxBootstrapper::StoreJob final : public QRunnable
+{
+public:
+    void run() final
+    {
+        ToxBootstrapper::instance().persist();
+    }
+};
+
+/**
+@brief Returns the process wide bootstrapper.
+*/
+ToxBootstrapper& ToxBootstrapper::instance()
+{
+    static ToxBootstrapper bootstrapper;
+    return bootstrapper;
+}
+
+/**
+@brief constructor
+
+Loads the node list and the persisted health record.
+*/
+ToxBootstrapper::ToxBootstrapper()
+    : storing_(false)
+    , random_(std::random_device()())
+{
+    const QString nodesFile =
+            QStandardPaths::writableLocation(
+                QStandardPaths::GenericConfigLocation) %
+            QStringLiteral("/Toxer/nodes.json");
+    if (!loadNodes(nodesFile)) {
+        for (const BootstrapNode& n : bootstrap_nodes) {
+            nodes_ << n;
+        }
+    }
+
+    QSettings s(QSettings::IniFormat, QSettings::UserScope,
+                QStringLiteral("Toxer"), QStringLiteral("Bootstrap"));
+    for (const QString& group : s.childGroups()) {
+        s.beginGroup(group);
+        Score score;
+        score.attempts = s.value(QStringLiteral("attempts")).toUInt();
+        score.successes = s.value(QStringLiteral("successes")).toUInt();
+        score.failuresInRow =
+                s.value(QStringLiteral("failures_in_row")).toUInt();
+        score.avgTimeToConnect =
+                s.value(QStringLiteral("avg_time_to_connect")).toLongLong();
+        score.lastFailure =
+                s.value(QStringLiteral("last_failure")).toLongLong();
+        s.endGroup();
+
+        scores_.insert(group.toLatin1(), score);
+    }
+}
+
+/**
+@brief Bootstraps a Tox instance.
+@param[in] tox      the Tox instance
+@param[in] cached   the cached nodes of the profile to contact first
+
+Starts a new bootstrap round. An unanswered previous round of the same
+instance is finished first. An instance that is online already, e.g. when
+bootstrapping again after a network change, gets no status change for the
+nodes, so no round is scored for it.
+*/
+void ToxBootstrapper::bootstrap(Tox* tox,
+                                const QVector<ToxNodeCache::Node>& cached)
+{
+    Q_ASSERT(tox);
+
+    QMutexLocker lock(&mutex_);
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    const bool online =
+            tox_self_get_connection_status(tox) != TOX_CONNECTION_NONE;
+
+    auto it = rounds_.find(tox);
+    if (it != rounds_.end()) {
+        expireRound(tox, *it, now);
+        rounds_.erase(it);
+    }
+
+    bootstrapCached(tox, cached);
+
+    Round round;
+    for (const BootstrapNode* d : select(now, FanOut)) {
+        const QByteArray id = nodeId(*d);
+        TOX_ERR_BOOTSTRAP err = TOX_ERR_BOOTSTRAP_OK;
+        tox_bootstrap(tox, d->address, d->port, d->key, &err);
+        if (err) {
+            qWarning("Failed to bootstrap address %s. Code: %d",
+                     d->address, err);
+            Round bad;
+            bad.nodes << id;
+            finishRound(bad, false, now);
+            continue;
+        }
+
+        tox_add_tcp_relay(tox, d->address, d->port, d->key, &err);
+        if (err) {
+            qWarning("Failed to add TCP relay for %s. Code: %d",
+                     d->address, err);
+        }
+
+        round.nodes << id;
+    }
+
+    if (!online) {
+        round.timer.start();
+        rounds_.insert(tox, round);
+    }
+}
+
+/**
+@brief Adds the best rated nodes as TCP relays.
+@param[in] tox      the Tox instance
+@param[in] count    the number of relays to add
+
+Used when bootstrapping alone does not get the Tox instance online, e.g. on
+networks blocking UDP.
+*/
+void ToxBootstrapper::addRelays(Tox* tox, int count)
+{
+    Q_ASSERT(tox);
+
+    QMutexLocker lock(&mutex_);
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (const BootstrapNode* d : select(now, count)) {
+        TOX_ERR_BOOTSTRAP err = TOX_ERR_BOOTSTRAP_OK;
+        tox_add_tcp_relay(tox, d->address, d->port, d->key, &err);
+        if (err) {
+            qWarning("Failed to add TCP relay for %s. Code: %d",
+                     d->address, err);
+        }
+    }
+}
+
+/**
+@brief Reports a connection status change of a Tox instance.
+@param[in] tox      the Tox instance
+@param[in] status   the new connection status
+
+The first connection after a bootstrap finishes the round successfully.
+*/
+void ToxBootstrapper::connectionChanged(const Tox* tox, TOX_CONNECTION status)
+{
+    if (status == TOX_CONNECTION_NONE) {
+        return;
+    }
+
+    QMutexLocker lock(&mutex_);
+    auto it = rounds_.find(tox);
+    if (it != rounds_.end()) {
+        finishRound(*it, true, QDateTime::currentMSecsSinceEpoch());
+        rounds_.erase(it);
+    }
+}
+
+/**
+@brief Forgets a Tox instance before it is killed.
+@param[in] tox      the Tox instance
+*/
+void ToxBootstrapper::release(const Tox* tox)
+{
+    QMutexLocker lock(&mutex_);
+    auto it = rounds_.find(tox);
+    if (it != rounds_.end()) {
+        expireRound(tox, *it, QDateTime::currentMSecsSinceEpoch());
+        rounds_.erase(it);
+    }
+}
+
+/**
+@brief Scores an unanswered round as failed once it timed out.
+@param[in] tox      the Tox instance of the round
+@param[in] round    the round
+@param[in] now      the current time in milliseconds since the epoch
+
+A round of an instance that is online nevertheless is dropped unscored;
+the status change was missed, the nodes did not fail.
+@note The mutex must be locked.
+*/
+void ToxBootstrapper::expireRound(const Tox* tox, const Round& round,
+                                  qint64 now)
+{
+    if (round.timer.elapsed() >= RoundTimeout &&
+        tox_self_get_connection_status(tox) == TOX_CONNECTION_NONE)
+    {
+        finishRound(round, false, now);
+    }
+}
+
+/**
+@brief Contacts cached nodes of a profile.
+@param[in] tox      the Tox instance
+@param[in] nodes    the cached nodes
+
+Cached nodes are not scored; they change with every session.
+*/
+void ToxBootstrapper::bootstrapCached(Tox* tox,
+                                      const QVector<ToxNodeCache::Node>& nodes)
+{
+    for (const ToxNodeCache::Node& n : nodes) {
+        const uint8_t* key =
+                reinterpret_cast<const uint8_t*>(n.key.constData());
+        TOX_ERR_BOOTSTRAP err = TOX_ERR_BOOTSTRAP_OK;
+        if (n.tcp) {
+            tox_add_tcp_relay(tox, n.address.constData(), n.port, key, &err);
+        } else {
+            tox_bootstrap(tox, n.address.constData(), n.port, key, &err);
+        }
+
+        if (err) {
+            qWarning("Failed to bootstrap cached node %s. Code: %d",
+                     n.address.constData(), err);
+        }
+    }
+}
+
+/**
+@brief Loads the bootstrap nodes from a JSON node list.
+@param[in] fileName     the node list file
+@return true, if at least one valid node was loaded
+
+The addresses of all nodes are packed into a single string table that the
+nodes point into.
 */
+bool ToxBootstrapper::loadNodes(const QString& fileName)
+{
+    QFile f(fileName);
+    if (!f.open(QFile::ReadOnly)) {
+        return false;
+    }
+
+    QJsonParseError error;
+    const QJsonDocument doc = QJsonDocument::fromJson(f.readAll(), &error);
+    if (error.error != QJsonParseError::NoError) {
+        qWarning("Bootstrap node list %s is invalid: %s",
+                 qUtf8Printable(fileName), qUtf8Printable(error.errorString()));
+        return false;
+    }
+
+    QVector<int> offsets;
+    const QJsonArray list = doc.object().value(QStringLiteral("nodes"))
+                            .toArray();
+    for (const QJsonValue& v : list) {
+        const QJsonObject o = v.toObject();
+        if (o.value(QStringLiteral("status_udp")) == QJsonValue(false) &&
+            o.value(QStringLiteral("status_tcp")) == QJsonValue(false))
+        {
+            continue;
+        }
+
+        QString address = o.value(QStringLiteral("ipv4")).toString();
+        if (address.isEmpty() || address == QStringLiteral("-")) {
+            address = o.value(QStringLiteral("ipv6")).toString();
+        }
+        const int port = o.value(QStringLiteral("port")).toInt();
+        const QByteArray hexKey = o.value(QStringLiteral("public_key"))
+                                  .toString().toLatin1();
+        const QByteArray key = QByteArray::fromHex(hexKey);
+        const bool validKey =
+                hexKey.size() == 2 * TOX_PUBLIC_KEY_SIZE &&
+                key.size() == TOX_PUBLIC_KEY_SIZE &&
+                std::all_of(hexKey.cbegin(), hexKey.cend(), [](char c) {
+                    return isxdigit(static_cast<uchar>(c)) != 0;
+                });
+        if (address.isEmpty() || address == QStringLiteral("-") ||
+            port <= 0 || port > 0xffff || !validKey)
+        {
+            qWarning("Skipped invalid bootstrap node %s.",
+                     qUtf8Printable(address));
+            continue;
+        }
+
+        BootstrapNode n;
+        n.address = nullptr;
+        n.port = static_cast<quint16>(port);
+        std::copy(key.cbegin(), key.cend(), n.key);
+        nodes_ << n;
+
+        offsets << addresses_.size();
+        addresses_ += address.toLatin1();
+        addresses_ += '\0';
+    }
+
+    for (int i = 0; i < nodes_.count(); i++) {
+        nodes_[i].address = addresses_.constData() + offsets.at(i);
+    }
+
+    return !nodes_.isEmpty();
+}
+
+/**
+@brief Selects the nodes for a bootstrap round.
+@param[in] now      the current time in milliseconds since epoch
+@param[in] count    the number of nodes to select
+@return up to count nodes
+*/
+QVector<const BootstrapNode*> ToxBootstrapper::select(qint64 now, int count)
+{
+    struct Candidate {
+        const BootstrapNode* node;
+        double rating;
+        qint64 backoff;
+    };
+
+    QVector<Candidate> available;
+    QVector<Candidate> backedOff;
+    for (const BootstrapNode& n : nodes_) {
+        const Score score = scores_.value(nodeId(n));
+        const Candidate c = { &n, rating(score), backoffUntil(score) };
+        if (c.backoff > now) {
+            backedOff << c;
+        } else {
+            available << c;
+        }
+    }
+
+    std::shuffle(available.begin(), available.end(), random_);
+    std::stable_sort(available.begin(), available.end(),
+                     [](const Candidate& a, const Candidate& b) {
+        return a.rating > b.rating;
+    });
+
+    const int best = qBound(0, count - Exploration, available.count());
+    std::shuffle(available.begin() + best, available.end(), random_);
+
+    std::sort(backedOff.begin(), backedOff.end(),
+              [](const Candidate& a, const Candidate& b) {
+        return a.backoff < b.backoff;
+    });
+    available << backedOff;
+
+    QVector<const BootstrapNode*> out;
+    for (int i = 0; i < available.count() && out.count() < count; i++) {
+        out << available.at(i).node;
+    }
+
+    return out;
+}
+
+/**
+@brief Updates the health record of the nodes of a round.
+@param[in] round    the bootstrap round
+@param[in] success  true, if the round lead to a connection
+@param[in] now      the current time in milliseconds since epoch
+@note The mutex must be locked.
+
+The records are marked changed and written by a StoreJob. A single job is
+queued at a time; it picks up the records changed while it runs.
+*/
+void ToxBootstrapper::finishRound(const Round& round, bool success,
+                                  qint64 now)
+{
+    const qint64 timeToConnect = round.timer.isValid() ? round.timer.elapsed()
+                                                      : 0;
+    for (const QByteArray& id : round.nodes) {
+        Score& score = scores_[id];
+        score.attempts++;
+        if (success) {
+            score.successes++;
+            score.failuresInRow = 0;
+            score.avgTimeToConnect =
+                    score.successes == 1
+                    ? timeToConnect
+                    : (score.avgTimeToConnect * 3 + timeToConnect) / 4;
+        } else {
+            score.failuresInRow++;
+            score.lastFailure = now;
+        }
+        dirty_.insert(id);
+    }
+
+    if (!storing_ && !dirty_.isEmpty()) {
+        storing_ = true;
+        QThreadPool::globalInstance()->start(new StoreJob());
+    }
+}
+
+/**
+@brief Writes the changed health records to the settings file.
+
+Runs on the global thread pool until no changed record is left. The mutex
+is not held while the settings file is written.
+*/
+void ToxBootstrapper::persist()
+{
+    for (;;) {
+        QHash<QByteArray, Score> changed;
+        {
+            QMutexLocker lock(&mutex_);
+            if (dirty_.isEmpty()) {
+                storing_ = false;
+                return;
+            }
+            for (const QByteArray& id : dirty_) {
+                changed.insert(id, scores_.value(id));
+            }
+            dirty_.clear();
+        }
+
+        QSettings s(QSettings::IniFormat, QSettings::UserScope,
+                    QStringLiteral("Toxer"), QStringLiteral("Bootstrap"));
+        for (auto it = changed.cbegin(); it != changed.cend(); ++it) {
+            const Score& score = it.value();
+            s.beginGroup(QString::fromLatin1(it.key()));
+            s.setValue(QStringLiteral("attempts"), score.attempts);
+            s.setValue(QStringLiteral("successes"), score.successes);
+            s.setValue(QStringLiteral("failures_in_row"), score.failuresInRow);
+            s.setValue(QStringLiteral("avg_time_to_connect"),
+                       score.avgTimeToConnect);
+            s.setValue(QStringLiteral("last_failure"), score.lastFailure);
+            s.endGroup();
+        }
+    }
+}
+
+/**
+@brief Returns the persistent id of a node.
+@param[in] node     the node
+@return the hex encoded public key and the port
+*/
+QByteArray ToxBootstrapper::nodeId(const BootstrapNode& node)
+{
+    return QByteArray(reinterpret_cast<const char*>(node.key),
+                      sizeof(node.key)).toHex() +
+            '_' + QByteArray::number(node.port);
+}
+
+/**
+@brief Rates a node; higher is better.
+@param[in] score    the health record of the node
+
+Combines the success rate, smoothed for nodes with few attempts, with the
+average time to connect.
+*/
+double ToxBootstrapper::rating(const Score& score)
+{
+    const double successRate = (score.successes + 1.0) /
+                               (score.attempts + 2.0);
+    return successRate / (1.0 + score.avgTimeToConnect / 10000.0);
+}
+
+/**
+@brief Returns the end of the backoff period of a node.
+@param[in] score    the health record of the node
+@return the time in milliseconds since epoch; 0 if not backed off
+*/
+qint64 ToxBootstrapper::backoffUntil(const Score& score)
+{
+    if (score.failuresInRow == 0) {
+        return 0;
+    }
+
+    const quint32 shift = qMin<quint32>(score.failuresInRow - 1, 10);
+    return score.lastFailure + qMin(BackoffBase << shift, BackoffMax);
+}
@@ -27,7 +27,17 @@
 #ifndef TOXER_TOX_BOOTSTRAP_H
 #define TOXER_TOX_BOOTSTRAP_H
 
-#include <QtGlobal>
+#include "ToxNodeCache.h"
+
+#include <tox/tox.h>
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QVector>
+
+#include <random>
 
 struct BootstrapNode {
     const char*     address;
@@ -289,4 +299,63 @@ static constexpr BootstrapNode bootstrap_nodes[] = {
     },
 };
 
+class ToxBootstrapper final
+{
+public:
+    static constexpr int CachedFanOut = 8;
+    static constexpr int FanOut = 8;
+    static constexpr int Exploration = 2;
+    static constexpr qint64 BackoffBase = 60 * 1000;
+    static constexpr qint64 BackoffMax = 24 * 60 * 60 * 1000;
+    static constexpr qint64 RoundTimeout = 30 * 1000;
+
+public:
+    static ToxBootstrapper& instance();
+
+    void bootstrap(Tox* tox, const QVector<ToxNodeCache::Node>& cached = {});
+    void addRelays(Tox* tox, int count);
+    void connectionChanged(const Tox* tox, TOX_CONNECTION status);
+    void release(const Tox* tox);
+
+private:
+    class StoreJob;
+
+    struct Score {
+        quint32 attempts = 0;
+        quint32 successes = 0;
+        quint32 failuresInRow = 0;
+        qint64 avgTimeToConnect = 0;
+        qint64 lastFailure = 0;
+    };
+
+    struct Round {
+        QVector<QByteArray> nodes;
+        QElapsedTimer timer;
+    };
+
+private:
+    ToxBootstrapper();
+
+    void bootstrapCached(Tox* tox, const QVector<ToxNodeCache::Node>& nodes);
+    bool loadNodes(const QString& fileName);
+    QVector<const BootstrapNode*> select(qint64 now, int count);
+    void finishRound(const Round& round, bool success, qint64 now);
+    void expireRound(const Tox* tox, const Round& round, qint64 now);
+    void persist();
+
+    static QByteArray nodeId(const BootstrapNode& node);
+    static double rating(const Score& score);
+    static qint64 backoffUntil(const Score& score);
+
+private:
+    QMutex mutex_;
+    QVector<BootstrapNode> nodes_;
+    QByteArray addresses_;
+    QHash<QByteArray, Score> scores_;
+    QHash<const Tox*, Round> rounds_;
+    QSet<QByteArray> dirty_;
+    bool storing_;
+    std::mt19937 random_;
+};
+
 #endif
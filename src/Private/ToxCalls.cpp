@@ -0,0 +1,596 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "ToxCalls.h"
+
+#include "ToxMetrics.h"
+#include "ToxProfile.h"
+#include "ToxSounds.h"
+#include "IToxNotify.h"
+#include "Settings.h"
+
+#include <QElapsedTimer>
+#include <QThread>
+
+#include <cstring>
+
+/**
+@class ToxCalls
+@brief The audio call engine of a profile.
+
+ToxAV runs on its own thread, which iterates at the interval ToxAV asks
+for. The audio devices are served by a second thread with time critical
+priority, which reads and writes one frame of ToxAudio::FrameDuration
+milliseconds per period on a steady clock. Neither thread depends on the
+event loop of Tox or the GUI, so a busy GUI does not add latency.
+
+Captured frames are handed to the ToxAV thread, which encodes and sends
+them. Received frames are decoded by ToxAV, converted to the call format
+and handed back to the audio thread. Both directions use a ToxAudioRing,
+so the audio path neither locks nor allocates. The playback ring doubles as
+jitter buffer: playback starts with ToxCalls::JitterFrames frames buffered
+and the buffer is trimmed back when it grows beyond
+ToxCalls::MaxLatencyFrames frames. Underruns are counted in the
+"call.underruns" metric.
+
+There is one audio call at a time. Incoming calls while a call is active
+and calls without audio are rejected. Video is not supported. The audio
+backends are taken from the audio_input and audio_output ToxSettings.
+
+ToxAV functions must not be called from its callbacks, rejecting a call is
+therefore deferred to the next iteration. The call state is never locked
+while a ToxAV function runs, which would deadlock with the callbacks.
+
+The observers are told about calls from the event loop of the profile only,
+which guards them. Events of the ToxAV thread are queued for update().
+Calls to a profile in standby are rejected, as nobody could answer them.
+
+
+@var ToxCalls::NoFriend
+@brief The friend number meaning no call.
+
+@var ToxCalls::AudioBitRate
+@brief The audio bit rate of calls in kbit/s.
+
+@var ToxCalls::JitterFrames
+@brief The number of frames buffered before playback starts.
+
+@var ToxCalls::MaxLatencyFrames
+@brief The number of buffered frames at which the playback skips ahead.
+
+@var ToxCalls::MaxFrameSamples
+@brief The number of samples of the longest frame ToxAV delivers.
+*/
+
+constexpr quint32 ToxCalls::NoFriend;
+constexpr quint32 ToxCalls::AudioBitRate;
+constexpr quint32 ToxCalls::JitterFrames;
+constexpr quint32 ToxCalls::MaxLatencyFrames;
+constexpr quint32 ToxCalls::MaxFrameSamples;
+
+/**
+@brief Runs toxav_iterate and sends the captured audio.
+*/
+class ToxCalls::Iterator final : public QThread
+{
+public:
+    explicit Iterator(ToxCalls* calls)
+        : calls_(calls)
+        , active_(1)
+    {
+    }
+
+    inline void stop()
+    {
+        active_.store(0);
+    }
+
+private:
+    void run() final
+    {
+        while (active_.load()) {
+            toxav_iterate(calls_->av_);
+            calls_->process();
+
+            unsigned long interval = toxav_iteration_interval(calls_->av_);
+            if (calls_->peer_.load() != NoFriend) {
+                interval = qMin<unsigned long>(interval,
+                                               ToxAudio::FrameDuration / 2);
+            }
+            msleep(interval);
+        }
+    }
+
+private:
+    ToxCalls* calls_;
+    QAtomicInt active_;
+};
+
+/**
+@brief Moves one frame between the audio devices and the rings per period.
+*/
+class ToxCalls::Pump final : public QThread
+{
+public:
+    Pump(ToxCalls* calls, IToxAudioSource* source, IToxAudioSink* sink)
+        : calls_(calls)
+        , source_(source)
+        , sink_(sink)
+        , active_(1)
+        , underruns_(0)
+    {
+    }
+
+    ~Pump() override
+    {
+        delete source_;
+        delete sink_;
+    }
+
+    inline void stop()
+    {
+        active_.store(0);
+    }
+
+    inline int underruns() const
+    {
+        return underruns_.load();
+    }
+
+private:
+    void run() final
+    {
+        constexpr qint64 period = ToxAudio::FrameDuration * 1000000ll;
+        constexpr quint32 jitter = JitterFrames * ToxAudio::FrameSamples;
+        constexpr quint32 maxLatency = MaxLatencyFrames *
+                                       ToxAudio::FrameSamples;
+        ToxAudioRing& playback = calls_->playback_;
+        playback.skip(playback.available());
+
+        QElapsedTimer clock;
+        clock.start();
+        qint64 deadline = 0;
+        bool playing = false;
+        while (active_.load()) {
+            source_->read(in_, ToxAudio::FrameSamples);
+            if (!calls_->muted_.load()) {
+                calls_->capture_.push(in_, ToxAudio::FrameSamples);
+            }
+
+            const quint32 available = playback.available();
+            if (available > maxLatency) {
+                playback.skip(available - jitter);
+            }
+            if (!playing && available >= jitter) {
+                playing = true;
+            }
+
+            quint32 count = 0;
+            if (playing) {
+                count = playback.pop(out_, ToxAudio::FrameSamples);
+                if (count < ToxAudio::FrameSamples) {
+                    underruns_.ref();
+                    playing = false;
+                }
+            }
+            std::memset(out_ + count, 0,
+                        (ToxAudio::FrameSamples - count) * sizeof(qint16));
+            sink_->write(out_, ToxAudio::FrameSamples);
+
+            deadline += period;
+            const qint64 wait = deadline - clock.nsecsElapsed();
+            if (wait > 0) {
+                usleep(static_cast<unsigned long>(wait / 1000));
+            } else if (wait < -period) {
+                // stalled, don't try to catch up
+                deadline = clock.nsecsElapsed();
+            }
+        }
+
+        source_->close();
+        sink_->close();
+    }
+
+private:
+    ToxCalls* calls_;
+    IToxAudioSource* source_;
+    IToxAudioSink* sink_;
+    QAtomicInt active_;
+    QAtomicInt underruns_;
+    qint16 in_[ToxAudio::FrameSamples];
+    qint16 out_[ToxAudio::FrameSamples];
+};
+
+/**
+@brief constructor
+@param[in] profile  the profile that owns the Tox instance
+*/
+ToxCalls::ToxCalls(ToxProfilePrivate* profile)
+    : profile_(profile)
+    , av_(nullptr)
+    , iterator_(nullptr)
+    , pump_(nullptr)
+    , active_(NoFriend)
+    , peer_(NoFriend)
+    , muted_(0)
+    , capture_(2 * MaxLatencyFrames * ToxAudio::FrameSamples)
+    , playback_(2 * MaxLatencyFrames * ToxAudio::FrameSamples)
+    , sendFrame_(new qint16[ToxAudio::FrameSamples])
+    , received_(new qint16[MaxFrameSamples])
+{
+}
+
+/**
+@brief destructor
+*/
+ToxCalls::~ToxCalls()
+{
+    detach();
+}
+
+/**
+@brief Creates the ToxAV instance for a Tox instance.
+@param[in] tox  the Tox instance
+@note Call this while Tox is not iterated.
+
+A previous ToxAV instance is released with detach() first.
+*/
+void ToxCalls::attach(Tox* tox)
+{
+    detach();
+
+    TOXAV_ERR_NEW err = TOXAV_ERR_NEW_OK;
+    av_ = toxav_new(tox, &err);
+    if (!av_) {
+        qWarning("Creating ToxAV failed: error %d", static_cast<int>(err));
+        return;
+    }
+
+    toxav_callback_call(av_, &ToxCalls::onCall, this);
+    toxav_callback_call_state(av_, &ToxCalls::onCallState, this);
+    toxav_callback_audio_receive_frame(av_, &ToxCalls::onAudioFrame, this);
+
+    iterator_ = new Iterator(this);
+    iterator_->start(QThread::HighPriority);
+}
+
+/**
+@brief Ends all calls and releases the ToxAV instance.
+@note Call this while Tox is not iterated and before Tox is released.
+*/
+void ToxCalls::detach()
+{
+    if (!av_) {
+        return;
+    }
+
+    iterator_->stop();
+    iterator_->wait();
+    delete iterator_;
+    iterator_ = nullptr;
+
+    QSet<quint32> ended;
+    {
+        QMutexLocker locker(&mutex_);
+        ended.swap(ringing_);
+        if (active_ != NoFriend) {
+            ended.insert(active_);
+            stopAudio();
+            active_ = NoFriend;
+        }
+        rejected_.clear();
+    }
+
+    for (quint32 friendNo : ended) {
+        post(EventKind::Finished, friendNo);
+    }
+
+    toxav_kill(av_);
+    av_ = nullptr;
+}
+
+/**
+@brief Calls a friend.
+@param[in] friendNo     the friend number
+@return true, if the call was placed
+*/
+bool ToxCalls::call(quint32 friendNo)
+{
+    {
+        QMutexLocker locker(&mutex_);
+        if (!av_ || active_ != NoFriend) {
+            return false;
+        }
+        active_ = friendNo;
+    }
+
+    TOXAV_ERR_CALL err = TOXAV_ERR_CALL_OK;
+    const bool ok = toxav_call(av_, friendNo, AudioBitRate, 0, &err);
+
+    QMutexLocker locker(&mutex_);
+    if (!ok) {
+        qWarning("Calling friend %u failed: error %d", friendNo,
+                 static_cast<int>(err));
+        active_ = NoFriend;
+    } else if (active_ == friendNo) {
+        startAudio(friendNo);
+    }
+    return ok;
+}
+
+/**
+@brief Answers the call of a friend.
+@param[in] friendNo     the friend number
+@return true, if the call was answered
+*/
+bool ToxCalls::answer(quint32 friendNo)
+{
+    {
+        QMutexLocker locker(&mutex_);
+        if (!av_ || active_ != NoFriend || !ringing_.remove(friendNo)) {
+            return false;
+        }
+        active_ = friendNo;
+    }
+
+    TOXAV_ERR_ANSWER err = TOXAV_ERR_ANSWER_OK;
+    if (!toxav_answer(av_, friendNo, AudioBitRate, 0, &err)) {
+        qWarning("Answering friend %u failed: error %d", friendNo,
+                 static_cast<int>(err));
+        finish(friendNo);
+        return false;
+    }
+
+    QMutexLocker locker(&mutex_);
+    if (active_ == friendNo) {
+        startAudio(friendNo);
+    }
+    return true;
+}
+
+/**
+@brief Ends or rejects the call of a friend.
+@param[in] friendNo     the friend number
+*/
+void ToxCalls::hangup(quint32 friendNo)
+{
+    if (av_) {
+        toxav_call_control(av_, friendNo, TOXAV_CALL_CONTROL_CANCEL,
+                           nullptr);
+        finish(friendNo);
+    }
+}
+
+/**
+@brief Mutes the audio input.
+@param[in] muted    true to send no audio
+*/
+void ToxCalls::setMuted(bool muted)
+{
+    muted_.store(muted ? 1 : 0);
+}
+
+/**
+@brief Handles an incoming call.
+*/
+void ToxCalls::onCall(ToxAV*, uint32_t friendNo, bool audio, bool,
+                      void* user_data)
+{
+    ToxCalls* c = static_cast<ToxCalls*>(user_data);
+    QMutexLocker locker(&c->mutex_);
+    if (!audio || c->active_ != NoFriend ||
+        c->profile_->mTEL->isStandby())
+    {
+        c->rejected_ << friendNo;
+        return;
+    }
+
+    c->ringing_.insert(friendNo);
+    locker.unlock();
+
+    c->post(EventKind::Incoming, friendNo);
+
+    if (c->profile_ == ToxProfilePrivate::current()) {
+        ToxSounds::instance().play(ToxSounds::IncomingCall);
+    }
+}
+
+/**
+@brief Handles a changed call state.
+*/
+void ToxCalls::onCallState(ToxAV*, uint32_t friendNo, uint32_t state,
+                           void* user_data)
+{
+    ToxCalls* c = static_cast<ToxCalls*>(user_data);
+    if (state & (TOXAV_FRIEND_CALL_STATE_FINISHED |
+                 TOXAV_FRIEND_CALL_STATE_ERROR))
+    {
+        c->finish(friendNo);
+        return;
+    }
+
+    c->post(EventKind::StateChanged, friendNo, state);
+}
+
+/**
+@brief Hands a received audio frame to the playback.
+
+Runs on the ToxAV thread.
+*/
+void ToxCalls::onAudioFrame(ToxAV*, uint32_t friendNo, const int16_t* pcm,
+                            size_t count, uint8_t channels,
+                            uint32_t sampleRate, void* user_data)
+{
+    ToxCalls* c = static_cast<ToxCalls*>(user_data);
+    if (friendNo != c->peer_.loadAcquire()) {
+        return;
+    }
+
+    const quint32 samples = ToxAudio::convert(
+                pcm, static_cast<quint32>(count), channels, sampleRate,
+                c->received_.get(), MaxFrameSamples);
+    c->playback_.push(c->received_.get(), samples);
+}
+
+/**
+@brief Opens the audio backends and starts the audio thread.
+@param[in] friendNo     the friend number of the call
+@note The mutex must be locked.
+*/
+void ToxCalls::startAudio(quint32 friendNo)
+{
+    const ToxSettings settings;
+    IToxAudioSource* source = ToxAudio::createSource(settings.audio_input());
+    if (!source->open()) {
+        qWarning("Opening the audio input failed, using silence.");
+        delete source;
+        source = ToxAudio::createSource(QStringLiteral("null"));
+        source->open();
+    }
+
+    IToxAudioSink* sink = ToxAudio::createSink(settings.audio_output());
+    if (!sink->open()) {
+        qWarning("Opening the audio output failed, discarding audio.");
+        delete sink;
+        sink = ToxAudio::createSink(QStringLiteral("null"));
+        sink->open();
+    }
+
+    peer_.storeRelease(friendNo);
+    pump_ = new Pump(this, source, sink);
+    pump_->start(QThread::TimeCriticalPriority);
+}
+
+/**
+@brief Stops the audio thread and closes the audio backends.
+@note The mutex must be locked.
+*/
+void ToxCalls::stopAudio()
+{
+    peer_.storeRelease(NoFriend);
+    if (pump_) {
+        pump_->stop();
+        pump_->wait();
+        ToxMetrics::instance().record("call.underruns", pump_->underruns());
+        delete pump_;
+        pump_ = nullptr;
+    }
+}
+
+/**
+@brief Rejects deferred calls and sends the captured audio.
+
+Runs on the ToxAV thread after each iteration.
+*/
+void ToxCalls::process()
+{
+    QVector<quint32> rejected;
+    {
+        QMutexLocker locker(&mutex_);
+        rejected.swap(rejected_);
+    }
+    for (quint32 friendNo : rejected) {
+        toxav_call_control(av_, friendNo, TOXAV_CALL_CONTROL_CANCEL, nullptr);
+    }
+
+    const quint32 friendNo = peer_.loadAcquire();
+    if (friendNo == NoFriend) {
+        capture_.skip(capture_.available());
+        return;
+    }
+
+    while (capture_.available() >= ToxAudio::FrameSamples) {
+        capture_.pop(sendFrame_.get(), ToxAudio::FrameSamples);
+        toxav_audio_send_frame(av_, friendNo, sendFrame_.get(),
+                               ToxAudio::FrameSamples, ToxAudio::Channels,
+                               ToxAudio::SampleRate, nullptr);
+    }
+}
+
+/**
+@brief Ends the call of a friend and tells the observers.
+@param[in] friendNo     the friend number
+*/
+void ToxCalls::finish(quint32 friendNo)
+{
+    bool ended;
+    {
+        QMutexLocker locker(&mutex_);
+        ended = ringing_.remove(friendNo);
+        if (active_ == friendNo) {
+            stopAudio();
+            active_ = NoFriend;
+            ended = true;
+        }
+    }
+
+    if (ended) {
+        post(EventKind::Finished, friendNo);
+    }
+}
+
+/**
+@brief Queues an event for the observers.
+@param[in] kind         the event kind
+@param[in] friendNo     the friend number
+@param[in] state        the call state for EventKind::StateChanged
+*/
+void ToxCalls::post(EventKind kind, quint32 friendNo, quint32 state)
+{
+    QMutexLocker locker(&mutex_);
+    events_.append({ kind, friendNo, state });
+}
+
+/**
+@brief Tells the observers about the queued events.
+@note Call this on the event loop thread with the event loop mutex locked.
+*/
+void ToxCalls::update()
+{
+    QVector<Event> events;
+    {
+        QMutexLocker locker(&mutex_);
+        events.swap(events_);
+    }
+
+    for (const Event& e : events) {
+        const int index = static_cast<int>(e.friendNo);
+        for (auto n : profile_->callNotifiers) {
+            switch (e.kind) {
+            case EventKind::Incoming:
+                n->on_call_incoming(index);
+                break;
+            case EventKind::StateChanged:
+                n->on_call_state_changed(index, e.state);
+                break;
+            case EventKind::Finished:
+                n->on_call_finished(index);
+                break;
+            }
+        }
+    }
+}
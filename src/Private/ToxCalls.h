@@ -0,0 +1,115 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef TOXER_PRIVATE_TOXCALLS_H
+#define TOXER_PRIVATE_TOXCALLS_H
+
+#include "ToxAudio.h"
+
+#include <tox/toxav.h>
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QSet>
+#include <QVector>
+
+class ToxProfilePrivate;
+
+class ToxCalls final
+{
+public:
+    static constexpr quint32 NoFriend = UINT32_MAX;
+    static constexpr quint32 AudioBitRate = 48;
+    static constexpr quint32 JitterFrames = 3;
+    static constexpr quint32 MaxLatencyFrames = 8;
+    static constexpr quint32 MaxFrameSamples = 120 * ToxAudio::SampleRate /
+                                               1000;
+
+public:
+    explicit ToxCalls(ToxProfilePrivate* profile);
+    ~ToxCalls();
+
+    void attach(Tox* tox);
+    void detach();
+
+    bool call(quint32 friendNo);
+    bool answer(quint32 friendNo);
+    void hangup(quint32 friendNo);
+    void setMuted(bool muted);
+
+    void update();
+
+private:
+    class Iterator;
+    class Pump;
+
+    enum class EventKind {
+        Incoming,
+        StateChanged,
+        Finished
+    };
+
+    struct Event {
+        EventKind kind;
+        quint32 friendNo;
+        quint32 state;
+    };
+
+    static void onCall(ToxAV* av, uint32_t friendNo, bool audio, bool video,
+                       void* user_data);
+    static void onCallState(ToxAV* av, uint32_t friendNo, uint32_t state,
+                            void* user_data);
+    static void onAudioFrame(ToxAV* av, uint32_t friendNo,
+                             const int16_t* pcm, size_t count,
+                             uint8_t channels, uint32_t sampleRate,
+                             void* user_data);
+
+    void startAudio(quint32 friendNo);
+    void stopAudio();
+    void process();
+    void finish(quint32 friendNo);
+    void post(EventKind kind, quint32 friendNo, quint32 state = 0);
+
+private:
+    ToxProfilePrivate* profile_;
+    ToxAV* av_;
+    Iterator* iterator_;
+    Pump* pump_;
+    QMutex mutex_;
+    quint32 active_;
+    QSet<quint32> ringing_;
+    QVector<quint32> rejected_;
+    QVector<Event> events_;
+    QAtomicInteger<quint32> peer_;
+    QAtomicInt muted_;
+    ToxAudioRing capture_;
+    ToxAudioRing playback_;
+    std::unique_ptr<qint16[]> sendFrame_;
+    std::unique_ptr<qint16[]> received_;
+};
+
+#endif
@@ -0,0 +1,422 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "ToxConferences.h"
+
+#include "ToxProfile.h"
+#include "IToxNotify.h"
+
+/**
+@class ToxConferences
+@brief The conference engine of a profile.
+
+Keeps a table of the peers of each conference, keyed by their public key,
+together with their names. The table is the source of the peer lists shown
+by the UI, so the UI never queries Tox for peers.
+
+Toxcore reports changes of a peer list without telling what changed. The
+change marks the conference and the peer lists of all marked conferences
+are compared with the table by update() after each iteration of the event
+loop. This way a burst of joins and leaves results in one comparison.
+Only the names of added peers are fetched from Tox and the observers get
+the added and removed peers, instead of the whole list. Peer numbers are not
+stable in toxcore, so they are never stored.
+
+Peers are reported to the IToxConferenceNotifier observers by their public
+key as hex string. Invites to audio conferences are ignored.
+
+The event functions are called on the event loop thread, added() and
+removed() with the Tox instance locked. The table can be read from any
+thread.
+*/
+
+/**
+@brief constructor
+@param[in] profile  the profile that owns the Tox instance
+*/
+ToxConferences::ToxConferences(ToxProfilePrivate* profile)
+    : profile_(profile)
+{
+}
+
+/**
+@brief Announces a conference invite of a friend.
+@param[in] friendNo     the friend number
+@param[in] type         the conference type
+@param[in] cookie       the invite cookie
+@param[in] length       the length of the cookie
+*/
+void ToxConferences::invited(quint32 friendNo, TOX_CONFERENCE_TYPE type,
+                             const uint8_t* cookie, size_t length)
+{
+    if (type != TOX_CONFERENCE_TYPE_TEXT) {
+        return;
+    }
+
+    const QString hex = QString::fromLatin1(
+                QByteArray(reinterpret_cast<const char*>(cookie),
+                           static_cast<int>(length)).toHex());
+    ToxProfilePrivate* p = profile_;
+    const int index = static_cast<int>(friendNo);
+    p->deliver([p, index, hex]() {
+        for (auto n : p->conferenceNotifiers) {
+            n->on_conference_invited(index, hex);
+        }
+    });
+}
+
+/**
+@brief Marks the peer list of a conference for comparison.
+@param[in] conferenceNo     the conference number
+*/
+void ToxConferences::peerListChanged(quint32 conferenceNo)
+{
+    QMutexLocker locker(&mutex_);
+    dirty_.insert(conferenceNo);
+    pending_.store(1);
+}
+
+/**
+@brief Updates the name of a peer in the table.
+@param[in] tox              the Tox instance
+@param[in] conferenceNo     the conference number
+@param[in] peerNo           the peer number
+@param[in] name             the new name
+*/
+void ToxConferences::peerNameChanged(Tox* tox, quint32 conferenceNo,
+                                     quint32 peerNo, const QString& name)
+{
+    const QByteArray key = peerKey(tox, conferenceNo, peerNo);
+    if (key.isEmpty()) {
+        return;
+    }
+
+    {
+        QMutexLocker locker(&mutex_);
+        auto conference = peers_.find(conferenceNo);
+        if (conference == peers_.end()) {
+            return;
+        }
+
+        auto peer = conference->find(key);
+        if (peer == conference->end()) {
+            // the peer is added with its name by the next update
+            return;
+        }
+
+        if (*peer == name) {
+            return;
+        }
+        *peer = name;
+    }
+
+    const QString hex = QString::fromLatin1(key.toHex());
+    for (auto n : profile_->conferenceNotifiers) {
+        n->on_conference_peer_name_changed(static_cast<int>(conferenceNo),
+                                           hex, name);
+    }
+}
+
+/**
+@brief Announces a changed conference title.
+@param[in] conferenceNo     the conference number
+@param[in] title            the new title
+*/
+void ToxConferences::titleChanged(quint32 conferenceNo, const QString& title)
+{
+    for (auto n : profile_->conferenceNotifiers) {
+        n->on_conference_title_changed(static_cast<int>(conferenceNo), title);
+    }
+}
+
+/**
+@brief Announces a conference message.
+@param[in] tox              the Tox instance
+@param[in] conferenceNo     the conference number
+@param[in] peerNo           the peer number of the sender
+@param[in] message          the message
+@param[in] type             the message type
+
+The name of the sender is taken from the table.
+*/
+void ToxConferences::message(Tox* tox, quint32 conferenceNo, quint32 peerNo,
+                             const QString& message,
+                             ToxTypes::MessageType type)
+{
+    const QByteArray key = peerKey(tox, conferenceNo, peerNo);
+    QString name;
+    {
+        QMutexLocker locker(&mutex_);
+        name = peers_.value(conferenceNo).value(key);
+    }
+
+    const QString hex = QString::fromLatin1(key.toHex());
+    ToxProfilePrivate* p = profile_;
+    const int index = static_cast<int>(conferenceNo);
+    const quint8 t = static_cast<quint8>(type);
+    p->deliver([p, index, hex, name, message, t]() {
+        for (auto n : p->conferenceNotifiers) {
+            n->on_conference_message(index, hex, name, message, t);
+        }
+    });
+}
+
+/**
+@brief Compares the peer lists of the marked conferences with the table.
+@param[in] tox  the Tox instance
+*/
+void ToxConferences::update(Tox* tox)
+{
+    if (!pending_.fetchAndStoreRelaxed(0)) {
+        return;
+    }
+
+    QSet<quint32> dirty;
+    {
+        QMutexLocker locker(&mutex_);
+        dirty.swap(dirty_);
+    }
+
+    for (quint32 conferenceNo : dirty) {
+        sync(tox, conferenceNo);
+    }
+}
+
+/**
+@brief Marks all conferences for comparison after Tox was replaced.
+@param[in] tox  the new Tox instance
+
+The table is kept, so the next update() reports the difference to the new
+instance only. Conferences the new instance does not know are removed.
+*/
+void ToxConferences::reset(Tox* tox)
+{
+    QVector<uint32_t> list(
+                static_cast<int>(tox_conference_get_chatlist_size(tox)));
+    tox_conference_get_chatlist(tox, list.data());
+
+    QMutexLocker locker(&mutex_);
+    for (auto it = peers_.cbegin(); it != peers_.cend(); ++it) {
+        dirty_.insert(it.key());
+    }
+    for (uint32_t conferenceNo : list) {
+        dirty_.insert(conferenceNo);
+        if (!peers_.contains(conferenceNo)) {
+            peers_.insert(conferenceNo, {});
+        }
+    }
+    pending_.store(1);
+}
+
+/**
+@brief Announces a conference that was created or joined.
+@param[in] conferenceNo     the conference number
+*/
+void ToxConferences::added(quint32 conferenceNo)
+{
+    {
+        QMutexLocker locker(&mutex_);
+        peers_[conferenceNo].clear();
+        dirty_.insert(conferenceNo);
+        pending_.store(1);
+    }
+
+    for (auto n : profile_->conferenceNotifiers) {
+        n->on_conference_added(static_cast<int>(conferenceNo));
+    }
+}
+
+/**
+@brief Removes a conference from the table.
+@param[in] conferenceNo     the conference number
+
+The peers of the conference are reported as removed first.
+*/
+void ToxConferences::removed(quint32 conferenceNo)
+{
+    QStringList keys;
+    {
+        QMutexLocker locker(&mutex_);
+        dirty_.remove(conferenceNo);
+        const QHash<QByteArray, QString> peers = peers_.take(conferenceNo);
+        keys.reserve(peers.size());
+        for (auto it = peers.cbegin(); it != peers.cend(); ++it) {
+            keys << QString::fromLatin1(it.key().toHex());
+        }
+    }
+
+    if (!keys.isEmpty()) {
+        notifyPeers(conferenceNo, {}, {}, keys);
+    }
+
+    for (auto n : profile_->conferenceNotifiers) {
+        n->on_conference_removed(static_cast<int>(conferenceNo));
+    }
+}
+
+/**
+@brief Returns the peers of a conference.
+@param[in] conferenceNo     the conference number
+@return the public keys and names of the peers
+*/
+QVector<ToxConferences::Peer> ToxConferences::peers(quint32 conferenceNo) const
+{
+    QMutexLocker locker(&mutex_);
+    const QHash<QByteArray, QString> peers = peers_.value(conferenceNo);
+    locker.unlock();
+
+    QVector<Peer> out;
+    out.reserve(peers.size());
+    for (auto it = peers.cbegin(); it != peers.cend(); ++it) {
+        out.append(qMakePair(it.key(), it.value()));
+    }
+    return out;
+}
+
+/**
+@brief Returns the number of peers of a conference.
+@param[in] conferenceNo     the conference number
+*/
+int ToxConferences::peerCount(quint32 conferenceNo) const
+{
+    QMutexLocker locker(&mutex_);
+    return peers_.value(conferenceNo).size();
+}
+
+/**
+@brief Compares the peer list of a conference with the table.
+@param[in] tox              the Tox instance
+@param[in] conferenceNo     the conference number
+*/
+void ToxConferences::sync(Tox* tox, quint32 conferenceNo)
+{
+    TOX_ERR_CONFERENCE_PEER_QUERY error;
+    const uint32_t count = tox_conference_peer_count(tox, conferenceNo,
+                                                     &error);
+    if (error == TOX_ERR_CONFERENCE_PEER_QUERY_CONFERENCE_NOT_FOUND) {
+        QMutexLocker locker(&mutex_);
+        if (peers_.contains(conferenceNo)) {
+            locker.unlock();
+            removed(conferenceNo);
+        }
+        return;
+    } else if (error != TOX_ERR_CONFERENCE_PEER_QUERY_OK) {
+        return;
+    }
+
+    QHash<QByteArray, quint32> current;
+    current.reserve(static_cast<int>(count));
+    for (uint32_t peerNo = 0; peerNo < count; ++peerNo) {
+        const QByteArray key = peerKey(tox, conferenceNo, peerNo);
+        if (!key.isEmpty()) {
+            current.insert(key, peerNo);
+        }
+    }
+
+    QStringList added;
+    QStringList names;
+    QStringList removed;
+    {
+        QMutexLocker locker(&mutex_);
+        QHash<QByteArray, QString>& table = peers_[conferenceNo];
+        for (auto it = table.begin(); it != table.end();) {
+            if (current.contains(it.key())) {
+                ++it;
+            } else {
+                removed << QString::fromLatin1(it.key().toHex());
+                it = table.erase(it);
+            }
+        }
+
+        for (auto it = current.cbegin(); it != current.cend(); ++it) {
+            if (!table.contains(it.key())) {
+                const QString name = peerName(tox, conferenceNo, it.value());
+                table.insert(it.key(), name);
+                added << QString::fromLatin1(it.key().toHex());
+                names << name;
+            }
+        }
+    }
+
+    if (!added.isEmpty() || !removed.isEmpty()) {
+        notifyPeers(conferenceNo, added, names, removed);
+    }
+}
+
+/**
+@brief Reports a change of the peer list to the observers.
+@param[in] conferenceNo     the conference number
+@param[in] added            the public keys of the added peers
+@param[in] names            the names of the added peers
+@param[in] removed          the public keys of the removed peers
+*/
+void ToxConferences::notifyPeers(quint32 conferenceNo,
+                                 const QStringList& added,
+                                 const QStringList& names,
+                                 const QStringList& removed)
+{
+    for (auto n : profile_->conferenceNotifiers) {
+        n->on_conference_peers_changed(static_cast<int>(conferenceNo), added,
+                                       names, removed);
+    }
+}
+
+/**
+@brief Returns the public key of a conference peer.
+@return the raw key or an empty array, if the peer does not exist
+*/
+QByteArray ToxConferences::peerKey(const Tox* tox, quint32 conferenceNo,
+                                   quint32 peerNo)
+{
+    QByteArray key(TOX_PUBLIC_KEY_SIZE, Qt::Uninitialized);
+    if (!tox_conference_peer_get_public_key(
+                tox, conferenceNo, peerNo,
+                reinterpret_cast<uint8_t*>(key.data()), nullptr))
+    {
+        return QByteArray();
+    }
+    return key;
+}
+
+/**
+@brief Returns the name of a conference peer.
+*/
+QString ToxConferences::peerName(const Tox* tox, quint32 conferenceNo,
+                                 quint32 peerNo)
+{
+    const size_t size = tox_conference_peer_get_name_size(tox, conferenceNo,
+                                                          peerNo, nullptr);
+    QByteArray name(static_cast<int>(size), Qt::Uninitialized);
+    if (size > 0 &&
+        !tox_conference_peer_get_name(tox, conferenceNo, peerNo,
+                                      reinterpret_cast<uint8_t*>(name.data()),
+                                      nullptr))
+    {
+        return QString();
+    }
+    return QString::fromUtf8(name);
+}
@@ -0,0 +1,89 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef TOXER_PRIVATE_TOXCONFERENCES_H
+#define TOXER_PRIVATE_TOXCONFERENCES_H
+
+#include <ToxTypes.h>
+
+#include <tox/tox.h>
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QMutex>
+#include <QPair>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+class ToxProfilePrivate;
+
+class ToxConferences final
+{
+public:
+    using Peer = QPair<QByteArray, QString>;
+
+public:
+    explicit ToxConferences(ToxProfilePrivate* profile);
+
+    void invited(quint32 friendNo, TOX_CONFERENCE_TYPE type,
+                 const uint8_t* cookie, size_t length);
+    void peerListChanged(quint32 conferenceNo);
+    void peerNameChanged(Tox* tox, quint32 conferenceNo, quint32 peerNo,
+                         const QString& name);
+    void titleChanged(quint32 conferenceNo, const QString& title);
+    void message(Tox* tox, quint32 conferenceNo, quint32 peerNo,
+                 const QString& message, ToxTypes::MessageType type);
+    void update(Tox* tox);
+    void reset(Tox* tox);
+
+    void added(quint32 conferenceNo);
+    void removed(quint32 conferenceNo);
+
+    QVector<Peer> peers(quint32 conferenceNo) const;
+    int peerCount(quint32 conferenceNo) const;
+
+private:
+    void sync(Tox* tox, quint32 conferenceNo);
+    void notifyPeers(quint32 conferenceNo, const QStringList& added,
+                     const QStringList& names, const QStringList& removed);
+
+    static QByteArray peerKey(const Tox* tox, quint32 conferenceNo,
+                              quint32 peerNo);
+    static QString peerName(const Tox* tox, quint32 conferenceNo,
+                            quint32 peerNo);
+
+private:
+    ToxProfilePrivate* profile_;
+    mutable QMutex mutex_;
+    QHash<quint32, QHash<QByteArray, QString>> peers_;
+    QSet<quint32> dirty_;
+    QAtomicInt pending_;
+};
+
+#endif
@@ -0,0 +1,553 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "ToxFileWriter.h"
+
+#include "ToxerPrivate.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QStringBuilder>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/**
+@class ToxFileWriter
+@brief Writes received files on a dedicated thread.
+
+The event loop hands coalesced blocks of received data to the writer, which
+writes them sequentially, so the event loop never waits on the disk. A file
+is received into "<name>.part", preallocated to its full size up front and
+renamed once it is complete.
+
+For each file, a journal records the destination, the size and the number of
+bytes known to be on disk. The journal is keyed by the public key of the
+sender and the Tox file id, which stays the same when a sender offers an
+interrupted file again. The data is synced to disk before the journal is
+updated, at most every ToxFileWriter::SyncInterval bytes. A crash therefore
+loses the data received since the last sync, but never records data that is
+not on disk.
+
+A file that cannot be opened, seeked or written is marked failed. Its
+partial file and journal are removed and no further data is written. The
+result of every file is reported once through takeResults(): a failure as
+soon as it happens, a success when the complete file got its final name.
+A complete file never overwrites an existing one, it gets a numbered name
+like "name (1).ext" instead. If it cannot be renamed, the partial file is
+kept, so the received data is never lost.
+
+All public functions are thread-safe.
+
+
+@enum ToxFileWriter::Outcome
+@brief The way a file is closed.
+@var Complete   the file was received completely and gets its final name
+@var Suspend    the transfer was interrupted and can be resumed
+@var Discard    the transfer was cancelled; the partial file is removed
+
+@var ToxFileWriter::SyncInterval
+@brief The number of bytes written between two journal updates.
+*/
+
+namespace {
+
+constexpr quint32 JournalMagic = 0x5458524a; // "TXRJ"
+constexpr quint8 JournalVersion = 2;
+
+}
+
+constexpr quint64 ToxFileWriter::SyncInterval;
+
+/**
+@brief constructor
+
+Starts the writer thread, which loads the journal first.
+*/
+ToxFileWriter::ToxFileWriter()
+    : QThread()
+    , ready_(false)
+    , backlog_(0)
+    , hasResults_(0)
+{
+    setObjectName(QStringLiteral("ToxFileWriter"));
+    start(QThread::LowPriority);
+}
+
+/**
+@brief destructor
+
+Writes the queued data and suspends all open files.
+*/
+ToxFileWriter::~ToxFileWriter()
+{
+    Job job;
+    job.kind = Job::Stop;
+    enqueue(job);
+    wait();
+}
+
+/**
+@brief Looks up an interrupted transfer in the journal.
+@param[in] key          the public key of the sender and the Tox file id
+@param[in] size         the size of the offered file
+@param[out] fileName    the destination of the file
+@param[out] position    the number of bytes on disk
+@return true, if the transfer can be resumed
+*/
+bool ToxFileWriter::resumable(const QByteArray& key, quint64 size,
+                              QString* fileName, quint64* position)
+{
+    QMutexLocker lock(&mutex_);
+    while (!ready_) {
+        loaded_.wait(&mutex_);
+    }
+
+    auto it = journal_.constFind(key);
+    if (it == journal_.cend() || it->size != size) {
+        return false;
+    }
+
+    *fileName = it->fileName;
+    *position = it->position;
+    return true;
+}
+
+/**
+@brief Opens a file for receiving.
+@param[in] id           the transfer id
+@param[in] fileName     the destination of the file
+@param[in] key          the journal key, see resumable()
+@param[in] size         the file size; UINT64_MAX if unknown
+@param[in] position     the position to continue at; 0 for new files
+*/
+void ToxFileWriter::open(quint64 id, const QString& fileName,
+                         const QByteArray& key, quint64 size,
+                         quint64 position)
+{
+    Job job;
+    job.kind = Job::Open;
+    job.id = id;
+    job.fileName = fileName;
+    job.key = key;
+    job.size = size;
+    job.position = position;
+    enqueue(job);
+}
+
+/**
+@brief Queues a block of data.
+@param[in] id           the transfer id
+@param[in] position     the file position of the block
+@param[in] data         the data
+*/
+void ToxFileWriter::write(quint64 id, quint64 position,
+                          const QByteArray& data)
+{
+    backlog_.fetchAndAddRelaxed(static_cast<quint64>(data.size()));
+
+    Job job;
+    job.kind = Job::Write;
+    job.id = id;
+    job.position = position;
+    job.data = data;
+    enqueue(job);
+}
+
+/**
+@brief Closes a file after the queued data was written.
+@param[in] id       the transfer id
+@param[in] outcome  the way to close the file
+*/
+void ToxFileWriter::close(quint64 id, Outcome outcome)
+{
+    Job job;
+    job.kind = Job::Close;
+    job.id = id;
+    job.outcome = outcome;
+    enqueue(job);
+}
+
+/**
+@brief Returns the number of queued bytes not written yet.
+*/
+quint64 ToxFileWriter::backlog() const
+{
+    return backlog_.load();
+}
+
+/**
+@brief Takes the results of the files reported since the last call.
+@return pairs of a transfer id and true for a complete file or false for a
+failed one
+*/
+QVector<QPair<quint64, bool>> ToxFileWriter::takeResults()
+{
+    QVector<QPair<quint64, bool>> out;
+    if (!hasResults_.fetchAndStoreRelaxed(0)) {
+        return out;
+    }
+
+    QMutexLocker lock(&mutex_);
+    out.swap(results_);
+    return out;
+}
+
+void ToxFileWriter::enqueue(const Job& job)
+{
+    QMutexLocker lock(&mutex_);
+    jobs_.enqueue(job);
+    wake_.wakeOne();
+}
+
+void ToxFileWriter::run()
+{
+    loadJournal();
+
+    QMutexLocker lock(&mutex_);
+    for (;;) {
+        while (jobs_.isEmpty()) {
+            wake_.wait(&mutex_);
+        }
+
+        const Job job = jobs_.dequeue();
+        lock.unlock();
+
+        switch (job.kind) {
+        case Job::Open:
+            execOpen(job);
+            break;
+        case Job::Write:
+            execWrite(job);
+            backlog_.fetchAndSubRelaxed(static_cast<quint64>(job.data.size()));
+            break;
+        case Job::Close:
+            execClose(job);
+            break;
+        case Job::Stop:
+            stop();
+            return;
+        }
+
+        lock.relock();
+    }
+}
+
+/**
+@brief Reads the journal entries of interrupted transfers.
+
+Entries of partial files that vanished are removed.
+*/
+void ToxFileWriter::loadJournal()
+{
+    QHash<QByteArray, Entry> journal;
+    QDir dir(journalDir());
+    const QStringList names = dir.entryList(QDir::Files);
+    for (const QString& name : names) {
+        QFile f(dir.filePath(name));
+        if (!f.open(QFile::ReadOnly)) {
+            continue;
+        }
+
+        QDataStream in(&f);
+        quint32 magic = 0;
+        quint8 version = 0;
+        Entry e;
+        in >> magic >> version >> e.fileName >> e.size >> e.position;
+        f.close();
+
+        const QByteArray key = QByteArray::fromHex(name.toLatin1());
+        if (in.status() == QDataStream::Ok && magic == JournalMagic &&
+            version == JournalVersion &&
+            QFile::exists(partName(e.fileName)))
+        {
+            journal.insert(key, e);
+        } else {
+            f.remove();
+        }
+    }
+
+    QMutexLocker lock(&mutex_);
+    journal_ = journal;
+    ready_ = true;
+    loaded_.wakeAll();
+}
+
+/**
+@brief Suspends the files still open when the writer stops.
+*/
+void ToxFileWriter::stop()
+{
+    const QList<quint64> ids = files_.keys();
+    for (quint64 id : ids) {
+        Job job;
+        job.kind = Job::Close;
+        job.id = id;
+        job.outcome = Outcome::Suspend;
+        execClose(job);
+    }
+}
+
+void ToxFileWriter::execOpen(const Job& job)
+{
+    File f;
+    f.file = new QFile(partName(job.fileName));
+    f.key = job.key;
+    f.entry.fileName = job.fileName;
+    f.entry.size = job.size;
+    f.entry.position = job.position;
+    f.written = job.position;
+
+    const QFile::OpenMode mode = job.position > 0
+            ? QFile::ReadWrite : QFile::WriteOnly | QFile::Truncate;
+    QDir().mkpath(QFileInfo(f.file->fileName()).absolutePath());
+    if (!f.file->open(mode) ||
+        !f.file->seek(static_cast<qint64>(job.position)))
+    {
+        qWarning("Cannot receive file %s: %s",
+                 qUtf8Printable(f.file->fileName()),
+                 qUtf8Printable(f.file->errorString()));
+        fail(job.id, f);
+        files_.insert(job.id, f);
+        return;
+    }
+
+#ifdef Q_OS_UNIX
+    if (job.size != UINT64_MAX) {
+        posix_fallocate(f.file->handle(), 0,
+                        static_cast<off_t>(job.size));
+    }
+#endif
+
+    files_.insert(job.id, f);
+    writeJournal(f.key, f.entry);
+}
+
+void ToxFileWriter::execWrite(const Job& job)
+{
+    auto it = files_.find(job.id);
+    if (it == files_.end() || !it->file) {
+        return;
+    }
+
+    File& f = *it;
+    if (f.written != job.position &&
+        !f.file->seek(static_cast<qint64>(job.position)))
+    {
+        qWarning("Seeking in file %s failed: %s",
+                 qUtf8Printable(f.file->fileName()),
+                 qUtf8Printable(f.file->errorString()));
+        fail(job.id, f);
+        return;
+    }
+
+    const qint64 n = f.file->write(job.data);
+    if (n != job.data.size()) {
+        qWarning("Writing file %s failed: %s",
+                 qUtf8Printable(f.file->fileName()),
+                 qUtf8Printable(f.file->errorString()));
+        fail(job.id, f);
+        return;
+    }
+
+    f.written = job.position + static_cast<quint64>(n);
+    if (f.written - f.entry.position >= SyncInterval) {
+        sync(f);
+    }
+}
+
+void ToxFileWriter::execClose(const Job& job)
+{
+    auto it = files_.find(job.id);
+    if (it == files_.end()) {
+        return;
+    }
+
+    File f = *it;
+    files_.erase(it);
+    if (f.failed) {
+        // already removed and reported
+        return;
+    }
+
+    switch (job.outcome) {
+    case Outcome::Complete:
+        if (!f.file->flush() ||
+            (f.entry.size != UINT64_MAX && f.written != f.entry.size))
+        {
+            qWarning("Received file %s is incomplete: %s",
+                     qUtf8Printable(f.file->fileName()),
+                     qUtf8Printable(f.file->errorString()));
+            fail(job.id, f);
+            return;
+        }
+        f.file->close();
+        if (f.entry.size == UINT64_MAX) {
+            f.entry.size = f.written;
+        }
+        removeJournal(f.key);
+        if (f.file->resize(static_cast<qint64>(f.entry.size)) &&
+            f.file->rename(uniqueName(f.entry.fileName)))
+        {
+            report(job.id, true);
+        } else {
+            // keep the complete data in the partial file
+            qWarning("Cannot rename received file %s: %s",
+                     qUtf8Printable(f.file->fileName()),
+                     qUtf8Printable(f.file->errorString()));
+            report(job.id, false);
+        }
+        break;
+    case Outcome::Suspend:
+        sync(f);
+        f.file->close();
+        break;
+    case Outcome::Discard:
+        f.file->remove();
+        removeJournal(f.key);
+        break;
+    }
+
+    delete f.file;
+}
+
+/**
+@brief Gives up a file that cannot be written.
+@param[in] id   the transfer id
+@param[in] f    the file
+
+The partial file and its journal are removed and the failure is reported.
+The entry stays in place without a file until the transfer is closed.
+*/
+void ToxFileWriter::fail(quint64 id, File& f)
+{
+    f.failed = true;
+    f.file->remove();
+    delete f.file;
+    f.file = nullptr;
+    removeJournal(f.key);
+    report(id, false);
+}
+
+/**
+@brief Queues the result of a file for takeResults().
+@param[in] id   the transfer id
+@param[in] ok   true for a complete file
+*/
+void ToxFileWriter::report(quint64 id, bool ok)
+{
+    QMutexLocker lock(&mutex_);
+    results_.append(qMakePair(id, ok));
+    hasResults_.store(1);
+}
+
+/**
+@brief Syncs the written data and records it in the journal.
+@param[in] f    the file
+*/
+void ToxFileWriter::sync(File& f)
+{
+    f.file->flush();
+#ifdef Q_OS_UNIX
+    fdatasync(f.file->handle());
+#endif
+    f.entry.position = f.written;
+    writeJournal(f.key, f.entry);
+}
+
+void ToxFileWriter::writeJournal(const QByteArray& key, const Entry& entry)
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out << JournalMagic << JournalVersion << entry.fileName << entry.size
+        << entry.position;
+
+    const QString dir = journalDir();
+    QDir().mkpath(dir);
+    ToxerPrivate::writeCache(dir % QLatin1Char('/') %
+                             QString::fromLatin1(key.toHex()), data);
+
+    QMutexLocker lock(&mutex_);
+    journal_.insert(key, entry);
+}
+
+void ToxFileWriter::removeJournal(const QByteArray& key)
+{
+    QFile::remove(journalDir() % QLatin1Char('/') %
+                  QString::fromLatin1(key.toHex()));
+
+    QMutexLocker lock(&mutex_);
+    journal_.remove(key);
+}
+
+/**
+@brief Returns the directory of the journal files.
+*/
+QString ToxFileWriter::journalDir()
+{
+    return QStandardPaths::writableLocation(
+                QStandardPaths::GenericDataLocation) %
+            QStringLiteral("/Toxer/transfers");
+}
+
+/**
+@brief Returns the name of the partial file of a destination.
+@param[in] fileName     the destination of a received file
+*/
+QString ToxFileWriter::partName(const QString& fileName)
+{
+    return fileName % QStringLiteral(".part");
+}
+
+/**
+@brief Returns a name for a received file that does not exist yet.
+@param[in] fileName     the destination of a received file
+@return the destination or a numbered variant like "name (1).ext"
+*/
+QString ToxFileWriter::uniqueName(const QString& fileName)
+{
+    if (!QFile::exists(fileName)) {
+        return fileName;
+    }
+
+    const QFileInfo info(fileName);
+    const QString base = info.dir().filePath(info.completeBaseName());
+    const QString suffix = info.suffix().isEmpty()
+            ? QString() : QString(QLatin1Char('.') % info.suffix());
+    for (int n = 1;; ++n) {
+        const QString name = base % QStringLiteral(" (") %
+                QString::number(n) % QLatin1Char(')') % suffix;
+        if (!QFile::exists(name)) {
+            return name;
+        }
+    }
+}
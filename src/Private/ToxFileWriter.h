@@ -0,0 +1,129 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef TOXER_PRIVATE_TOXFILEWRITER_H
+#define TOXER_PRIVATE_TOXFILEWRITER_H
+
+#include <QAtomicInteger>
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QPair>
+#include <QQueue>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+class QFile;
+
+class ToxFileWriter final : public QThread
+{
+public:
+    enum class Outcome : quint8 {
+        Complete,
+        Suspend,
+        Discard
+    };
+
+    static constexpr quint64 SyncInterval = 8 * 1024 * 1024;
+
+public:
+    ToxFileWriter();
+    ~ToxFileWriter() override;
+
+    bool resumable(const QByteArray& key, quint64 size, QString* fileName,
+                   quint64* position);
+
+    void open(quint64 id, const QString& fileName, const QByteArray& key,
+              quint64 size, quint64 position);
+    void write(quint64 id, quint64 position, const QByteArray& data);
+    void close(quint64 id, Outcome outcome);
+    quint64 backlog() const;
+    QVector<QPair<quint64, bool>> takeResults();
+
+protected:
+    void run() override;
+
+private:
+    struct Job {
+        enum Kind : quint8 { Open, Write, Close, Stop };
+
+        Kind kind;
+        quint64 id;
+        quint64 position;
+        QByteArray data;
+        QString fileName;
+        QByteArray key;
+        quint64 size;
+        Outcome outcome;
+    };
+
+    struct Entry {
+        QString fileName;
+        quint64 size = 0;
+        quint64 position = 0;
+    };
+
+    struct File {
+        QFile* file = nullptr;
+        QByteArray key;
+        Entry entry;
+        quint64 written = 0;
+        bool failed = false;
+    };
+
+private:
+    void enqueue(const Job& job);
+    void loadJournal();
+    void stop();
+    void execOpen(const Job& job);
+    void execWrite(const Job& job);
+    void execClose(const Job& job);
+    void sync(File& f);
+    void fail(quint64 id, File& f);
+    void report(quint64 id, bool ok);
+    void writeJournal(const QByteArray& key, const Entry& entry);
+    void removeJournal(const QByteArray& key);
+
+    static QString journalDir();
+    static QString partName(const QString& fileName);
+    static QString uniqueName(const QString& fileName);
+
+private:
+    QMutex mutex_;
+    QWaitCondition wake_;
+    QWaitCondition loaded_;
+    bool ready_;
+    QQueue<Job> jobs_;
+    QHash<QByteArray, Entry> journal_;
+    QAtomicInteger<quint64> backlog_;
+    QHash<quint64, File> files_;
+    QVector<QPair<quint64, bool>> results_;
+    QAtomicInt hasResults_;
+};
+
+#endif
@@ -0,0 +1,347 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "ToxIconAtlas.h"
+
+#include "ToxerPrivate.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QPainter>
+#include <QRunnable>
+#include <QStandardPaths>
+#include <QStringBuilder>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <cmath>
+
+/**
+@class ToxIconAtlas
+@brief Pre-rasterized theme icons.
+
+The theme icons are SVG files, which are expensive to rasterize. The atlas
+rasterizes every icon of all themes once per cell size and packs them into
+one image. Cell sizes are ToxIconAtlas::IconSize scaled by the device pixel
+ratios of the screens. The atlases are cached on disk and rebuilt only for
+another Toxer version. Icons are then served as copies of their cell, or
+QML clips them from the atlas image directly.
+
+Rasterizing at build time would need Qt Svg on the build host. Instead,
+prepare() builds missing atlases on first run in the background.
+
+Icon names are "<theme>/<icon>", e.g. "dark/dot_online".
+
+
+@var ToxIconAtlas::IconSize
+@brief The logical icon size in pixels.
+
+
+@class ToxIconProvider
+@brief Serves the theme icons to QML.
+
+The image id is either an icon name or "atlas/<cell size>" for a whole
+atlas.
+*/
+
+namespace {
+
+constexpr quint32 CacheMagic = 0x54584941; // "TXIA"
+constexpr quint8 CacheVersion = 1;
+
+const QString iconRoot = QStringLiteral(":/res/images");
+
+QString buildStamp()
+{
+#ifdef TOXER_VERSION
+    return QStringLiteral(TOXER_VERSION);
+#else
+    return QString();
+#endif
+}
+
+}
+
+constexpr int ToxIconAtlas::IconSize;
+
+class ToxIconAtlas::PrepareJob final : public QRunnable
+{
+public:
+    explicit PrepareJob(const QVector<int>& cellSizes)
+        : cellSizes_(cellSizes)
+    {
+    }
+
+    void run() final
+    {
+        ToxIconAtlas::instance().ensure(cellSizes_);
+    }
+
+private:
+    const QVector<int> cellSizes_;
+};
+
+ToxIconAtlas& ToxIconAtlas::instance()
+{
+    static ToxIconAtlas atlas;
+    return atlas;
+}
+
+ToxIconAtlas::ToxIconAtlas()
+{
+}
+
+/**
+@brief Loads or builds the atlases in the background.
+@param[in] cellSizes    the icon sizes in pixels
+*/
+void ToxIconAtlas::prepare(const QVector<int>& cellSizes)
+{
+    QThreadPool::globalInstance()->start(new PrepareJob(cellSizes));
+}
+
+/**
+@brief Returns an icon.
+@param[in] name     the icon name
+@param[in] size     the requested size; invalid for ToxIconAtlas::IconSize
+@return the icon; a null image for unknown names
+
+Icons larger than all atlases are rasterized from the SVG file.
+*/
+QImage ToxIconAtlas::icon(const QString& name, const QSize& size)
+{
+    const int pixels = size.width() > 0 || size.height() > 0
+            ? qMax(size.width(), size.height()) : IconSize;
+
+    QMutexLocker lock(&mutex_);
+    const Atlas* a = select(pixels);
+    if (a && a->cell >= pixels) {
+        const QRect r = a->rects.value(name);
+        return r.isValid() ? a->image.copy(r) : QImage();
+    }
+    lock.unlock();
+
+    QImageReader reader(iconRoot % QLatin1Char('/') % name %
+                        QStringLiteral(".svg"));
+    const QSize full = reader.size();
+    if (full.isValid()) {
+        reader.setScaledSize(full.scaled(pixels, pixels,
+                                         Qt::KeepAspectRatio));
+    }
+    return reader.read();
+}
+
+/**
+@brief Returns an atlas image.
+@param[in] cellSize     the icon size in pixels
+*/
+QImage ToxIconAtlas::atlas(int cellSize)
+{
+    QMutexLocker lock(&mutex_);
+    const Atlas* a = select(cellSize);
+    return a ? a->image : QImage();
+}
+
+/**
+@brief Returns the rectangle of an icon in an atlas image.
+@param[in] name         the icon name
+@param[in] cellSize     the icon size in pixels
+*/
+QRect ToxIconAtlas::rect(const QString& name, int cellSize)
+{
+    QMutexLocker lock(&mutex_);
+    const Atlas* a = select(cellSize);
+    return a ? a->rects.value(name) : QRect();
+}
+
+/**
+@brief Loads or builds missing atlases.
+@param[in] cellSizes    the icon sizes in pixels
+*/
+void ToxIconAtlas::ensure(const QVector<int>& cellSizes)
+{
+    for (int cell : cellSizes) {
+        QMutexLocker lock(&mutex_);
+        const Atlas* existing = select(cell);
+        if (existing && existing->cell == cell) {
+            continue;
+        }
+        lock.unlock();
+
+        Atlas a;
+        a.cell = cell;
+        if (!load(a)) {
+            build(a);
+            save(a);
+        }
+
+        lock.relock();
+        atlases_ << a;
+        std::sort(atlases_.begin(), atlases_.end(),
+                  [](const Atlas& l, const Atlas& r) {
+            return l.cell < r.cell;
+        });
+    }
+}
+
+/**
+@brief Selects the smallest atlas with icons of at least a size.
+@param[in] pixels   the icon size in pixels
+@return the atlas; the largest atlas if none is large enough
+@note The mutex must be locked.
+*/
+const ToxIconAtlas::Atlas* ToxIconAtlas::select(int pixels)
+{
+    for (const Atlas& a : atlases_) {
+        if (a.cell >= pixels) {
+            return &a;
+        }
+    }
+    return atlases_.isEmpty() ? nullptr : &atlases_.last();
+}
+
+bool ToxIconAtlas::load(Atlas& a)
+{
+    QFile f(cacheName(a.cell));
+    if (!f.open(QFile::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream in(&f);
+    quint32 magic = 0;
+    quint8 version = 0;
+    QString stamp;
+    in >> magic >> version >> stamp;
+    if (magic != CacheMagic || version != CacheVersion ||
+        stamp != buildStamp())
+    {
+        return false;
+    }
+
+    in >> a.rects >> a.image;
+    return in.status() == QDataStream::Ok && !a.image.isNull();
+}
+
+/**
+@brief Rasterizes all icons into an atlas.
+@param[in,out] a    the atlas with the cell size set
+*/
+void ToxIconAtlas::build(Atlas& a)
+{
+    QStringList names;
+    const QStringList themes = QDir(iconRoot).entryList(QDir::Dirs |
+                                                        QDir::NoDotAndDotDot);
+    for (const QString& theme : themes) {
+        const QStringList icons =
+                QDir(iconRoot % QLatin1Char('/') % theme).entryList(
+                    QStringList(QStringLiteral("*.svg")), QDir::Files);
+        for (const QString& icon : icons) {
+            names << theme % QLatin1Char('/') % icon.left(icon.length() - 4);
+        }
+    }
+    if (names.isEmpty()) {
+        return;
+    }
+
+    const int columns = static_cast<int>(std::ceil(std::sqrt(names.count())));
+    const int rows = (names.count() + columns - 1) / columns;
+    a.image = QImage(columns * a.cell, rows * a.cell,
+                     QImage::Format_ARGB32_Premultiplied);
+    a.image.fill(Qt::transparent);
+
+    QPainter painter(&a.image);
+    for (int i = 0; i < names.count(); i++) {
+        QImageReader reader(iconRoot % QLatin1Char('/') % names[i] %
+                            QStringLiteral(".svg"));
+        const QSize full = reader.size();
+        const QSize scaled = full.isValid()
+                ? full.scaled(a.cell, a.cell, Qt::KeepAspectRatio)
+                : QSize(a.cell, a.cell);
+        reader.setScaledSize(scaled);
+        const QImage icon = reader.read();
+        if (icon.isNull()) {
+            continue;
+        }
+
+        const QRect r((i % columns) * a.cell, (i / columns) * a.cell,
+                      scaled.width(), scaled.height());
+        painter.drawImage(r.topLeft(), icon);
+        a.rects.insert(names[i], r);
+    }
+}
+
+void ToxIconAtlas::save(const Atlas& a)
+{
+    if (a.image.isNull()) {
+        return;
+    }
+
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out << CacheMagic << CacheVersion << buildStamp() << a.rects << a.image;
+
+    const QString fileName = cacheName(a.cell);
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+    ToxerPrivate::writeCache(fileName, data);
+}
+
+/**
+@brief Returns the cache file of an atlas.
+@param[in] cellSize     the icon size in pixels
+*/
+QString ToxIconAtlas::cacheName(int cellSize)
+{
+    return QStandardPaths::writableLocation(
+                QStandardPaths::GenericCacheLocation) %
+            QStringLiteral("/Toxer/icons@") % QString::number(cellSize) %
+            QStringLiteral(".atlas");
+}
+
+/**
+@brief constructor
+*/
+ToxIconProvider::ToxIconProvider()
+    : QQuickImageProvider(QQmlImageProviderBase::Image)
+{
+}
+
+QImage ToxIconProvider::requestImage(const QString& id, QSize* size,
+                                     const QSize& requestedSize)
+{
+    static const QString atlasPrefix = QStringLiteral("atlas/");
+    const QImage img = id.startsWith(atlasPrefix)
+            ? ToxIconAtlas::instance().atlas(id.mid(atlasPrefix.length())
+                                             .toInt())
+            : ToxIconAtlas::instance().icon(id, requestedSize);
+    if (size) {
+        *size = img.size();
+    }
+    return img;
+}
@@ -0,0 +1,84 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef TOXER_PRIVATE_TOXICONATLAS_H
+#define TOXER_PRIVATE_TOXICONATLAS_H
+
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QQuickImageProvider>
+#include <QVector>
+
+class ToxIconAtlas final
+{
+public:
+    static constexpr int IconSize = 32;
+
+public:
+    static ToxIconAtlas& instance();
+
+    void prepare(const QVector<int>& cellSizes);
+    QImage icon(const QString& name, const QSize& size);
+    QImage atlas(int cellSize);
+    QRect rect(const QString& name, int cellSize);
+
+private:
+    struct Atlas {
+        int cell = 0;
+        QImage image;
+        QHash<QString, QRect> rects;
+    };
+
+private:
+    class PrepareJob;
+
+    ToxIconAtlas();
+
+    void ensure(const QVector<int>& cellSizes);
+    const Atlas* select(int pixels);
+
+    static bool load(Atlas& a);
+    static void build(Atlas& a);
+    static void save(const Atlas& a);
+    static QString cacheName(int cellSize);
+
+private:
+    QMutex mutex_;
+    QVector<Atlas> atlases_;
+};
+
+class ToxIconProvider final : public QQuickImageProvider
+{
+public:
+    ToxIconProvider();
+
+    QImage requestImage(const QString& id, QSize* size,
+                        const QSize& requestedSize) override;
+};
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "ToxMetrics.h"
+
+/**
+@class ToxMetrics
+@brief A process wide registry of counters and measurements.
+
+Metrics are identified by a dotted name like "network.recovery_ms". A
+counter only uses ToxMetrics::Value::count, while a measurement also tracks
+the last, minimum, maximum and total value. All functions are thread-safe.
+QML reads the metrics through Toxer::metrics.
+
+
+@struct ToxMetrics::Value
+@brief The aggregated state of a metric.
+@var count  the number of events or measurements
+@var last   the most recent measurement
+@var min    the smallest measurement
+@var max    the largest measurement
+@var total  the sum of all measurements
+*/
+
+/**
+@brief Returns the process wide metrics registry.
+*/
+ToxMetrics& ToxMetrics::instance()
+{
+    static ToxMetrics metrics;
+    return metrics;
+}
+
+/**
+@brief Counts an event.
+@param[in] name     the metric name
+*/
+void ToxMetrics::increment(const char* name)
+{
+    QMutexLocker lock(&mutex_);
+    values_[QByteArray(name)].count++;
+}
+
+/**
+@brief Records a measurement.
+@param[in] name     the metric name
+@param[in] value    the measured value
+*/
+void ToxMetrics::record(const char* name, qint64 value)
+{
+    QMutexLocker lock(&mutex_);
+    Value& v = values_[QByteArray(name)];
+    v.min = v.count == 0 ? value : qMin(v.min, value);
+    v.max = v.count == 0 ? value : qMax(v.max, value);
+    v.last = value;
+    v.total += value;
+    v.count++;
+}
+
+/**
+@brief Returns the current state of all metrics.
+*/
+QHash<QByteArray, ToxMetrics::Value> ToxMetrics::snapshot() const
+{
+    QMutexLocker lock(&mutex_);
+    return values_;
+}
@@ -0,0 +1,61 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef TOXER_PRIVATE_TOXMETRICS_H
+#define TOXER_PRIVATE_TOXMETRICS_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+
+class ToxMetrics final
+{
+public:
+    struct Value {
+        quint64 count = 0;
+        qint64 last = 0;
+        qint64 min = 0;
+        qint64 max = 0;
+        qint64 total = 0;
+    };
+
+public:
+    static ToxMetrics& instance();
+
+    void increment(const char* name);
+    void record(const char* name, qint64 value);
+
+    QHash<QByteArray, Value> snapshot() const;
+
+private:
+    ToxMetrics() = default;
+
+private:
+    mutable QMutex mutex_;
+    QHash<QByteArray, Value> values_;
+};
+
+#endif
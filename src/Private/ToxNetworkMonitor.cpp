@@ -0,0 +1,172 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "ToxNetworkMonitor.h"
+
+#include "ToxMetrics.h"
+
+#include <QSocketNotifier>
+
+#ifdef Q_OS_LINUX
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#endif
+
+/**
+@class ToxNetworkMonitor
+@brief Reports changes of the local network configuration.
+
+Toxcore notices a changed network only after its own timeouts. Meanwhile the
+self connection status is stale and the profile is offline. The monitor
+subscribes to link, address and route changes of the kernel through an
+rtnetlink socket, so the profiles can bootstrap again right away.
+
+A network change usually produces a burst of netlink messages. The monitor
+emits ToxNetworkMonitor::changed once ToxNetworkMonitor::SettleDelay
+milliseconds after the first message of a burst.
+
+Network changes are detected on Linux only. On other platforms the monitor
+never emits.
+
+
+@var ToxNetworkMonitor::SettleDelay
+@brief The time in milliseconds a burst of netlink messages is collected.
+
+
+@fn ToxNetworkMonitor::changed
+@brief Emitted when a network link, address or route changed.
+*/
+
+constexpr int ToxNetworkMonitor::SettleDelay;
+
+/**
+@brief Returns the process wide network monitor.
+*/
+ToxNetworkMonitor* ToxNetworkMonitor::instance()
+{
+    static ToxNetworkMonitor monitor;
+    return &monitor;
+}
+
+/**
+@brief constructor
+
+Opens the netlink socket.
+*/
+ToxNetworkMonitor::ToxNetworkMonitor()
+    : QObject()
+    , fd_(-1)
+    , notifier_(nullptr)
+{
+    settle_.setSingleShot(true);
+    settle_.setInterval(SettleDelay);
+    connect(&settle_, &QTimer::timeout, this, &ToxNetworkMonitor::changed);
+
+#ifdef Q_OS_LINUX
+    fd_ = ::socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                   NETLINK_ROUTE);
+    if (fd_ < 0) {
+        qWarning("Network change detection unavailable: %s",
+                 strerror(errno));
+        return;
+    }
+
+    sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR |
+                     RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+    if (::bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        qWarning("Network change detection unavailable: %s",
+                 strerror(errno));
+        ::close(fd_);
+        fd_ = -1;
+        return;
+    }
+
+    notifier_ = new QSocketNotifier(fd_, QSocketNotifier::Read, this);
+    connect(notifier_, &QSocketNotifier::activated,
+            this, &ToxNetworkMonitor::readEvents);
+#endif
+}
+
+/**
+@brief destructor
+
+Closes the netlink socket.
+*/
+ToxNetworkMonitor::~ToxNetworkMonitor()
+{
+    delete notifier_;
+#ifdef Q_OS_LINUX
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+#endif
+}
+
+/**
+@brief Drains the netlink socket and starts the settle timer on changes.
+*/
+void ToxNetworkMonitor::readEvents()
+{
+#ifdef Q_OS_LINUX
+    bool relevant = false;
+    char buffer[8192];
+    for (;;) {
+        const ssize_t len = ::recv(fd_, buffer, sizeof(buffer), 0);
+        if (len <= 0) {
+            break;
+        }
+
+        int remaining = static_cast<int>(len);
+        for (const nlmsghdr* msg = reinterpret_cast<const nlmsghdr*>(buffer);
+             NLMSG_OK(msg, remaining); msg = NLMSG_NEXT(msg, remaining))
+        {
+            switch (msg->nlmsg_type) {
+            case RTM_NEWLINK:
+            case RTM_DELLINK:
+            case RTM_NEWADDR:
+            case RTM_DELADDR:
+            case RTM_NEWROUTE:
+            case RTM_DELROUTE:
+                relevant = true;
+                break;
+            }
+        }
+    }
+
+    if (relevant && !settle_.isActive()) {
+        ToxMetrics::instance().increment("network.changes");
+        settle_.start();
+    }
+#endif
+}
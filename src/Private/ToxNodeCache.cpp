@@ -0,0 +1,338 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "ToxNodeCache.h"
+
+#include "ToxSaver.h"
+
+#include <tox/tox.h>
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QStandardPaths>
+#include <QStringBuilder>
+#include <QtEndian>
+
+#include <algorithm>
+
+#include <arpa/inet.h>
+
+/**
+@class ToxNodeCache
+@brief Remembers the DHT nodes and TCP relays of recent sessions.
+
+The Tox savedata contains the DHT nodes and TCP relays an instance was
+connected to. Whenever a profile is saved, these are merged into a small
+cache file of the profile. The next activation bootstraps from the most
+recently seen nodes first, so a restart reconnects to known peers instead
+of waiting for the DHT discovery through the static nodes.
+
+The nodes tell where a profile was connected from, so the cache file is
+encrypted with the key of an encrypted profile and never shared between
+profiles. A cache file that cannot be decrypted is ignored.
+
+The cache keeps the ToxNodeCache::MaxNodes most recently seen nodes.
+
+
+@struct ToxNodeCache::Node
+@brief A cached DHT node or TCP relay.
+@var address    the numeric IPv4 or IPv6 address
+@var port       the port in host byte order
+@var key        the public key of the node
+@var tcp        true for a TCP relay; false for a DHT node
+@var lastSeen   the time of the last save listing the node
+*/
+
+namespace {
+
+constexpr quint32 FileMagic = 0x54584e43; // "TXNC"
+constexpr quint8 FileVersion = 1;
+
+constexpr quint32 StateCookie = 0x15ed1b1f;
+constexpr quint16 SectionCookie = 0x01ce;
+constexpr quint16 SectionDht = 2;
+constexpr quint16 SectionTcpRelay = 10;
+constexpr quint16 SectionEnd = 255;
+
+constexpr quint32 DhtCookie = 0x0159000d;
+constexpr quint16 DhtSectionCookie = 0x11ce;
+constexpr quint16 DhtSectionNodes = 4;
+
+constexpr quint8 FamilyUdp4 = 2;
+constexpr quint8 FamilyUdp6 = 10;
+constexpr quint8 FamilyTcp4 = 130;
+constexpr quint8 FamilyTcp6 = 138;
+
+inline bool sameNode(const ToxNodeCache::Node& a, const ToxNodeCache::Node& b)
+{
+    return a.tcp == b.tcp && a.port == b.port && a.address == b.address &&
+            a.key == b.key;
+}
+
+}
+
+/**
+@brief constructor
+@param[in] profileName  the name of the profile
+@param[in] key          the profile encryption key; nullptr if unencrypted
+
+Loads the cache file of the profile.
+*/
+ToxNodeCache::ToxNodeCache(const QString& profileName,
+                           const ToxerPrivate::PassKeyPtr& key)
+    : fileName_(cacheDir() % QLatin1Char('/') % profileName %
+                QStringLiteral(".nodes"))
+    , key_(key)
+{
+    QFile f(fileName_);
+    if (!f.open(QFile::ReadOnly)) {
+        return;
+    }
+
+    QByteArray data = f.readAll();
+    if (key_) {
+        data = ToxerPrivate::decrypt(data.constData(), data.size(), key_);
+    }
+
+    QDataStream in(data);
+    quint32 magic = 0;
+    quint8 version = 0;
+    quint32 count = 0;
+    in >> magic >> version >> count;
+    if (magic != FileMagic || version != FileVersion) {
+        return;
+    }
+
+    for (quint32 i = 0; i < count && i < MaxNodes; i++) {
+        Node n;
+        in >> n.address >> n.port >> n.key >> n.tcp >> n.lastSeen;
+        if (in.status() != QDataStream::Ok) {
+            break;
+        }
+        nodes_ << n;
+    }
+}
+
+/**
+@brief Merges the nodes listed in Tox savedata into the cache.
+@param[in] savedata     the unencrypted Tox savedata
+@param[in] len          the savedata length
+*/
+void ToxNodeCache::record(const uint8_t* savedata, size_t len)
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    const QVector<Node> seen = parse(savedata, len, now);
+    if (seen.isEmpty()) {
+        return;
+    }
+
+    QMutexLocker lock(&mutex_);
+    for (const Node& n : seen) {
+        auto it = std::find_if(nodes_.begin(), nodes_.end(),
+                               [&n](const Node& other) {
+            return sameNode(n, other);
+        });
+        if (it == nodes_.end()) {
+            nodes_ << n;
+        } else {
+            it->lastSeen = now;
+        }
+    }
+
+    std::stable_sort(nodes_.begin(), nodes_.end(),
+                     [](const Node& a, const Node& b) {
+        return a.lastSeen > b.lastSeen;
+    });
+    if (nodes_.count() > MaxNodes) {
+        nodes_.resize(MaxNodes);
+    }
+
+    store();
+}
+
+/**
+@brief Returns the most recently seen nodes.
+@param[in] count    the maximum number of nodes
+@return the nodes ordered from most to least recently seen
+*/
+QVector<ToxNodeCache::Node> ToxNodeCache::nodes(int count) const
+{
+    QMutexLocker lock(&mutex_);
+    return nodes_.mid(0, count);
+}
+
+/**
+@brief Atomically writes the cache file.
+@note The mutex must be locked.
+*/
+void ToxNodeCache::store() const
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out << FileMagic << FileVersion << static_cast<quint32>(nodes_.count());
+    for (const Node& n : nodes_) {
+        out << n.address << n.port << n.key << n.tcp << n.lastSeen;
+    }
+
+    if (key_) {
+        data = ToxerPrivate::encrypt(data.constData(), data.size(), key_);
+        if (data.isEmpty()) {
+            return;
+        }
+    }
+
+    QDir().mkpath(cacheDir());
+    ToxProfileSaver::write(fileName_, data);
+}
+
+/**
+@brief Returns the absolute path of the directory of the cache files.
+*/
+QString ToxNodeCache::cacheDir()
+{
+    return QStandardPaths::writableLocation(
+                QStandardPaths::GenericCacheLocation) %
+            QStringLiteral("/Toxer");
+}
+
+/**
+@brief Extracts the DHT nodes and TCP relays from Tox savedata.
+@param[in] savedata     the unencrypted Tox savedata
+@param[in] len          the savedata length
+@param[in] now          the time to stamp the nodes with
+@return the nodes found
+
+The savedata consists of a global cookie followed by sections, each with a
+little endian length, type and section cookie.
+*/
+QVector<ToxNodeCache::Node> ToxNodeCache::parse(const uint8_t* savedata,
+                                                size_t len, qint64 now)
+{
+    QVector<Node> out;
+    if (len < 8 || qFromLittleEndian<quint32>(savedata) != 0 ||
+        qFromLittleEndian<quint32>(savedata + 4) != StateCookie)
+    {
+        return out;
+    }
+
+    size_t pos = 8;
+    while (pos + 8 <= len) {
+        const quint32 size = qFromLittleEndian<quint32>(savedata + pos);
+        const quint32 type = qFromLittleEndian<quint32>(savedata + pos + 4);
+        pos += 8;
+        if ((type >> 16) != SectionCookie || size > len - pos) {
+            break;
+        }
+
+        switch (type & 0xffff) {
+        case SectionDht:
+            parseDht(savedata + pos, size, now, out);
+            break;
+        case SectionTcpRelay:
+            parseNodes(savedata + pos, size, now, out);
+            break;
+        case SectionEnd:
+            return out;
+        }
+
+        pos += size;
+    }
+
+    return out;
+}
+
+/**
+@brief Extracts the nodes from the DHT section of Tox savedata.
+*/
+void ToxNodeCache::parseDht(const uint8_t* data, size_t len, qint64 now,
+                            QVector<Node>& out)
+{
+    if (len < 4 || qFromLittleEndian<quint32>(data) != DhtCookie) {
+        return;
+    }
+
+    size_t pos = 4;
+    while (pos + 8 <= len) {
+        const quint32 size = qFromLittleEndian<quint32>(data + pos);
+        const quint32 type = qFromLittleEndian<quint32>(data + pos + 4);
+        pos += 8;
+        if ((type >> 16) != DhtSectionCookie || size > len - pos) {
+            return;
+        }
+
+        if ((type & 0xffff) == DhtSectionNodes) {
+            parseNodes(data + pos, size, now, out);
+        }
+
+        pos += size;
+    }
+}
+
+/**
+@brief Extracts a list of packed nodes.
+
+A packed node is the address family, the IPv4 or IPv6 address, the port in
+network byte order and the public key.
+*/
+void ToxNodeCache::parseNodes(const uint8_t* data, size_t len, qint64 now,
+                              QVector<Node>& out)
+{
+    size_t pos = 0;
+    while (pos < len) {
+        size_t ipLen = 0;
+        int af = AF_INET;
+        bool tcp = false;
+        switch (data[pos]) {
+        case FamilyUdp4: ipLen = 4; break;
+        case FamilyUdp6: ipLen = 16; af = AF_INET6; break;
+        case FamilyTcp4: ipLen = 4; tcp = true; break;
+        case FamilyTcp6: ipLen = 16; af = AF_INET6; tcp = true; break;
+        default: return;
+        }
+
+        const size_t nodeLen = 1 + ipLen + 2 + TOX_PUBLIC_KEY_SIZE;
+        if (pos + nodeLen > len) {
+            return;
+        }
+
+        char address[INET6_ADDRSTRLEN];
+        const uint8_t* ip = data + pos + 1;
+        if (inet_ntop(af, ip, address, sizeof(address))) {
+            Node n;
+            n.address = QByteArray(address);
+            n.port = qFromBigEndian<quint16>(ip + ipLen);
+            n.key = QByteArray(reinterpret_cast<const char*>(ip + ipLen + 2),
+                               TOX_PUBLIC_KEY_SIZE);
+            n.tcp = tcp;
+            n.lastSeen = now;
+            out << n;
+        }
+
+        pos += nodeLen;
+    }
+}
@@ -0,0 +1,75 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef TOXER_PRIVATE_TOXNODECACHE_H
+#define TOXER_PRIVATE_TOXNODECACHE_H
+
+#include "ToxerPrivate.h"
+
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+class ToxNodeCache final
+{
+public:
+    static constexpr int MaxNodes = 64;
+
+    struct Node {
+        QByteArray address;
+        quint16 port;
+        QByteArray key;
+        bool tcp;
+        qint64 lastSeen;
+    };
+
+public:
+    ToxNodeCache(const QString& profileName,
+                 const ToxerPrivate::PassKeyPtr& key);
+
+    void record(const uint8_t* savedata, size_t len);
+    QVector<Node> nodes(int count) const;
+
+private:
+    void store() const;
+
+    static QString cacheDir();
+    static QVector<Node> parse(const uint8_t* savedata, size_t len,
+                               qint64 now);
+    static void parseDht(const uint8_t* data, size_t len, qint64 now,
+                         QVector<Node>& out);
+    static void parseNodes(const uint8_t* data, size_t len, qint64 now,
+                           QVector<Node>& out);
+
+private:
+    const QString fileName_;
+    const ToxerPrivate::PassKeyPtr key_;
+    mutable QMutex mutex_;
+    QVector<Node> nodes_;
+};
+
+#endif
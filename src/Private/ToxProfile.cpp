@@ -27,16 +27,36 @@
 #include "ToxProfile.h"
 
 #include "ToxBootstrap.h"
+#include "ToxCalls.h"
+#include "ToxConferences.h"
+#include "ToxMetrics.h"
+#include "ToxNetworkMonitor.h"
+#include "ToxReconfigurer.h"
+#include "ToxSaver.h"
+#include "ToxSounds.h"
+#include "ToxStartupTrace.h"
+#include "ToxTransfers.h"
 #include "Settings.h"
 #include "IToxNotify.h"
 
 #include <QFile>
 
 ToxProfilePrivate* ToxProfilePrivate::activeProfile = nullptr;
+QVector<ToxProfilePrivate*> ToxProfilePrivate::standbyProfiles = {};
+constexpr unsigned long ToxProfilePrivate::ToxEventLoop::StandbyInterval;
+constexpr qint64 ToxProfilePrivate::ToxEventLoop::StallTimeout;
+constexpr int ToxProfilePrivate::ToxEventLoop::StallRelays;
+constexpr int ToxProfilePrivate::MaxBacklog;
 
 /**
 @class ToxProfilePrivate
 @brief Tox profile Qt implementation.
+
+The notification observers are read by the event loop while it iterates Tox
+and are changed on the GUI thread. Both sides hold the event loop mutex.
+
+@var ToxProfilePrivate::MaxBacklog
+@brief The number of events kept for a profile in standby.
 */
 
 /**
@@ -46,114 +66,191 @@ ToxProfilePrivate* ToxProfilePrivate::activeProfile = nullptr;
 */
 void ToxProfilePrivate::create(const QString& name, const QString& password)
 {
-    QFile f(ToxerPrivate::profilesDir() % QString::fromUtf8("/%1.tox")
-            .arg(name));
-
-    if (f.exists()) {
+    const QString fileName = ToxerPrivate::profilePath(name);
+    if (QFile::exists(fileName)) {
         qWarning("Exiting Tox profile found at \"%s\"",
-                 qUtf8Printable(f.fileName()));
+                 qUtf8Printable(fileName));
         return;
     }
 
-    if (f.open(QFile::WriteOnly)) {
-        Tox* t = createTox({});
-        if (t) {
-            size_t c_size = tox_get_savedata_size(t);
-            uint8_t* c_data = new uint8_t[c_size];
-            tox_get_savedata(t, c_data);
-
-            TOX_ERR_ENCRYPTION err = TOX_ERR_ENCRYPTION_OK;
-            size_t c_encrypted_size = c_size + TOX_PASS_ENCRYPTION_EXTRA_LENGTH;
-            uint8_t* c_encrypted = new uint8_t[c_encrypted_size];
-            QByteArray pw = password.toUtf8();
-            tox_pass_encrypt(c_data, c_size,
-                             reinterpret_cast<const uint8_t*>(pw.constData()),
-                             static_cast<size_t>(pw.length()), c_encrypted,
-                             &err);
-
-            if (err == TOX_ERR_ENCRYPTION_OK) {
-                f.write(reinterpret_cast<char*>(c_encrypted),
-                        static_cast<qint64>(c_encrypted_size));
-            } else {
-                qWarning("Encryption of Tox profile failed.");
-            }
+    Tox* t = createTox(nullptr, 0);
+    if (t) {
+        QByteArray data(static_cast<int>(tox_get_savedata_size(t)), 0);
+        tox_get_savedata(t, reinterpret_cast<uint8_t*>(data.data()));
+        tox_kill(t);
 
-            delete[] c_data;
-            delete[] c_encrypted;
-            tox_kill(t);
+        const QByteArray pw = password.toUtf8();
+        const ToxerPrivate::PassKeyPtr key =
+                ToxerPrivate::createKey(pw.constData(), pw.length(), nullptr);
+        const QByteArray encrypted =
+                key ? ToxerPrivate::encrypt(data.constData(), data.length(),
+                                            key)
+                    : QByteArray();
+        if (encrypted.isEmpty()) {
+            qWarning("Encryption of Tox profile failed.");
+        } else if (!ToxProfileSaver::write(fileName, encrypted)) {
+            qWarning("Failed to create Tox profile %s.",
+                     qUtf8Printable(name));
         }
-    } else {
-        qWarning("Failed to create Tox profile %s.\nError message: %s",
-                 qUtf8Printable(name),
-                 qUtf8Printable(f.errorString()));
     }
 }
 
 /**
-@brief Loads a Tox profile.
-@param[in] name         the profile name
-@param[in] password     the profile password
-@return the profile data
+@brief Activates a Tox profile.
+@param[in] profileName  the profile name
+@param[in] tox          the Tox instance created from the profile data
+@param[in] key          the profile encryption key; nullptr if unencrypted
+@note A previously active profile will be closed.
+
+The profile takes ownership of the Tox instance.
 */
-QByteArray ToxProfilePrivate::load(const QString& name, const QString& password)
+void ToxProfilePrivate::activate(const QString& profileName, Tox* tox,
+                                 const ToxerPrivate::PassKeyPtr& key)
 {
-    QFile f(ToxerPrivate::profilesDir() % QString::fromUtf8("/%1.tox")
-            .arg(name));
+    Q_ASSERT(tox);
+
+    ToxProfilePrivate* p = new ToxProfilePrivate(profileName, tox, key);
+    makeActive(p);
+    p->start();
+}
 
-    if (!f.exists()) {
-        qWarning("No Tox savefile found at \"%s\"",
-                 qUtf8Printable(f.fileName()));
-        return {};
+/**
+@brief Returns a profile kept in standby.
+@param[in] profileName  the profile name
+@return the standby profile or nullptr
+*/
+ToxProfilePrivate* ToxProfilePrivate::standby(const QString& profileName)
+{
+    for (ToxProfilePrivate* p : standbyProfiles) {
+        if (p->name() == profileName) {
+            return p;
+        }
     }
 
-    if (f.open(QFile::ReadOnly)) {
-        const QByteArray data = f.readAll();
-        const QByteArray decrypted =
-                ToxerPrivate::isEncrypted(data.constData())
-                ? ToxerPrivate::decrypt(data.constData(), data.length(),
-                                        password)
-                : data;
+    return nullptr;
+}
 
-        return decrypted;
-    } else {
-        qWarning("Failed to open Tox profile %s.\nError message: %s",
-                 qUtf8Printable(name),
-                 qUtf8Printable(f.errorString()));
+/**
+@brief Activates a profile kept in standby.
+@param[in] profileName  the profile name
+@return true, if the profile was found in standby; false otherwise
 
-        return {};
+The Tox instance of the profile stayed online, so activation only rebinds
+the notifiers and restores the regular iteration interval.
+*/
+bool ToxProfilePrivate::resume(const QString& profileName)
+{
+    ToxProfilePrivate* p = standby(profileName);
+    if (p) {
+        standbyProfiles.removeOne(p);
+        makeActive(p);
     }
+
+    return p != nullptr;
 }
 
 /**
-@brief Activates a Tox profile.
-@note A previously active profile will be closed.
+@brief Closes the active profile.
+
+If standby profiles are enabled in ToxSettings, the profile stays online in
+standby mode. The least recently used standby profile is closed, when the
+configured number of standby profiles is exceeded.
 */
-void ToxProfilePrivate::activate(const QString& profileName,
-                          const QString& password)
+void ToxProfilePrivate::close()
 {
-    if (activeProfile && activeProfile->name() == profileName) {
-        return;
+    ToxProfilePrivate* p = activeProfile;
+    if (p) {
+        activeProfile = nullptr;
+        {
+            QMutexLocker locker(&p->mTEL->mutex_);
+            p->profileNotifiers.clear();
+            p->friendNotifiers.clear();
+            p->transferNotifiers.clear();
+            p->conferenceNotifiers.clear();
+            p->callNotifiers.clear();
+            p->mTEL->setStandby(true);
+        }
+        park(p);
     }
+}
 
+/**
+@brief Closes the active profile and all standby profiles.
+*/
+void ToxProfilePrivate::closeAll()
+{
     delete activeProfile;
+    qDeleteAll(standbyProfiles);
+    standbyProfiles.clear();
+}
 
-    QByteArray profileData = load(profileName, password);
-    if (!profileData.isEmpty()) {
-        activeProfile = new ToxProfilePrivate(profileName, profileData);
-        activeProfile->start();
-    } else {
-        qWarning("Tox profile not activated: Wrong password.");
+/**
+@brief Makes a profile the active profile.
+@param[in] profile  the profile
+
+The notification observers of the previously active profile are handed over
+to the new profile, while the previous profile goes to standby. Both event
+loops are locked meanwhile, so no event is dispatched to a half handed over
+profile. The events the new profile kept during standby are dispatched on
+its next iteration.
+*/
+void ToxProfilePrivate::makeActive(ToxProfilePrivate* profile)
+{
+    ToxProfilePrivate* old = activeProfile;
+    QMutexLocker locker(&profile->mTEL->mutex_);
+    if (old) {
+        QMutexLocker oldLocker(&old->mTEL->mutex_);
+        profile->profileNotifiers.swap(old->profileNotifiers);
+        profile->friendNotifiers.swap(old->friendNotifiers);
+        profile->transferNotifiers.swap(old->transferNotifiers);
+        profile->conferenceNotifiers.swap(old->conferenceNotifiers);
+        profile->callNotifiers.swap(old->callNotifiers);
+        old->profileNotifiers.clear();
+        old->friendNotifiers.clear();
+        old->transferNotifiers.clear();
+        old->conferenceNotifiers.clear();
+        old->callNotifiers.clear();
+        old->mTEL->setStandby(true);
     }
 
-    return;
+    activeProfile = profile;
+    profile->mTEL->setStandby(false);
+    locker.unlock();
+
+    if (old) {
+        park(old);
+    }
+}
+
+/**
+@brief Puts a profile into standby or closes it.
+@param[in] profile  the profile that is no longer active
+*/
+void ToxProfilePrivate::park(ToxProfilePrivate* profile)
+{
+    const int capacity = ToxSettings().standby_profiles();
+    if (capacity <= 0) {
+        delete profile;
+        return;
+    }
+
+    profile->mTEL->setStandby(true);
+    standbyProfiles.prepend(profile);
+    while (standbyProfiles.count() > capacity) {
+        delete standbyProfiles.takeLast();
+    }
 }
 
 /**
 @brief Creates a Tox instance for the profile.
-@param profileData  the saved profile state
+@param profileData  the saved profile state; nullptr for a new profile
+@param len          the length of the saved profile state
 @return the created Tox instance
+
+Tox parses the profile data during the call. The caller may wipe the data as
+soon as the function returns.
 */
-Tox* ToxProfilePrivate::createTox(const QByteArray& profileData)
+Tox* ToxProfilePrivate::createTox(const uint8_t* profileData, size_t len)
 {
     ToxSettings toxSettings;
 
@@ -162,11 +259,10 @@ Tox* ToxProfilePrivate::createTox(const QByteArray& profileData)
     toxOpts.ipv6_enabled = toxSettings.ipv6_enabled();
     toxOpts.udp_enabled = toxSettings.udp_enabled();
 
-    if (!profileData.isEmpty()) {
+    if (profileData && len > 0) {
         toxOpts.savedata_type = TOX_SAVEDATA_TYPE_TOX_SAVE;
-        toxOpts.savedata_data =
-                reinterpret_cast<const uint8_t*>(profileData.constData());
-        toxOpts.savedata_length = static_cast<size_t>(profileData.size());
+        toxOpts.savedata_data = profileData;
+        toxOpts.savedata_length = len;
     }
 
     ToxTypes::Proxy proxyType = toxSettings.proxy_type();
@@ -197,159 +293,557 @@ Tox* ToxProfilePrivate::createTox(const QByteArray& profileData)
     return tox;
 }
 
-ToxProfilePrivate::ToxEventLoop::ToxEventLoop(Tox* _tox)
+/**
+@brief Bootstraps a Tox instance into the DHT network.
+@param[in] tox      the Tox instance
+@param[in] cache    the node cache of the profile
+
+Resolving the node addresses may block. Bootstrap before the event loop of
+the profile is started.
+@see ToxBootstrapper
+*/
+void ToxProfilePrivate::bootstrap(Tox* tox, const ToxNodeCache& cache)
+{
+    ToxBootstrapper::instance().bootstrap(
+                tox, cache.nodes(ToxBootstrapper::CachedFanOut));
+}
+
+ToxProfilePrivate::ToxEventLoop::ToxEventLoop(Tox* _tox,
+                                              ToxProfilePrivate* profile)
     : QThread()
     , tox_(_tox)
+    , pending_(nullptr)
+    , pendingRevision_(0)
+    , profile_(profile)
     , active_(false)
+    , standby_(0)
+    , networkChanged_(0)
+    , stallStage_(0)
 {
     Q_ASSERT(tox_);
     setObjectName(QStringLiteral("ToxEventLoop"));
 }
 
-void ToxProfilePrivate::ToxEventLoop::bootstrap()
-{
-    Q_ASSERT(tox_);
-    Q_ASSERT(!isRunning());
-
-    quint32 j = static_cast<quint32>(qrand());
-
-    for (int i = 0; i < 4; i++, j++) {
-        const BootstrapNode *d =
-                &bootstrap_nodes[j % COUNTOF(bootstrap_nodes)];
-        TOX_ERR_BOOTSTRAP err = TOX_ERR_BOOTSTRAP_OK;
-        tox_bootstrap(tox_, d->address, d->port, d->key, &err);
-        if (err) {
-            qWarning("Failed to bootstrap address %s. Code: %d",
-                     d->address, err);
-        }
+/**
+@brief destructor
 
-        tox_add_tcp_relay(tox_, d->address, d->port, d->key, &err);
-        if (err) {
-            qWarning("Failed to add TCP relay for %s. Code: %d",
-                     d->address, err);
-        }
+Releases the Tox instances. The thread must have finished.
+*/
+ToxProfilePrivate::ToxEventLoop::~ToxEventLoop()
+{
+    if (pending_) {
+        ToxBootstrapper::instance().release(pending_);
+        tox_kill(pending_);
     }
+    ToxBootstrapper::instance().release(tox_);
+    tox_kill(tox_);
 }
 
+/**
+@brief Iterates Tox until the event loop is stopped.
+
+The mutex is held for the whole iteration and only released while sleeping.
+This serializes Tox with the queries of the GUI and guards the observers.
+*/
 void ToxProfilePrivate::ToxEventLoop::run()
 {
     QMutexLocker locker(&mutex_);
-    const size_t interval = tox_iteration_interval(tox_);
     active_ = true;
-    locker.unlock();
+    lastProgress_.start();
 
     while (active_) {
-        tox_iterate(tox_, nullptr);
+        if (networkChanged_.fetchAndStoreRelaxed(0)) {
+            // only a change that dropped the connection is a recovery
+            if (tox_self_get_connection_status(tox_) == TOX_CONNECTION_NONE) {
+                recovery_.start();
+            } else {
+                recovery_.invalidate();
+            }
+            ToxBootstrapper::instance().bootstrap(tox_);
+        }
+
+        adoptPending();
+        watchdog(locker);
+        if (!standby_.load()) {
+            profile_->replayBacklog();
+        }
+        profile_->mTransfers->poll(tox_);
+        tox_iterate(tox_, profile_);
+        profile_->mTransfers->schedule(tox_);
+        profile_->mConferences->update(tox_);
+        profile_->mCalls->update();
+
+        unsigned long interval = standby_.load()
+                ? StandbyInterval : tox_iteration_interval(tox_);
+        if (profile_->mTransfers->isBusy()) {
+            interval = qMin(interval, ToxTransfers::BusyInterval);
+        }
+        locker.unlock();
         msleep(interval);
+        locker.relock();
     }
+}
 
-    locker.relock();
+/**
+@brief Hands a replacement Tox instance to the event loop.
+@param[in] tox          the new Tox instance
+@param[in] revision     the profile revision the instance was created from
+
+This function is thread-safe. The event loop takes ownership of the instance
+and swaps it in before its next iteration, if the profile was not modified
+since the given revision.
+*/
+void ToxProfilePrivate::ToxEventLoop::replace(Tox* tox, quint64 revision)
+{
+    QMutexLocker locker(&mutex_);
+    if (pending_) {
+        ToxBootstrapper::instance().release(pending_);
+        tox_kill(pending_);
+    }
+
+    pending_ = tox;
+    pendingRevision_ = revision;
+}
+
+/**
+@brief Swaps in a pending replacement Tox instance.
+
+An outdated replacement is dropped and a new one is requested.
+@note The mutex must be locked.
+*/
+void ToxProfilePrivate::ToxEventLoop::adoptPending()
+{
+    if (!pending_) {
+        return;
+    }
+
+    if (pendingRevision_ == profile_->mRevision) {
+        swap(pending_);
+    } else {
+        ToxBootstrapper::instance().release(pending_);
+        tox_kill(pending_);
+        QMetaObject::invokeMethod(profile_->mReconfigurer, "schedule",
+                                  Qt::QueuedConnection);
+    }
+
+    pending_ = nullptr;
+}
+
+/**
+@brief Replaces the Tox instance.
+@param[in] tox  the new Tox instance
+@note The mutex must be locked.
+
+The observers are told that the profile and its friends went offline and
+that all file transfers and calls ended. The new instance reports its
+connections through the regular callbacks. The conference peers are compared
+with the new instance on the next iteration.
+*/
+void ToxProfilePrivate::ToxEventLoop::swap(Tox* tox)
+{
+    if (tox_self_get_connection_status(tox_) != TOX_CONNECTION_NONE) {
+        for (auto n : profile_->profileNotifiers) {
+            n->on_is_online_changed(false);
+        }
+    }
+
+    QVector<uint32_t> friends(
+                static_cast<int>(tox_self_get_friend_list_size(tox_)));
+    tox_self_get_friend_list(tox_, friends.data());
+    for (uint32_t f : friends) {
+        if (tox_friend_get_connection_status(tox_, f, nullptr) !=
+            TOX_CONNECTION_NONE)
+        {
+            for (auto n : profile_->friendNotifiers) {
+                n->on_is_online_changed(static_cast<int>(f), false);
+            }
+        }
+    }
+
+    profile_->mTransfers->abortAll();
+    profile_->mCalls->attach(tox);
+
+    ToxBootstrapper::instance().release(tox_);
     tox_kill(tox_);
+    tox_ = tox;
+    profile_->mConferences->reset(tox_);
 }
 
-ToxProfilePrivate::ToxProfilePrivate(const QString& name,
-                                     const QByteArray& profileData)
-    : mName(name)
-    , mTEL(new ToxEventLoop(createTox(profileData)))
+/**
+@brief Tracks the recovery from a network change.
+@param[in] status   the new self connection status
+
+Called on the event loop thread. The time from a network change that left
+the instance offline to the next connection is recorded as
+"network.recovery_ms" metric.
+*/
+void ToxProfilePrivate::ToxEventLoop::connectionChanged(TOX_CONNECTION status)
+{
+    progress();
+    if (status != TOX_CONNECTION_NONE) {
+        ToxStartupTrace::instance().mark("self_online");
+    }
+
+    if (status != TOX_CONNECTION_NONE && recovery_.isValid()) {
+        ToxMetrics::instance().record("network.recovery_ms",
+                                      recovery_.elapsed());
+        recovery_.invalidate();
+    }
+}
+
+/**
+@brief Resets the stall watchdog.
+
+Called on the event loop thread whenever the self or a friend connection
+changed.
+*/
+void ToxProfilePrivate::ToxEventLoop::progress()
 {
-    tox_callback_self_connection_status(mTEL->tox_,
-                                        [](Tox*, TOX_CONNECTION status, void*)
+    lastProgress_.restart();
+    stallStage_ = 0;
+}
+
+/**
+@brief Recovers a Tox instance that stays offline.
+
+Toxcore does not expose the state of the DHT. The watchdog therefore
+considers the instance stalled, when it stays offline without any connection
+change for StallTimeout milliseconds. Each further StallTimeout the recovery
+escalates:
+1. bootstrap again
+2. add StallRelays TCP relays
+3. recreate the Tox instance from its current savedata
+
+Each step is counted in the "watchdog.*" metrics.
+@param[in] locker   the locker holding the mutex
+*/
+void ToxProfilePrivate::ToxEventLoop::watchdog(QMutexLocker& locker)
+{
+    if (tox_self_get_connection_status(tox_) != TOX_CONNECTION_NONE) {
+        progress();
+        return;
+    }
+
+    if (lastProgress_.elapsed() < StallTimeout * (stallStage_ + 1)) {
+        return;
+    }
+
+    switch (stallStage_) {
+    case 0:
+        ToxMetrics::instance().increment("watchdog.rebootstrap");
+        ToxBootstrapper::instance().bootstrap(tox_);
+        stallStage_++;
+        break;
+    case 1:
+        ToxMetrics::instance().increment("watchdog.relays");
+        ToxBootstrapper::instance().addRelays(tox_, StallRelays);
+        stallStage_++;
+        break;
+    default:
+        ToxMetrics::instance().increment("watchdog.recreate");
+        recreate(locker);
+        progress();
+        break;
+    }
+}
+
+/**
+@brief Replaces the Tox instance by a new one created from its savedata.
+
+Called on the event loop thread. The savedata only exists in secure memory
+during the call. It is taken together with the profile revision while the
+mutex is locked. The mutex is released while the new instance is created,
+which may take a while. Like a replacement of the ToxReconfigurer, the new
+instance is dropped if the profile was modified meanwhile; the watchdog
+tries again later.
+@param[in] locker   the locker holding the mutex
+*/
+void ToxProfilePrivate::ToxEventLoop::recreate(QMutexLocker& locker)
+{
+    SecureBuffer data(tox_get_savedata_size(tox_));
+    if (data.isNull()) {
+        return;
+    }
+    tox_get_savedata(tox_, data.data());
+    const quint64 revision = profile_->mRevision;
+
+    locker.unlock();
+    Tox* tox = ToxProfilePrivate::createTox(data.constData(), data.size());
+    data.clear();
+    if (tox) {
+        setupCallbacks(tox);
+        ToxProfilePrivate::bootstrap(tox, profile_->nodeCache());
+    }
+    locker.relock();
+
+    if (!tox) {
+        qWarning("Recreation of stalled Tox instance failed.");
+        return;
+    }
+
+    if (revision != profile_->mRevision) {
+        ToxBootstrapper::instance().release(tox);
+        tox_kill(tox);
+        return;
+    }
+
+    swap(tox);
+}
+
+/**
+@brief Registers the Tox callbacks of a profile.
+@param[in] tox  the Tox instance
+
+The callbacks receive the profile as user data from the event loop. This
+keeps the notifications of standby profiles apart from the active one.
+*/
+void ToxProfilePrivate::setupCallbacks(Tox* tox)
+{
+    tox_callback_self_connection_status(tox, [](Tox* tox, TOX_CONNECTION status,
+                                        void* user_data)
     {
-        if (activeProfile) {
-            for (auto n : activeProfile->profileNotifiers) {
-                n->on_is_online_changed(status != TOX_CONNECTION_NONE);
-            }
+        ToxBootstrapper::instance().connectionChanged(tox, status);
+
+        ToxProfilePrivate* p = static_cast<ToxProfilePrivate*>(user_data);
+        p->mTEL->connectionChanged(status);
+        p->markDirty();
+        for (auto n : p->profileNotifiers) {
+            n->on_is_online_changed(status != TOX_CONNECTION_NONE);
         }
     });
 
-    tox_callback_friend_connection_status(mTEL->tox_,
-                                          [](Tox*, uint32_t c_index,
-                                          TOX_CONNECTION status, void*)
+    tox_callback_friend_connection_status(tox, [](Tox*, uint32_t c_index,
+                                          TOX_CONNECTION status,
+                                          void* user_data)
     {
-        if (activeProfile){
-            int index = static_cast<int>(c_index);
-            for (auto n : activeProfile->friendNotifiers) {
-                n->on_is_online_changed(index, status != TOX_CONNECTION_NONE);
-            }
+        ToxProfilePrivate* p = static_cast<ToxProfilePrivate*>(user_data);
+        p->mTEL->progress();
+        p->markDirty();
+        if (status != TOX_CONNECTION_NONE) {
+            ToxStartupTrace::instance().mark("friend_online");
+            ToxStartupTrace::instance().finishLater();
+        }
+
+        if (status == TOX_CONNECTION_NONE) {
+            p->mTransfers->friendOffline(c_index);
+        }
+
+        int index = static_cast<int>(c_index);
+        for (auto n : p->friendNotifiers) {
+            n->on_is_online_changed(index, status != TOX_CONNECTION_NONE);
         }
     });
 
-    tox_callback_friend_name(mTEL->tox_,
-                             [](Tox*, uint32_t c_index,
-                             const uint8_t* c_name, size_t c_len, void*)
+    tox_callback_friend_name(tox, [](Tox*, uint32_t c_index,
+                             const uint8_t* c_name, size_t c_len,
+                             void* user_data)
     {
-        if (activeProfile) {
-            int index = static_cast<int>(c_index);
-            const char* name = reinterpret_cast<const char*>(c_name);
-            int len = static_cast<int>(c_len);
-            QString nameStr = QString::fromUtf8(name, len);
-            for (auto n : activeProfile->friendNotifiers) {
-                n->on_name_changed(index, nameStr);
-            }
+        ToxProfilePrivate* p = static_cast<ToxProfilePrivate*>(user_data);
+        p->markDirty();
+        int index = static_cast<int>(c_index);
+        const char* name = reinterpret_cast<const char*>(c_name);
+        int len = static_cast<int>(c_len);
+        QString nameStr = QString::fromUtf8(name, len);
+        for (auto n : p->friendNotifiers) {
+            n->on_name_changed(index, nameStr);
         }
     });
 
-    tox_callback_friend_status_message(mTEL->tox_,
-                                       [](Tox*, uint32_t c_index,
+    tox_callback_friend_status_message(tox, [](Tox*, uint32_t c_index,
                                        const uint8_t* c_message, size_t c_len,
-                                       void*)
+                                       void* user_data)
     {
-        if (activeProfile) {
-            int index = static_cast<int>(c_index);
-            const char* message = reinterpret_cast<const char*>(c_message);
-            int len = static_cast<int>(c_len);
-            QString messageStr = QString::fromUtf8(message, len);
-            for (auto n : activeProfile->friendNotifiers) {
-                n->on_status_message_changed(index, messageStr);
-            }
+        ToxProfilePrivate* p = static_cast<ToxProfilePrivate*>(user_data);
+        p->markDirty();
+        int index = static_cast<int>(c_index);
+        const char* message = reinterpret_cast<const char*>(c_message);
+        int len = static_cast<int>(c_len);
+        QString messageStr = QString::fromUtf8(message, len);
+        for (auto n : p->friendNotifiers) {
+            n->on_status_message_changed(index, messageStr);
         }
     });
 
-    tox_callback_friend_status(mTEL->tox_,
-                               [](Tox*, uint32_t c_index,
-                               TOX_USER_STATUS status, void*)
+    tox_callback_friend_status(tox, [](Tox*, uint32_t c_index,
+                               TOX_USER_STATUS status, void* user_data)
     {
-        if (activeProfile) {
-            int index = static_cast<int>(c_index);
-            for (auto n : activeProfile->friendNotifiers) {
-                n->on_status_changed(index, static_cast<quint8>(status));
-            }
+        ToxProfilePrivate* p = static_cast<ToxProfilePrivate*>(user_data);
+        p->markDirty();
+        int index = static_cast<int>(c_index);
+        for (auto n : p->friendNotifiers) {
+            n->on_status_changed(index, static_cast<quint8>(status));
         }
     });
 
-    tox_callback_friend_message(mTEL->tox_, [](Tox*, uint32_t c_index,
+    tox_callback_friend_message(tox, [](Tox*, uint32_t c_index,
                                 TOX_MESSAGE_TYPE type, const uint8_t *c_message,
-                                size_t c_len, void *) {
+                                size_t c_len, void* user_data) {
         // TODO: handle message type
         Q_UNUSED(type);
 
         // TODO: manage message history
-        if (activeProfile) {
-            int index = static_cast<int>(c_index);
-            const char* message = reinterpret_cast<const char*>(c_message);
-            int len = static_cast<int>(c_len);
-            QString messageStr = QString::fromUtf8(message, len);
-            for (auto n : activeProfile->friendNotifiers) {
+        ToxProfilePrivate* p = static_cast<ToxProfilePrivate*>(user_data);
+        int index = static_cast<int>(c_index);
+        const char* message = reinterpret_cast<const char*>(c_message);
+        int len = static_cast<int>(c_len);
+        QString messageStr = QString::fromUtf8(message, len);
+        p->deliver([p, index, messageStr]() {
+            for (auto n : p->friendNotifiers) {
                 n->on_message(index, messageStr);
             }
+        });
+
+        if (p == activeProfile) {
+            ToxSounds::instance().play(ToxSounds::Notification);
         }
     });
+
+    tox_callback_file_chunk_request(tox, [](Tox* tox, uint32_t c_index,
+                                    uint32_t c_file, uint64_t position,
+                                    size_t length, void* user_data)
+    {
+        ToxProfilePrivate* p = static_cast<ToxProfilePrivate*>(user_data);
+        p->mTransfers->chunkRequest(tox, c_index, c_file, position, length);
+    });
+
+    tox_callback_file_recv_control(tox, [](Tox*, uint32_t c_index,
+                                   uint32_t c_file, TOX_FILE_CONTROL control,
+                                   void* user_data)
+    {
+        ToxProfilePrivate* p = static_cast<ToxProfilePrivate*>(user_data);
+        p->mTransfers->control(c_index, c_file, control);
+    });
+
+    tox_callback_file_recv(tox, [](Tox* tox, uint32_t c_index,
+                           uint32_t c_file, uint32_t kind, uint64_t size,
+                           const uint8_t* c_name, size_t c_len,
+                           void* user_data)
+    {
+        ToxProfilePrivate* p = static_cast<ToxProfilePrivate*>(user_data);
+        const char* name = reinterpret_cast<const char*>(c_name);
+        int len = static_cast<int>(c_len);
+        p->mTransfers->receive(tox, c_index, c_file, kind, size,
+                               QString::fromUtf8(name, len));
+    });
+
+    tox_callback_file_recv_chunk(tox, [](Tox* tox, uint32_t c_index,
+                                 uint32_t c_file, uint64_t position,
+                                 const uint8_t* data, size_t length,
+                                 void* user_data)
+    {
+        ToxProfilePrivate* p = static_cast<ToxProfilePrivate*>(user_data);
+        p->mTransfers->chunkReceived(tox, c_index, c_file, position, data,
+                                     length);
+    });
+
+    tox_callback_conference_invite(tox, [](Tox*, uint32_t c_index,
+                                   TOX_CONFERENCE_TYPE type,
+                                   const uint8_t* cookie, size_t length,
+                                   void* user_data)
+    {
+        ToxProfilePrivate* p = static_cast<ToxProfilePrivate*>(user_data);
+        p->mConferences->invited(c_index, type, cookie, length);
+    });
+
+    tox_callback_conference_message(tox, [](Tox* tox, uint32_t c_conference,
+                                    uint32_t c_peer, TOX_MESSAGE_TYPE type,
+                                    const uint8_t* c_message, size_t c_len,
+                                    void* user_data)
+    {
+        ToxProfilePrivate* p = static_cast<ToxProfilePrivate*>(user_data);
+        const char* message = reinterpret_cast<const char*>(c_message);
+        int len = static_cast<int>(c_len);
+        p->mConferences->message(tox, c_conference, c_peer,
+                                 QString::fromUtf8(message, len),
+                                 ToxerPrivate::fromTox(type));
+    });
+
+    tox_callback_conference_title(tox, [](Tox*, uint32_t c_conference,
+                                  uint32_t, const uint8_t* c_title,
+                                  size_t c_len, void* user_data)
+    {
+        ToxProfilePrivate* p = static_cast<ToxProfilePrivate*>(user_data);
+        p->markDirty();
+        const char* title = reinterpret_cast<const char*>(c_title);
+        int len = static_cast<int>(c_len);
+        p->mConferences->titleChanged(c_conference,
+                                      QString::fromUtf8(title, len));
+    });
+
+    tox_callback_conference_peer_name(tox, [](Tox* tox, uint32_t c_conference,
+                                      uint32_t c_peer, const uint8_t* c_name,
+                                      size_t c_len, void* user_data)
+    {
+        ToxProfilePrivate* p = static_cast<ToxProfilePrivate*>(user_data);
+        const char* name = reinterpret_cast<const char*>(c_name);
+        int len = static_cast<int>(c_len);
+        p->mConferences->peerNameChanged(tox, c_conference, c_peer,
+                                         QString::fromUtf8(name, len));
+    });
+
+    tox_callback_conference_peer_list_changed(tox, [](Tox*,
+                                              uint32_t c_conference,
+                                              void* user_data)
+    {
+        ToxProfilePrivate* p = static_cast<ToxProfilePrivate*>(user_data);
+        p->mConferences->peerListChanged(c_conference);
+    });
 }
 
+ToxProfilePrivate::ToxProfilePrivate(const QString& name, Tox* tox,
+                                     const ToxerPrivate::PassKeyPtr& key)
+    : mName(name)
+    , mTEL(new ToxEventLoop(tox, this))
+    , mKey(key)
+    , mCanary(key ? encrypt(QByteArrayLiteral("Toxer")) : QByteArray())
+    , mNodeCache(new ToxNodeCache(name, key))
+    , mSaver(new ToxProfileSaver(this, ToxerPrivate::profilePath(name)))
+    , mTransfers(new ToxTransfers(this))
+    , mConferences(new ToxConferences(this))
+    , mCalls(new ToxCalls(this))
+    , mReconfigurer(new ToxReconfigurer(this))
+    , mRevision(0)
+{
+    setupCallbacks(tox);
+    mConferences->reset(tox);
+    mCalls->attach(tox);
+
+    // bootstrap again as soon as the network changed
+    mNetworkWatch = QObject::connect(ToxNetworkMonitor::instance(),
+                                     &ToxNetworkMonitor::changed, [this]() {
+        mTEL->networkChanged();
+    });
+}
+
+/**
+@brief destructor
+
+The event loop is joined first, so no callback runs while the parts of the
+profile go away. The saver writes pending changes while Tox is still alive
+and ToxAV is released before Tox.
+*/
 ToxProfilePrivate::~ToxProfilePrivate() {
+    QObject::disconnect(mNetworkWatch);
     mTEL->stop();
 #if 0
     qInfo("Waiting on TEL");
 #endif
     mTEL->wait();
+    delete mReconfigurer;
+    delete mSaver;
+    delete mCalls;
     delete mTEL;
-    activeProfile = nullptr;
+    delete mTransfers;
+    delete mConferences;
+    delete mNodeCache;
+    if (activeProfile == this) {
+        activeProfile = nullptr;
+    }
 }
 
 void ToxProfilePrivate::start()
 {
     if (!mTEL->active_) {
-        mTEL->bootstrap();
         mTEL->start();
     }
 }
@@ -362,51 +856,433 @@ QVariant ToxProfilePrivate::toxQuery(ToxProfilePrivate::ToxFunc query_func) cons
 void ToxProfilePrivate::toxSet(ToxProfilePrivate::ToxSetFunc set_func) {
     QMutexLocker locker(&mTEL->mutex_);
     set_func(mTEL->tox_);
+    mTransfers->interactive();
+    mRevision++;
+    mSaver->markDirty();
+}
+
+/**
+@brief Sends messages or invites with the Tox instance locked.
+@param[in] send_func    the function to call
+
+Unlike toxSet(), the state to save does not change, so the profile is
+neither marked dirty nor does its revision change. A pending reconfiguration
+is not invalidated by chat traffic.
+*/
+void ToxProfilePrivate::toxSend(ToxProfilePrivate::ToxSetFunc send_func)
+{
+    QMutexLocker locker(&mTEL->mutex_);
+    send_func(mTEL->tox_);
+    mTransfers->interactive();
+}
+
+/**
+@brief Serializes the current Tox state.
+@return the unencrypted savedata
+*/
+QByteArray ToxProfilePrivate::savedata() const
+{
+    return toxQuery([](const Tox* tox) -> QVariant {
+        QByteArray out(static_cast<int>(tox_get_savedata_size(tox)), 0);
+        tox_get_savedata(tox, reinterpret_cast<uint8_t*>(out.data()));
+        return out;
+    }).toByteArray();
+}
+
+/**
+@brief Serializes the current Tox state into secure memory.
+@param[out] revision    the revision of the profile state
+@return the unencrypted savedata
+*/
+SecureBuffer ToxProfilePrivate::secureSavedata(quint64* revision) const
+{
+    QMutexLocker locker(&mTEL->mutex_);
+    SecureBuffer out(tox_get_savedata_size(mTEL->tox_));
+    if (!out.isNull()) {
+        tox_get_savedata(mTEL->tox_, out.data());
+    }
+
+    *revision = mRevision;
+    return out;
+}
+
+/**
+@brief Swaps in a Tox instance created with changed options.
+@param[in] tox          the new Tox instance
+@param[in] revision     the profile revision the instance was created from
+@see ToxReconfigurer
+
+This function is thread-safe. The profile takes ownership of the instance.
+*/
+void ToxProfilePrivate::replaceTox(Tox* tox, quint64 revision)
+{
+    setupCallbacks(tox);
+    mTEL->replace(tox, revision);
+}
+
+/**
+@brief Offers a file to a friend.
+@param[in] friendIndex  the friend number
+@param[in] fileName     the absolute path of the file
+@return the file number of the transfer; UINT32_MAX on failure
+@see ToxTransfers
+*/
+quint32 ToxProfilePrivate::sendFile(int friendIndex, const QString& fileName)
+{
+    QMutexLocker locker(&mTEL->mutex_);
+    return mTransfers->send(mTEL->tox_, static_cast<quint32>(friendIndex),
+                            fileName);
+}
+
+/**
+@brief Sets the rate limits of the outgoing file transfers.
+@param[in] total        the limit of all transfers in bytes per second
+@param[in] perFriend    the limit per friend in bytes per second
+@see ToxTransfers::setRateLimits
+*/
+void ToxProfilePrivate::setRateLimits(quint64 total, quint64 perFriend)
+{
+    mTransfers->setRateLimits(total, perFriend);
+}
+
+/**
+@brief Returns the number of queued file chunks.
+@param[in] friendIndex  the friend number; -1 for all friends
+*/
+int ToxProfilePrivate::transferQueueDepth(int friendIndex) const
+{
+    return friendIndex < 0
+            ? mTransfers->queueDepth()
+            : mTransfers->queueDepth(static_cast<quint32>(friendIndex));
+}
+
+/**
+@brief Accepts a file offered by a friend.
+@param[in] friendIndex  the friend number
+@param[in] fileIndex    the file number
+@param[in] fileName     the absolute path to store the file at
+@return true, if the transfer started
+*/
+bool ToxProfilePrivate::acceptFile(int friendIndex, quint32 fileIndex,
+                                   const QString& fileName)
+{
+    QMutexLocker locker(&mTEL->mutex_);
+    return mTransfers->accept(mTEL->tox_, static_cast<quint32>(friendIndex),
+                              fileIndex, fileName);
+}
+
+/**
+@brief Cancels a file transfer.
+@param[in] friendIndex  the friend number
+@param[in] fileIndex    the file number
+*/
+void ToxProfilePrivate::cancelTransfer(int friendIndex, quint32 fileIndex)
+{
+    QMutexLocker locker(&mTEL->mutex_);
+    mTransfers->cancel(mTEL->tox_, static_cast<quint32>(friendIndex),
+                       fileIndex);
+}
+
+/**
+@brief Creates a new text conference.
+@return the conference number; -1 on failure
+*/
+int ToxProfilePrivate::createConference()
+{
+    int index = -1;
+    toxSet([this, &index](Tox* tox) {
+        const uint32_t c_index = tox_conference_new(tox, nullptr);
+        if (c_index != UINT32_MAX) {
+            mConferences->added(c_index);
+            index = static_cast<int>(c_index);
+        }
+    });
+    return index;
+}
+
+/**
+@brief Joins the conference a friend invited to.
+@param[in] friendIndex  the friend number
+@param[in] cookie       the invite cookie
+@return the conference number; -1 on failure
+*/
+int ToxProfilePrivate::joinConference(int friendIndex,
+                                      const QByteArray& cookie)
+{
+    int index = -1;
+    toxSet([this, friendIndex, &cookie, &index](Tox* tox) {
+        const uint32_t c_index = tox_conference_join(
+                    tox, static_cast<uint32_t>(friendIndex),
+                    reinterpret_cast<const uint8_t*>(cookie.constData()),
+                    static_cast<size_t>(cookie.size()), nullptr);
+        if (c_index != UINT32_MAX) {
+            mConferences->added(c_index);
+            index = static_cast<int>(c_index);
+        }
+    });
+    return index;
+}
+
+/**
+@brief Leaves a conference.
+@param[in] index    the conference number
+@return true, if the conference was left
+*/
+bool ToxProfilePrivate::leaveConference(int index)
+{
+    bool ok = false;
+    toxSet([this, index, &ok](Tox* tox) {
+        const uint32_t c_index = static_cast<uint32_t>(index);
+        ok = tox_conference_delete(tox, c_index, nullptr);
+        if (ok) {
+            mConferences->removed(c_index);
+        }
+    });
+    return ok;
+}
+
+/**
+@brief Returns the number of peers of a conference.
+@param[in] index    the conference number
+@see ToxConferences
+*/
+int ToxProfilePrivate::conferencePeerCount(int index) const
+{
+    return mConferences->peerCount(static_cast<quint32>(index));
+}
+
+/**
+@brief Returns the peers of a conference.
+@param[in] index    the conference number
+@return the public keys and names of the peers
+@see ToxConferences
+*/
+QVector<QPair<QByteArray, QString>> ToxProfilePrivate::conferencePeers(
+        int index) const
+{
+    return mConferences->peers(static_cast<quint32>(index));
+}
+
+/**
+@brief Starts an audio call with a friend.
+@param[in] friendIndex  the friend number
+@return true, if the call was placed
+@see ToxCalls
+*/
+bool ToxProfilePrivate::startCall(int friendIndex)
+{
+    QMutexLocker locker(&mTEL->mutex_);
+    return mCalls->call(static_cast<quint32>(friendIndex));
+}
+
+/**
+@brief Answers the call of a friend.
+@param[in] friendIndex  the friend number
+@return true, if the call was answered
+*/
+bool ToxProfilePrivate::answerCall(int friendIndex)
+{
+    QMutexLocker locker(&mTEL->mutex_);
+    return mCalls->answer(static_cast<quint32>(friendIndex));
+}
+
+/**
+@brief Ends or rejects the call of a friend.
+@param[in] friendIndex  the friend number
+*/
+void ToxProfilePrivate::endCall(int friendIndex)
+{
+    QMutexLocker locker(&mTEL->mutex_);
+    mCalls->hangup(static_cast<quint32>(friendIndex));
+}
+
+/**
+@brief Mutes the audio input of calls.
+@param[in] muted    true to send no audio
+*/
+void ToxProfilePrivate::setCallMuted(bool muted)
+{
+    mCalls->setMuted(muted);
+}
+
+/**
+@brief Encrypts data with the profile key.
+@param[in] data     the plain data
+@return the encrypted data; the unchanged data for unencrypted profiles
+
+Use this for any data belonging to the profile (e.g. history or files). The
+key is derived once at activation, so the call does not run the expensive
+key derivation.
+*/
+QByteArray ToxProfilePrivate::encrypt(const QByteArray& data) const
+{
+    return mKey ? ToxerPrivate::encrypt(data.constData(), data.length(), mKey)
+                : data;
+}
+
+/**
+@brief Encrypts secure data with the profile key.
+@param[in] data     the plain data
+@return the encrypted data; a copy of the data for unencrypted profiles
+
+Unlike the QByteArray overload, the plain data is never copied into
+ordinary memory for encrypted profiles.
+*/
+QByteArray ToxProfilePrivate::encrypt(const SecureBuffer& data) const
+{
+    const char* raw = reinterpret_cast<const char*>(data.constData());
+    const int len = static_cast<int>(data.size());
+    return mKey ? ToxerPrivate::encrypt(raw, len, mKey)
+                : QByteArray(raw, len);
+}
+
+/**
+@brief Decrypts data with the profile key.
+@param[in] data     the encrypted data
+@return the decrypted data or an empty array on failure
+@see ToxProfilePrivate::encrypt
+*/
+QByteArray ToxProfilePrivate::decrypt(const QByteArray& data) const
+{
+    if (!ToxerPrivate::isEncrypted(data.constData())) {
+        return data;
+    }
+
+    return mKey ? ToxerPrivate::decrypt(data.constData(), data.length(), mKey)
+                : QByteArray();
+}
+
+/**
+@brief Schedules the profile to be written back to disk.
+
+Thread-safe; repeated calls within the save delay result in a single write.
+*/
+void ToxProfilePrivate::markDirty()
+{
+    mSaver->markDirty();
+}
+
+/**
+@brief Dispatches an event that must not get lost in standby.
+@param[in] event    calls the observers
+@note Call this on the event loop thread or with the event loop mutex locked.
+
+Messages, invites and file offers arrive while a profile is in standby and
+has no observers. They are kept until the profile is active again. When
+more than MaxBacklog events pile up, the oldest are dropped.
+*/
+void ToxProfilePrivate::deliver(const std::function<void ()>& event)
+{
+    if (!mTEL->isStandby()) {
+        event();
+        return;
+    }
+
+    if (mBacklog.count() >= MaxBacklog) {
+        qWarning("Standby backlog of %s is full; dropping the oldest event.",
+                 qUtf8Printable(mName));
+        mBacklog.removeFirst();
+    }
+    mBacklog << event;
+}
+
+/**
+@brief Dispatches the events kept during standby.
+@note The event loop mutex must be locked.
+*/
+void ToxProfilePrivate::replayBacklog()
+{
+    if (mBacklog.isEmpty()) {
+        return;
+    }
+
+    QVector<std::function<void ()>> backlog;
+    backlog.swap(mBacklog);
+    for (const auto& event : backlog) {
+        event();
+    }
 }
 
 void ToxProfilePrivate::addNotificationObserver(IToxFriendNotifier* notify)
 {
+    QMutexLocker locker(&mTEL->mutex_);
     friendNotifiers << notify;
 }
 
 void ToxProfilePrivate::removeNotificationObserver(IToxFriendNotifier* notify)
 {
+    QMutexLocker locker(&mTEL->mutex_);
     friendNotifiers.removeAll(notify);
 }
 
 void ToxProfilePrivate::addNotificationObserver(IToxProfileNotifier* notify)
 {
+    QMutexLocker locker(&mTEL->mutex_);
     profileNotifiers << notify;
 }
 
 void ToxProfilePrivate::removeNotificationObserver(IToxProfileNotifier* notify)
 {
+    QMutexLocker locker(&mTEL->mutex_);
     profileNotifiers.removeAll(notify);
 }
 
+void ToxProfilePrivate::addNotificationObserver(IToxTransferNotifier* notify)
+{
+    QMutexLocker locker(&mTEL->mutex_);
+    transferNotifiers << notify;
+}
+
+void ToxProfilePrivate::removeNotificationObserver(
+        IToxTransferNotifier* notify)
+{
+    QMutexLocker locker(&mTEL->mutex_);
+    transferNotifiers.removeAll(notify);
+}
+
+void ToxProfilePrivate::addNotificationObserver(
+        IToxConferenceNotifier* notify)
+{
+    QMutexLocker locker(&mTEL->mutex_);
+    conferenceNotifiers << notify;
+}
+
+void ToxProfilePrivate::removeNotificationObserver(
+        IToxConferenceNotifier* notify)
+{
+    QMutexLocker locker(&mTEL->mutex_);
+    conferenceNotifiers.removeAll(notify);
+}
+
+void ToxProfilePrivate::addNotificationObserver(IToxCallNotifier* notify)
+{
+    QMutexLocker locker(&mTEL->mutex_);
+    callNotifiers << notify;
+}
+
+void ToxProfilePrivate::removeNotificationObserver(IToxCallNotifier* notify)
+{
+    QMutexLocker locker(&mTEL->mutex_);
+    callNotifiers.removeAll(notify);
+}
+
 void ToxProfilePrivate::on_status_changed(int status)
 {
-    if (activeProfile) {
-        for (auto n : activeProfile->profileNotifiers) {
-            n->on_status_changed(status != TOX_CONNECTION_NONE);
-        }
+    for (auto n : profileNotifiers) {
+        n->on_status_changed(status != TOX_CONNECTION_NONE);
     }
 }
 
 void ToxProfilePrivate::on_status_message_changed(const QString& message)
 {
-    if (activeProfile) {
-        for (auto n : activeProfile->profileNotifiers) {
-            n->on_status_message_changed(message);
-        }
+    for (auto n : profileNotifiers) {
+        n->on_status_message_changed(message);
     }
 }
 
 void ToxProfilePrivate::on_user_name_changed(const QString& userName)
 {
-    if (activeProfile) {
-        for (auto n : activeProfile->profileNotifiers) {
-            n->on_user_name_changed(userName);
-        }
+    for (auto n : profileNotifiers) {
+        n->on_user_name_changed(userName);
     }
 }
@@ -29,7 +29,10 @@
 
 #include "ToxerPrivate.h"
 
+#include <QAtomicInt>
+#include <QElapsedTimer>
 #include <QMutex>
+#include <QPair>
 #include <QThread>
 #include <QVector>
 
@@ -37,8 +40,17 @@
 #include <functional>
 #endif
 
+class IToxCallNotifier;
+class IToxConferenceNotifier;
 class IToxFriendNotifier;
 class IToxProfileNotifier;
+class IToxTransferNotifier;
+class ToxCalls;
+class ToxConferences;
+class ToxNodeCache;
+class ToxProfileSaver;
+class ToxReconfigurer;
+class ToxTransfers;
 
 /**
 @class ToxProfile::Private
@@ -46,17 +58,23 @@ class IToxProfileNotifier;
 */
 class ToxProfilePrivate final
 {
+    friend class ToxCalls;
+    friend class ToxConferences;
+    friend class ToxTransfers;
+
     class ToxEventLoop final : public QThread
     {
         friend class ToxProfilePrivate;
 
     public:
-        ToxEventLoop(Tox* _tox);
-#if 0
-        inline ~ToxEventLoop() override { qInfo("TEL destroyed"); }
-#endif
+        static constexpr unsigned long StandbyInterval = 1000;
+        static constexpr qint64 StallTimeout = 30 * 1000;
+        static constexpr int StallRelays = 16;
+
+    public:
+        ToxEventLoop(Tox* _tox, ToxProfilePrivate* profile);
+        ~ToxEventLoop() override;
 
-        void bootstrap();
         inline void stop() {
             Q_ASSERT(QThread::currentThread() != this);
             QMutexLocker lock(&mutex_);
@@ -64,34 +82,77 @@ class ToxProfilePrivate final
             quit(); // we don't actually use an event loop!
         }
 
+        inline void setStandby(bool standby) {
+            standby_.store(standby ? 1 : 0);
+        }
+
+        inline bool isStandby() const {
+            return standby_.load() != 0;
+        }
+
+        inline void networkChanged() {
+            networkChanged_.store(1);
+        }
+
+        void replace(Tox* tox, quint64 revision);
+
     private:
         void run() final;
+        void connectionChanged(TOX_CONNECTION status);
+        void progress();
+        void watchdog(QMutexLocker& locker);
+        void recreate(QMutexLocker& locker);
+        void adoptPending();
+        void swap(Tox* tox);
 
     private:
         mutable QMutex mutex_;
         Tox* tox_;
+        Tox* pending_;
+        quint64 pendingRevision_;
+        ToxProfilePrivate* profile_;
         bool active_;
+        QAtomicInt standby_;
+        QAtomicInt networkChanged_;
+        QElapsedTimer recovery_;
+        QElapsedTimer lastProgress_;
+        int stallStage_;
     };
 
+public:
+    static constexpr int MaxBacklog = 1024;
+
 public:
     inline static ToxProfilePrivate* current() {
         return activeProfile;
     }
 
     static void create(const QString& name, const QString& password);
-    static QByteArray load(const QString& name, const QString& password);
-    static void activate(const QString& profileName,
-                         const QString& password);
+    static void activate(const QString& profileName, Tox* tox,
+                         const ToxerPrivate::PassKeyPtr& key);
+    static ToxProfilePrivate* standby(const QString& profileName);
+    static bool resume(const QString& profileName);
+    static void close();
+    static void closeAll();
+
+    static Tox* createTox(const uint8_t* profileData, size_t len);
+    static void bootstrap(Tox* tox, const ToxNodeCache& cache);
 
 private:
-    static Tox* createTox(const QByteArray& profileData);
+    static void makeActive(ToxProfilePrivate* profile);
+    static void park(ToxProfilePrivate* profile);
+    static void setupCallbacks(Tox* tox);
+
+    void deliver(const std::function<void ()>& event);
+    void replayBacklog();
 
 public:
     using ToxFunc = std::function<QVariant (const Tox*)>;
     using ToxSetFunc = std::function<void (Tox*)>;
 
 public:
-    ToxProfilePrivate(const QString& _name, const QByteArray& profileData);
+    ToxProfilePrivate(const QString& _name, Tox* tox,
+                      const ToxerPrivate::PassKeyPtr& key);
     ~ToxProfilePrivate();
 
     inline const QString name() const {
@@ -102,6 +163,47 @@ public:
 
     QVariant toxQuery(ToxFunc query_func) const;
     void toxSet(ToxSetFunc set_func);
+    void toxSend(ToxSetFunc send_func);
+
+    inline const ToxerPrivate::PassKeyPtr& passKey() const {
+        return mKey;
+    }
+
+    inline const QByteArray& canary() const {
+        return mCanary;
+    }
+
+    QByteArray encrypt(const QByteArray& data) const;
+    QByteArray encrypt(const SecureBuffer& data) const;
+    QByteArray decrypt(const QByteArray& data) const;
+
+    QByteArray savedata() const;
+    SecureBuffer secureSavedata(quint64* revision) const;
+    void markDirty();
+
+    inline ToxNodeCache& nodeCache() const {
+        return *mNodeCache;
+    }
+
+    void replaceTox(Tox* tox, quint64 revision);
+
+    void setRateLimits(quint64 total, quint64 perFriend);
+    int transferQueueDepth(int friendIndex) const;
+    quint32 sendFile(int friendIndex, const QString& fileName);
+    bool acceptFile(int friendIndex, quint32 fileIndex,
+                    const QString& fileName);
+    void cancelTransfer(int friendIndex, quint32 fileIndex);
+
+    int createConference();
+    int joinConference(int friendIndex, const QByteArray& cookie);
+    bool leaveConference(int index);
+    int conferencePeerCount(int index) const;
+    QVector<QPair<QByteArray, QString>> conferencePeers(int index) const;
+
+    bool startCall(int friendIndex);
+    bool answerCall(int friendIndex);
+    void endCall(int friendIndex);
+    void setCallMuted(bool muted);
 
     void addNotificationObserver(IToxFriendNotifier* notify);
     void removeNotificationObserver(IToxFriendNotifier* notify);
@@ -109,6 +211,15 @@ public:
     void addNotificationObserver(IToxProfileNotifier* notify);
     void removeNotificationObserver(IToxProfileNotifier* notify);
 
+    void addNotificationObserver(IToxTransferNotifier* notify);
+    void removeNotificationObserver(IToxTransferNotifier* notify);
+
+    void addNotificationObserver(IToxConferenceNotifier* notify);
+    void removeNotificationObserver(IToxConferenceNotifier* notify);
+
+    void addNotificationObserver(IToxCallNotifier* notify);
+    void removeNotificationObserver(IToxCallNotifier* notify);
+
 public:
     // profile notifiers
     void on_status_changed(int status);
@@ -118,12 +229,27 @@ public:
 private:
     QString mName;
     ToxEventLoop* mTEL;
+    const ToxerPrivate::PassKeyPtr mKey;
+    const QByteArray mCanary;
+    ToxNodeCache* mNodeCache;
+    ToxProfileSaver* mSaver;
+    ToxTransfers* mTransfers;
+    ToxConferences* mConferences;
+    ToxCalls* mCalls;
+    ToxReconfigurer* mReconfigurer;
+    quint64 mRevision;
+    QMetaObject::Connection mNetworkWatch;
+    QVector<std::function<void ()>> mBacklog;
 
     QVector<IToxProfileNotifier*> profileNotifiers;
     QVector<IToxFriendNotifier*> friendNotifiers;
+    QVector<IToxTransferNotifier*> transferNotifiers;
+    QVector<IToxConferenceNotifier*> conferenceNotifiers;
+    QVector<IToxCallNotifier*> callNotifiers;
 
 private:
     static ToxProfilePrivate* activeProfile;
+    static QVector<ToxProfilePrivate*> standbyProfiles;
 };
 
 #endif
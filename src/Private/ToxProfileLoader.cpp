@@ -0,0 +1,332 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "ToxProfileLoader.h"
+
+#include "SecureBuffer.h"
+#include "ToxBootstrap.h"
+#include "ToxNodeCache.h"
+#include "ToxProfile.h"
+#include "ToxStartupTrace.h"
+
+#include <QFile>
+#include <QRunnable>
+#include <QThreadPool>
+
+/**
+@class ToxProfileLoader
+@brief Activates a Tox profile in the background.
+
+The expensive parts of a profile activation run as a staged job on the
+global thread pool. The profile file is memory mapped and decrypted straight
+into a SecureBuffer, which is passed to Tox and wiped right after Tox parsed
+it. This way the secret state exists in memory once.
+
+Each stage reports a progress signal and the job can be cancelled between
+stages. When the job succeeds, the profile is activated on the thread that
+owns the loader.
+
+If the profile is kept in standby, the job only verifies the password
+against the canary of the profile and the standby profile is resumed. This
+skips reading the file, creating Tox and bootstrapping.
+
+A loader is single-use and deletes itself once the job has finished. After
+cancel() no more signals are emitted.
+
+
+@var ToxProfileLoader::StageCount
+@brief The number of stages of ToxTypes::ActivationStage.
+
+
+@fn ToxProfileLoader::progress
+@brief Emitted when the job enters a stage.
+@param[in] stage        the ToxTypes::ActivationStage value
+@param[in] stageCount   the total number of stages
+
+
+@fn ToxProfileLoader::activated
+@brief Emitted after the loaded profile became the active profile.
+
+
+@fn ToxProfileLoader::failed
+@brief Emitted when the profile could not be loaded.
+@param[in] reason   a readable message
+*/
+
+struct ToxProfileLoader::State
+{
+    QAtomicInt cancelled;
+    bool resume = false;
+    Tox* tox = nullptr;
+    ToxerPrivate::PassKeyPtr key;
+    const char* error = nullptr;
+};
+
+class ToxProfileLoader::Job final : public QRunnable
+{
+    using Stage = ToxTypes::ActivationStage;
+
+public:
+    Job(QObject* loader, const QString& name, const QString& password,
+        const QByteArray& canary,
+        const std::shared_ptr<ToxProfileLoader::State>& state)
+        : loader_(loader)
+        , name_(name)
+        , password_(password.constData(), password.size())
+        , canary_(canary)
+        , state_(state)
+    {
+    }
+
+    void run() final
+    {
+        if (state_->resume) {
+            verify();
+        } else {
+            load();
+        }
+    }
+
+private:
+    void verify()
+    {
+        if (!enter(Stage::DeriveKey)) {
+            return;
+        }
+        const ToxerPrivate::PassKeyPtr key =
+                ToxerPrivate::createKey(password_, canary_.constData());
+        wipePassword();
+
+        if (!enter(Stage::Decrypt)) {
+            return;
+        }
+        const bool ok = !ToxerPrivate::decrypt(canary_.constData(),
+                                               canary_.length(),
+                                               key).isEmpty();
+        finish(ok ? nullptr : "Wrong password.");
+    }
+
+    void load()
+    {
+        ToxStartupTrace& trace = ToxStartupTrace::instance();
+
+        enter(Stage::Read);
+        trace.begin("read");
+        QFile f(ToxerPrivate::profilePath(name_));
+        const qint64 size = f.size();
+        uchar* data = f.open(QFile::ReadOnly) && size > 0 ? f.map(0, size)
+                                                          : nullptr;
+        trace.end("read");
+        if (!data) {
+            finish("Tox profile not found.");
+            return;
+        }
+
+        const size_t c_size = static_cast<size_t>(size);
+        const bool encrypted =
+                c_size >= TOX_PASS_ENCRYPTION_EXTRA_LENGTH &&
+                ToxerPrivate::isEncrypted(reinterpret_cast<const char*>(data));
+
+        SecureBuffer decrypted;
+        if (encrypted) {
+            if (!enter(Stage::DeriveKey)) {
+                return;
+            }
+            trace.begin("kdf");
+            state_->key = ToxerPrivate::createKey(
+                              password_, reinterpret_cast<const char*>(data));
+            wipePassword();
+            trace.end("kdf");
+
+            if (!enter(Stage::Decrypt)) {
+                return;
+            }
+            trace.begin("decrypt");
+            decrypted = ToxerPrivate::decryptSecure(data, c_size, state_->key);
+            trace.end("decrypt");
+            if (decrypted.isNull()) {
+                finish("Wrong password.");
+                return;
+            }
+        }
+
+        if (!enter(Stage::CreateTox)) {
+            return;
+        }
+        trace.begin("tox_new");
+        state_->tox = encrypted
+                ? ToxProfilePrivate::createTox(decrypted.constData(),
+                                               decrypted.size())
+                : ToxProfilePrivate::createTox(data, c_size);
+        trace.end("tox_new");
+        decrypted.clear();
+        f.unmap(data);
+        if (!state_->tox) {
+            finish("Creation of Tox instance failed.");
+            return;
+        }
+
+        if (!enter(Stage::Bootstrap)) {
+            return;
+        }
+        trace.begin("bootstrap");
+        ToxProfilePrivate::bootstrap(state_->tox,
+                                     ToxNodeCache(name_, state_->key));
+        trace.end("bootstrap");
+
+        finish();
+    }
+
+    bool enter(Stage stage)
+    {
+        if (state_->cancelled.load()) {
+            finish();
+            return false;
+        }
+
+        QMetaObject::invokeMethod(loader_, "reportStage",
+                                  Qt::QueuedConnection,
+                                  Q_ARG(int, static_cast<int>(stage)));
+        return true;
+    }
+
+    void wipePassword()
+    {
+        // the password is a deep copy, so this overwrites the only copy
+        password_.fill(QChar());
+        password_.clear();
+    }
+
+    void finish(const char* error = nullptr)
+    {
+        wipePassword();
+        state_->error = error;
+        QMetaObject::invokeMethod(loader_, "complete", Qt::QueuedConnection);
+    }
+
+private:
+    QObject* loader_;
+    const QString name_;
+    QString password_;
+    const QByteArray canary_;
+    const std::shared_ptr<ToxProfileLoader::State> state_;
+};
+
+/**
+@brief constructor
+@param[in] profileName  the name of the profile to activate
+*/
+ToxProfileLoader::ToxProfileLoader(const QString& profileName)
+    : QObject()
+    , name_(profileName)
+    , state_(std::make_shared<State>())
+{
+}
+
+/**
+@brief destructor
+
+Releases a Tox instance that was created, but never activated.
+*/
+ToxProfileLoader::~ToxProfileLoader()
+{
+    if (state_->tox) {
+        ToxBootstrapper::instance().release(state_->tox);
+        tox_kill(state_->tox);
+    }
+}
+
+/**
+@brief Starts the activation job.
+@param[in] password     the profile password
+
+The loader must stay alive until the job has finished. This is guaranteed as
+long as the loader is not deleted explicitly.
+*/
+void ToxProfileLoader::start(const QString& password)
+{
+    ToxStartupTrace::instance().begin("activation");
+
+    QByteArray canary;
+    const ToxProfilePrivate* standby = ToxProfilePrivate::standby(name_);
+    if (standby) {
+        state_->resume = true;
+        canary = standby->canary();
+        if (canary.isEmpty()) {
+            QMetaObject::invokeMethod(this, "complete", Qt::QueuedConnection);
+            return;
+        }
+    }
+
+    QThreadPool::globalInstance()->start(
+                new Job(this, name_, password, canary, state_));
+}
+
+/**
+@brief Cancels the activation job.
+
+The job stops before its next stage and the loader cleans up after itself.
+*/
+void ToxProfileLoader::cancel()
+{
+    state_->cancelled.store(1);
+}
+
+/**
+@brief Forwards the stage of the job as progress signal.
+*/
+void ToxProfileLoader::reportStage(int stage)
+{
+    if (!state_->cancelled.load()) {
+        emit progress(static_cast<quint8>(stage), StageCount);
+    }
+}
+
+/**
+@brief Activates the profile after the job has finished.
+*/
+void ToxProfileLoader::complete()
+{
+    if (!state_->cancelled.load()) {
+        if (state_->resume && !state_->error) {
+            if (ToxProfilePrivate::resume(name_)) {
+                emit activated();
+            } else {
+                emit failed(QStringLiteral("Tox profile was closed."));
+            }
+        } else if (state_->tox) {
+            ToxProfilePrivate::activate(name_, state_->tox, state_->key);
+            state_->tox = nullptr;
+            ToxStartupTrace::instance().end("activation");
+            emit activated();
+        } else {
+            qWarning("Tox profile not activated: %s", state_->error);
+            emit failed(QString::fromUtf8(state_->error));
+        }
+    }
+
+    deleteLater();
+}
@@ -0,0 +1,69 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef TOXER_PRIVATE_TOXPROFILELOADER_H
+#define TOXER_PRIVATE_TOXPROFILELOADER_H
+
+#include <QObject>
+
+#include <memory>
+
+class ToxProfileLoader final : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr quint8 StageCount = 5;
+
+public:
+    ToxProfileLoader(const QString& profileName);
+    ~ToxProfileLoader() override;
+
+    inline const QString& profileName() const {
+        return name_;
+    }
+
+    void start(const QString& password);
+    void cancel();
+
+signals:
+    void progress(quint8 stage, quint8 stageCount);
+    void activated();
+    void failed(const QString& reason);
+
+private slots:
+    void reportStage(int stage);
+    void complete();
+
+private:
+    class Job;
+    struct State;
+
+    const QString name_;
+    std::shared_ptr<State> state_;
+};
+
+#endif
@@ -0,0 +1,177 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "ToxReconfigurer.h"
+
+#include "ToxBootstrap.h"
+#include "ToxMetrics.h"
+#include "ToxProfile.h"
+
+#include <QRunnable>
+
+/**
+@class ToxReconfigurer
+@brief Applies changed network settings to a running profile.
+
+Tox reads its network options only when the instance is created. When the
+proxy, UDP or IPv6 settings change, the reconfigurer snapshots the savedata
+of the profile, creates and bootstraps a new Tox instance with the new
+options on a worker thread and hands it to the event loop of the profile.
+The event loop swaps the instances between two iterations. The profile, its
+observers and its state stay in place, so the change costs one reconnect.
+
+Changes made through the profile while the new instance was built would be
+lost by the swap. In that case the new instance is dropped and the rebuild
+starts over.
+
+Settings changes within ToxReconfigurer::SettleDelay milliseconds are
+applied at once.
+
+The transfer rate limits do not need a new instance and are applied right
+away.
+
+
+@var ToxReconfigurer::SettleDelay
+@brief The time in milliseconds to collect settings changes.
+*/
+
+constexpr int ToxReconfigurer::SettleDelay;
+
+namespace {
+
+class RebuildJob final : public QRunnable
+{
+public:
+    RebuildJob(ToxProfilePrivate* profile, SecureBuffer&& savedata,
+               quint64 revision)
+        : profile_(profile)
+        , savedata_(std::move(savedata))
+        , revision_(revision)
+    {
+    }
+
+    void run() final
+    {
+        Tox* tox = ToxProfilePrivate::createTox(savedata_.constData(),
+                                                savedata_.size());
+        savedata_.clear();
+        if (!tox) {
+            qWarning("Tox profile not reconfigured.");
+            return;
+        }
+
+        ToxProfilePrivate::bootstrap(tox, profile_->nodeCache());
+        ToxMetrics::instance().increment("network.reconfigure");
+        profile_->replaceTox(tox, revision_);
+    }
+
+private:
+    ToxProfilePrivate* profile_;
+    SecureBuffer savedata_;
+    const quint64 revision_;
+};
+
+}
+
+/**
+@brief constructor
+@param[in] profile  the profile to reconfigure
+*/
+ToxReconfigurer::ToxReconfigurer(ToxProfilePrivate* profile)
+    : QObject()
+    , profile_(profile)
+{
+    timer_.setSingleShot(true);
+    timer_.setInterval(SettleDelay);
+    connect(&timer_, &QTimer::timeout, this, &ToxReconfigurer::rebuild);
+
+    pool_.setMaxThreadCount(1);
+
+    connect(&settings_, &ToxSettings::ipv6_enabled_changed,
+            this, &ToxReconfigurer::schedule);
+    connect(&settings_, &ToxSettings::udp_enabled_changed,
+            this, &ToxReconfigurer::schedule);
+    connect(&settings_, &ToxSettings::proxy_type_changed,
+            this, &ToxReconfigurer::schedule);
+    connect(&settings_, &ToxSettings::proxy_addr_changed,
+            this, &ToxReconfigurer::schedule);
+    connect(&settings_, &ToxSettings::proxy_port_changed,
+            this, &ToxReconfigurer::schedule);
+
+    connect(&settings_, &ToxSettings::transfer_rate_limit_changed,
+            this, &ToxReconfigurer::applyRateLimits);
+    connect(&settings_, &ToxSettings::friend_rate_limit_changed,
+            this, &ToxReconfigurer::applyRateLimits);
+    applyRateLimits();
+}
+
+/**
+@brief destructor
+
+Waits for a running rebuild to finish. The profile deletes the reconfigurer
+only after its event loop is joined, so a replacement handed over by a late
+rebuild is released together with the event loop.
+*/
+ToxReconfigurer::~ToxReconfigurer()
+{
+    timer_.stop();
+    pool_.waitForDone();
+}
+
+/**
+@brief Starts or restarts the settle timer.
+*/
+void ToxReconfigurer::schedule()
+{
+    timer_.start();
+}
+
+/**
+@brief Starts building a new Tox instance from a savedata snapshot.
+*/
+void ToxReconfigurer::rebuild()
+{
+    if (pool_.activeThreadCount() > 0) {
+        // retry when the running rebuild is done
+        timer_.start();
+        return;
+    }
+
+    quint64 revision = 0;
+    SecureBuffer savedata = profile_->secureSavedata(&revision);
+    if (!savedata.isNull()) {
+        pool_.start(new RebuildJob(profile_, std::move(savedata), revision));
+    }
+}
+
+/**
+@brief Passes the rate limits to the transfers of the profile.
+*/
+void ToxReconfigurer::applyRateLimits()
+{
+    profile_->setRateLimits(settings_.transfer_rate_limit() * 1024ull,
+                            settings_.friend_rate_limit() * 1024ull);
+}
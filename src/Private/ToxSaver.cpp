@@ -0,0 +1,200 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "ToxSaver.h"
+
+#include "ToxNodeCache.h"
+#include "ToxProfile.h"
+
+#include <QSaveFile>
+
+#include <unistd.h>
+
+/**
+@class ToxProfileSaver
+@brief Writes the Tox savedata of a profile back to its file.
+
+Every mutation marks the profile dirty. The first mark opens a coalescing
+window of ToxProfileSaver::SaveDelay milliseconds, after which a single save
+is issued no matter how many changes happened meanwhile. On a worker thread
+the savedata is serialized into secure memory, encrypted from there and
+replaces the profile file atomically. The nodes listed in the savedata are
+recorded in the ToxNodeCache on the way.
+
+
+@var ToxProfileSaver::SaveDelay
+@brief The coalescing window in milliseconds.
+*/
+
+namespace {
+
+class SaveJob final : public QRunnable
+{
+public:
+    SaveJob(const ToxProfilePrivate* profile, const QString& fileName)
+        : profile_(profile)
+        , fileName_(fileName)
+    {
+    }
+
+    void run() final
+    {
+        quint64 revision = 0;
+        const SecureBuffer data = profile_->secureSavedata(&revision);
+        if (data.isNull() || data.size() == 0) {
+            qWarning("Tox profile not saved: No savedata available.");
+            return;
+        }
+
+        profile_->nodeCache().record(data.constData(), data.size());
+
+        const QByteArray encrypted = profile_->encrypt(data);
+        if (!encrypted.isEmpty()) {
+            ToxProfileSaver::write(fileName_, encrypted);
+        }
+    }
+
+private:
+    const ToxProfilePrivate* profile_;
+    const QString fileName_;
+};
+
+}
+
+/**
+@brief constructor
+@param[in] profile      the profile to save
+@param[in] fileName     the absolute path to the profile file
+
+The savedata is encrypted with the key of the profile.
+*/
+ToxProfileSaver::ToxProfileSaver(const ToxProfilePrivate* profile,
+                                 const QString& fileName)
+    : QObject()
+    , profile_(profile)
+    , fileName_(fileName)
+    , dirty_(0)
+{
+    timer_.setSingleShot(true);
+    timer_.setInterval(SaveDelay);
+    connect(&timer_, &QTimer::timeout, this, &ToxProfileSaver::save);
+
+    pool_.setMaxThreadCount(1);
+}
+
+/**
+@brief destructor
+
+Pending changes are written before the saver goes away.
+*/
+ToxProfileSaver::~ToxProfileSaver()
+{
+    flush();
+}
+
+/**
+@brief Marks the profile as modified.
+
+This function is thread-safe and cheap to call from Tox callbacks.
+*/
+void ToxProfileSaver::markDirty()
+{
+    if (dirty_.testAndSetOrdered(0, 1)) {
+        QMetaObject::invokeMethod(this, "schedule", Qt::QueuedConnection);
+    }
+}
+
+/**
+@brief Synchronously writes pending changes.
+
+Waits for a running save to finish and writes any remaining changes on the
+calling thread. Use before the Tox instance is killed.
+*/
+void ToxProfileSaver::flush()
+{
+    timer_.stop();
+    pool_.waitForDone();
+
+    if (dirty_.testAndSetOrdered(1, 0)) {
+        SaveJob(profile_, fileName_).run();
+    }
+}
+
+/**
+@brief Atomically replaces a file with the given data.
+@param[in] fileName     the file to replace
+@param[in] data         the new file content
+@return true on success; false otherwise
+
+The data is written to a temporary file, synced to disk and renamed over the
+target. A crash at any time leaves either the old or the new file intact.
+*/
+bool ToxProfileSaver::write(const QString& fileName, const QByteArray& data)
+{
+    QSaveFile f(fileName);
+    if (!f.open(QIODevice::WriteOnly)) {
+        qWarning("Failed to save Tox profile %s.\nError message: %s",
+                 qUtf8Printable(fileName), qUtf8Printable(f.errorString()));
+        return false;
+    }
+
+    if (f.write(data) != data.length() || !f.flush() ||
+        ::fsync(f.handle()) != 0)
+    {
+        qWarning("Failed to write Tox profile %s.\nError message: %s",
+                 qUtf8Printable(fileName), qUtf8Printable(f.errorString()));
+        f.cancelWriting();
+        return false;
+    }
+
+    if (!f.commit()) {
+        qWarning("Failed to commit Tox profile %s.\nError message: %s",
+                 qUtf8Printable(fileName), qUtf8Printable(f.errorString()));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+@brief Opens the coalescing window unless a save is already scheduled.
+*/
+void ToxProfileSaver::schedule()
+{
+    if (!timer_.isActive()) {
+        timer_.start();
+    }
+}
+
+/**
+@brief Hands the pending changes to the save worker.
+*/
+void ToxProfileSaver::save()
+{
+    if (dirty_.testAndSetOrdered(1, 0)) {
+        pool_.start(new SaveJob(profile_, fileName_));
+    }
+}
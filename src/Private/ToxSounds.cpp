@@ -0,0 +1,377 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "ToxSounds.h"
+
+#include "Settings.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QThread>
+
+#include <cstring>
+
+namespace {
+
+const char* const soundFiles[ToxSounds::SoundCount] = {
+    ":/res/sounds/tox/notification.pcm",
+    ":/res/sounds/tox/incoming-call.pcm"
+};
+
+}
+
+/**
+@class ToxSounds
+@brief Plays the notification sounds.
+
+The sounds are raw 16 bit mono PCM at ToxAudio::SampleRate. They are
+loaded into memory once. A mixer thread sums the playing sounds into a
+single output stream, so overlapping sounds share one sink. The sink is
+opened for the first sound and stays open; it is taken from the
+notification_output ToxSettings. When the setting changes, the sink is
+closed and the new one opened for the next sound. The "null" device
+disables the sounds.
+
+The mixer writes periods of ToxSounds::PeriodSamples samples and sleeps
+while no sound plays. A sound therefore starts within one period of the
+request and the idle mixer costs nothing. Up to ToxSounds::MaxVoices sounds
+play at once; when all voices are busy, the sound that played longest is
+replaced.
+
+Bursts are coalesced: a sound starts at most once per ToxSounds::MinGap
+milliseconds, all requests in between result in one more start after the
+gap. So 50 messages arriving at once play the notification once.
+
+play() is thread-safe and cheap, it only flags the sound and wakes the
+mixer.
+
+
+@enum ToxSounds::Sound
+@brief The notification sounds.
+@var Notification   a new message
+@var IncomingCall   a friend is calling
+
+
+@var ToxSounds::PeriodSamples
+@brief The number of samples mixed per period (5 ms).
+
+@var ToxSounds::MaxVoices
+@brief The maximum number of sounds playing at once.
+
+@var ToxSounds::MinGap
+@brief The minimum time in milliseconds between two starts of a sound.
+*/
+
+constexpr quint32 ToxSounds::PeriodSamples;
+constexpr int ToxSounds::MaxVoices;
+constexpr qint64 ToxSounds::MinGap;
+
+/**
+@brief Mixes the playing sounds into the sink.
+*/
+class ToxSounds::Mixer final : public QThread
+{
+public:
+    explicit Mixer(ToxSounds* sounds)
+        : sounds_(sounds)
+        , sink_(nullptr)
+        , active_(1)
+    {
+    }
+
+    ~Mixer() override
+    {
+        delete sink_;
+    }
+
+    inline void stop()
+    {
+        QMutexLocker locker(&sounds_->mutex_);
+        active_.store(0);
+        sounds_->wake_.wakeOne();
+    }
+
+private:
+    struct Voice {
+        const qint16* data = nullptr;
+        quint32 size = 0;
+        quint32 position = 0;
+    };
+
+private:
+    void run() final
+    {
+        constexpr qint64 period = qint64(PeriodSamples) * 1000000000ll /
+                                  ToxAudio::SampleRate;
+        bool opened = false;
+        bool pending[SoundCount] = {};
+        qint64 started[SoundCount];
+        for (qint64& s : started) {
+            s = -MinGap;
+        }
+
+        QElapsedTimer clock;
+        clock.start();
+        qint64 deadline = 0;
+        while (active_.load()) {
+            if (sounds_->reopen_.fetchAndStoreRelaxed(0)) {
+                if (opened) {
+                    sink_->close();
+                    opened = false;
+                }
+                delete sink_;
+
+                QMutexLocker locker(&sounds_->mutex_);
+                const QString device = sounds_->device_;
+                locker.unlock();
+                sink_ = ToxAudio::createSink(device);
+            }
+
+            const qint64 now = clock.elapsed();
+            qint64 timeout = -1;
+            for (int s = 0; s < SoundCount; ++s) {
+                if (sounds_->requests_[s].fetchAndStoreRelaxed(0)) {
+                    pending[s] = true;
+                }
+                if (!pending[s]) {
+                    continue;
+                }
+
+                const qint64 gap = started[s] + MinGap - now;
+                if (gap <= 0) {
+                    start(static_cast<Sound>(s));
+                    started[s] = now;
+                    pending[s] = false;
+                } else if (timeout < 0 || gap < timeout) {
+                    timeout = gap;
+                }
+            }
+
+            if (!playing()) {
+                QMutexLocker locker(&sounds_->mutex_);
+                if (active_.load() && !requested() &&
+                    !sounds_->reopen_.load())
+                {
+                    if (timeout < 0) {
+                        sounds_->wake_.wait(&sounds_->mutex_);
+                    } else {
+                        sounds_->wake_.wait(
+                                    &sounds_->mutex_,
+                                    static_cast<unsigned long>(timeout));
+                    }
+                }
+                deadline = clock.nsecsElapsed();
+                continue;
+            }
+
+            if (!opened) {
+                opened = true;
+                if (!sink_->open()) {
+                    qWarning("Opening the notification output failed.");
+                    delete sink_;
+                    sink_ = ToxAudio::createSink(QStringLiteral("null"));
+                    sink_->open();
+                }
+            }
+
+            mix();
+            sink_->write(out_, PeriodSamples);
+
+            deadline += period;
+            const qint64 wait = deadline - clock.nsecsElapsed();
+            if (wait > 0) {
+                usleep(static_cast<unsigned long>(wait / 1000));
+            } else if (wait < -period) {
+                deadline = clock.nsecsElapsed();
+            }
+        }
+
+        if (opened) {
+            sink_->close();
+        }
+    }
+
+    bool playing() const
+    {
+        for (const Voice& v : voices_) {
+            if (v.data) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool requested() const
+    {
+        for (const QAtomicInt& r : sounds_->requests_) {
+            if (r.load()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void start(Sound sound)
+    {
+        const QByteArray& pcm = sounds_->pcm_[sound];
+        if (pcm.isEmpty()) {
+            return;
+        }
+
+        Voice* voice = &voices_[0];
+        for (Voice& v : voices_) {
+            if (!v.data) {
+                voice = &v;
+                break;
+            }
+            if (v.position > voice->position) {
+                voice = &v;
+            }
+        }
+
+        voice->data = reinterpret_cast<const qint16*>(pcm.constData());
+        voice->size = static_cast<quint32>(pcm.size()) / sizeof(qint16);
+        voice->position = 0;
+    }
+
+    void mix()
+    {
+        std::memset(sum_, 0, sizeof(sum_));
+        for (Voice& v : voices_) {
+            if (!v.data) {
+                continue;
+            }
+
+            const quint32 count = qMin(PeriodSamples, v.size - v.position);
+            const qint16* in = v.data + v.position;
+            for (quint32 i = 0; i < count; ++i) {
+                sum_[i] += in[i];
+            }
+
+            v.position += count;
+            if (v.position >= v.size) {
+                v.data = nullptr;
+            }
+        }
+
+        for (quint32 i = 0; i < PeriodSamples; ++i) {
+            out_[i] = static_cast<qint16>(qBound(-32768, sum_[i], 32767));
+        }
+    }
+
+private:
+    ToxSounds* sounds_;
+    IToxAudioSink* sink_;
+    QAtomicInt active_;
+    Voice voices_[MaxVoices];
+    int sum_[PeriodSamples];
+    qint16 out_[PeriodSamples];
+};
+
+/**
+@brief Returns the process wide notification sound player.
+
+Call this on the GUI thread first, which loads the sounds.
+*/
+ToxSounds& ToxSounds::instance()
+{
+    static ToxSounds sounds;
+    return sounds;
+}
+
+/**
+@brief constructor
+
+Loads the sounds and starts the mixer. The mixer sleeps until a sound
+plays, so it costs nothing while the sounds are disabled.
+*/
+ToxSounds::ToxSounds()
+    : enabled_(0)
+    , reopen_(0)
+    , mixer_(nullptr)
+{
+    for (int s = 0; s < SoundCount; ++s) {
+        QFile f(QString::fromLatin1(soundFiles[s]));
+        if (f.open(QFile::ReadOnly)) {
+            pcm_[s] = f.readAll();
+        } else {
+            qWarning("Notification sound %s not found.", soundFiles[s]);
+        }
+    }
+
+    setOutput(settings_.notification_output());
+    QObject::connect(&settings_, &ToxSettings::notification_output_changed,
+                     [this](const QString& device) {
+        setOutput(device);
+    });
+
+    mixer_ = new Mixer(this);
+    mixer_->start(QThread::TimeCriticalPriority);
+}
+
+/**
+@brief destructor
+*/
+ToxSounds::~ToxSounds()
+{
+    if (mixer_) {
+        mixer_->stop();
+        mixer_->wait();
+        delete mixer_;
+    }
+}
+
+/**
+@brief Plays a sound.
+@param[in] sound    the sound
+*/
+void ToxSounds::play(Sound sound)
+{
+    if (!enabled_.load()) {
+        return;
+    }
+
+    requests_[sound].ref();
+    QMutexLocker locker(&mutex_);
+    wake_.wakeOne();
+}
+
+/**
+@brief Switches the sounds to another output.
+@param[in] device   the device string; "null" disables the sounds
+
+The mixer closes the current sink and opens the new one for the next sound.
+*/
+void ToxSounds::setOutput(const QString& device)
+{
+    enabled_.store(device != QLatin1String("null"));
+
+    QMutexLocker locker(&mutex_);
+    device_ = device;
+    reopen_.store(1);
+    wake_.wakeOne();
+}
@@ -0,0 +1,80 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef TOXER_PRIVATE_TOXSOUNDS_H
+#define TOXER_PRIVATE_TOXSOUNDS_H
+
+#include "ToxAudio.h"
+
+#include <Settings.h>
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+#include <QWaitCondition>
+
+class ToxSounds final
+{
+public:
+    enum Sound {
+        Notification,
+        IncomingCall,
+        SoundCount
+    };
+
+    static constexpr quint32 PeriodSamples = ToxAudio::SampleRate * 5 / 1000;
+    static constexpr int MaxVoices = 8;
+    static constexpr qint64 MinGap = 200;
+
+public:
+    static ToxSounds& instance();
+
+    void play(Sound sound);
+
+private:
+    class Mixer;
+
+private:
+    ToxSounds();
+    ~ToxSounds();
+
+    void setOutput(const QString& device);
+
+private:
+    QByteArray pcm_[SoundCount];
+    QAtomicInt requests_[SoundCount];
+    QAtomicInt enabled_;
+    QAtomicInt reopen_;
+    QString device_;
+    QMutex mutex_;
+    QWaitCondition wake_;
+    ToxSettings settings_;
+    Mixer* mixer_;
+};
+
+#endif
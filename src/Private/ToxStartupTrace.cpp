@@ -0,0 +1,254 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "ToxStartupTrace.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QStringBuilder>
+#include <QThread>
+#include <QThreadPool>
+
+#include <algorithm>
+
+/**
+@class ToxStartupTrace
+@brief Records the timeline of a Toxer launch.
+
+The phases of a launch, like reading the settings, deriving the profile key
+or creating the Tox instance, are timed with a monotonic clock that starts
+with the first use of the tracer. Each phase and mark is recorded once; later
+repetitions, e.g. when switching profiles, are ignored.
+
+The trace is finished when the first friend comes online or Toxer exits,
+whatever comes first. The timeline is then logged in a single line and
+written as Chrome trace event file "Toxer/startup-trace.json" to the user's
+cache directory, which can be opened in chrome://tracing or Perfetto. The
+event loop only marks the friend and leaves the writing to the global
+thread pool through finishLater().
+
+
+@class ToxStartupTrace::Scope
+@brief Times a phase for the lifetime of the scope.
+*/
+
+namespace {
+
+class FinishJob final : public QRunnable
+{
+public:
+    void run() final
+    {
+        ToxStartupTrace::instance().finish();
+    }
+};
+
+}
+
+/**
+@brief Returns the process wide startup tracer.
+*/
+ToxStartupTrace& ToxStartupTrace::instance()
+{
+    static ToxStartupTrace trace;
+    return trace;
+}
+
+/**
+@brief constructor
+
+Starts the clock of the timeline.
+*/
+ToxStartupTrace::ToxStartupTrace()
+    : finished_(false)
+    , scheduled_(false)
+{
+    clock_.start();
+}
+
+/**
+@brief Starts a phase.
+@param[in] name     the phase name
+*/
+void ToxStartupTrace::begin(const char* name)
+{
+    const QByteArray n(name);
+    QMutexLocker lock(&mutex_);
+    if (!finished_ && !recorded(n) && !pending_.contains(n)) {
+        pending_.insert(n, clock_.nsecsElapsed());
+    }
+}
+
+/**
+@brief Ends a phase.
+@param[in] name     the phase name
+*/
+void ToxStartupTrace::end(const char* name)
+{
+    const QByteArray n(name);
+    QMutexLocker lock(&mutex_);
+    if (!finished_ && pending_.contains(n)) {
+        const qint64 start = pending_.take(n);
+        events_ << Event { n, start, clock_.nsecsElapsed() - start,
+                           threadId(), false };
+    }
+}
+
+/**
+@brief Records a point in time.
+@param[in] name     the mark name
+*/
+void ToxStartupTrace::mark(const char* name)
+{
+    const QByteArray n(name);
+    QMutexLocker lock(&mutex_);
+    if (!finished_ && !recorded(n)) {
+        events_ << Event { n, clock_.nsecsElapsed(), 0, threadId(), true };
+    }
+}
+
+/**
+@brief Finishes the trace and writes the timeline.
+
+Unfinished phases are dropped.
+*/
+void ToxStartupTrace::finish()
+{
+    QMutexLocker lock(&mutex_);
+    if (finished_) {
+        return;
+    }
+
+    finished_ = true;
+    pending_.clear();
+    QVector<Event> events = events_;
+    lock.unlock();
+
+    std::stable_sort(events.begin(), events.end(),
+                     [](const Event& a, const Event& b) {
+        return a.start < b.start;
+    });
+
+    QByteArray line;
+    for (const Event& e : events) {
+        line += ' ' + e.name + '@' + QByteArray::number(e.start / 1e6, 'f', 1);
+        if (!e.instant) {
+            line += '+' + QByteArray::number(e.duration / 1e6, 'f', 1);
+        }
+    }
+    qInfo("Startup timeline (ms):%s", line.constData());
+
+    write(events);
+}
+
+/**
+@brief Finishes the trace on the global thread pool.
+
+Cheap and safe to call on the event loop thread; the trace is finished
+once.
+*/
+void ToxStartupTrace::finishLater()
+{
+    QMutexLocker lock(&mutex_);
+    if (finished_ || scheduled_) {
+        return;
+    }
+
+    scheduled_ = true;
+    lock.unlock();
+    QThreadPool::globalInstance()->start(new FinishJob());
+}
+
+/**
+@brief Returns, if a phase or mark was recorded already.
+*/
+bool ToxStartupTrace::recorded(const QByteArray& name) const
+{
+    return std::any_of(events_.cbegin(), events_.cend(),
+                       [&name](const Event& e) {
+        return e.name == name;
+    });
+}
+
+/**
+@brief Writes the timeline as Chrome trace event file.
+@param[in] events   the recorded events sorted by time
+*/
+void ToxStartupTrace::write(const QVector<Event>& events)
+{
+    const qint64 pid = QCoreApplication::applicationPid();
+    QJsonArray list;
+    for (const Event& e : events) {
+        QJsonObject o;
+        o.insert(QStringLiteral("name"), QString::fromLatin1(e.name));
+        o.insert(QStringLiteral("cat"), QStringLiteral("startup"));
+        o.insert(QStringLiteral("ts"), e.start / 1000.0);
+        o.insert(QStringLiteral("pid"), pid);
+        o.insert(QStringLiteral("tid"), e.thread);
+        if (e.instant) {
+            o.insert(QStringLiteral("ph"), QStringLiteral("i"));
+            o.insert(QStringLiteral("s"), QStringLiteral("p"));
+        } else {
+            o.insert(QStringLiteral("ph"), QStringLiteral("X"));
+            o.insert(QStringLiteral("dur"), e.duration / 1000.0);
+        }
+        list.append(o);
+    }
+
+    QJsonObject doc;
+    doc.insert(QStringLiteral("traceEvents"), list);
+    doc.insert(QStringLiteral("displayTimeUnit"), QStringLiteral("ms"));
+
+    const QString fileName =
+            QStandardPaths::writableLocation(
+                QStandardPaths::GenericCacheLocation) %
+            QStringLiteral("/Toxer/startup-trace.json");
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+    QSaveFile f(fileName);
+    if (!f.open(QSaveFile::WriteOnly) ||
+        f.write(QJsonDocument(doc).toJson(QJsonDocument::Compact)) < 0 ||
+        !f.commit())
+    {
+        qWarning("Failed to write startup trace %s.",
+                 qUtf8Printable(fileName));
+    }
+}
+
+/**
+@brief Returns a numeric id of the current thread.
+*/
+qint64 ToxStartupTrace::threadId()
+{
+    return static_cast<qint64>(
+                reinterpret_cast<quintptr>(QThread::currentThreadId()));
+}
@@ -0,0 +1,96 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef TOXER_PRIVATE_TOXSTARTUPTRACE_H
+#define TOXER_PRIVATE_TOXSTARTUPTRACE_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QVector>
+
+class ToxStartupTrace final
+{
+public:
+    class Scope final
+    {
+    public:
+        inline explicit Scope(const char* name)
+            : name_(name)
+        {
+            ToxStartupTrace::instance().begin(name_);
+        }
+
+        inline ~Scope()
+        {
+            ToxStartupTrace::instance().end(name_);
+        }
+
+        Scope(const Scope& other) = delete;
+        Scope& operator=(const Scope& other) = delete;
+
+    private:
+        const char* name_;
+    };
+
+public:
+    static ToxStartupTrace& instance();
+
+    void begin(const char* name);
+    void end(const char* name);
+    void mark(const char* name);
+    void finish();
+    void finishLater();
+
+private:
+    struct Event {
+        QByteArray name;
+        qint64 start;
+        qint64 duration;
+        qint64 thread;
+        bool instant;
+    };
+
+private:
+    ToxStartupTrace();
+
+    bool recorded(const QByteArray& name) const;
+
+    static void write(const QVector<Event>& events);
+
+    static qint64 threadId();
+
+private:
+    mutable QMutex mutex_;
+    QElapsedTimer clock_;
+    QHash<QByteArray, qint64> pending_;
+    QVector<Event> events_;
+    bool finished_;
+    bool scheduled_;
+};
+
+#endif
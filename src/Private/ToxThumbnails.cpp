@@ -0,0 +1,359 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "ToxThumbnails.h"
+
+#include "ToxerPrivate.h"
+
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QRunnable>
+#include <QStringBuilder>
+#include <QThread>
+
+/**
+@class ToxThumbnails
+@brief Decodes images for QML on a worker pool.
+
+Images are decoded on a pool of worker threads at the size requested by
+QML, so the GUI thread never decodes and no full resolution image is held
+in memory. Without a requested size, images are fit into
+ToxThumbnails::MaxDimension pixels.
+
+Thumbnails of image files are kept in the thumbnails directory next to the
+avatars directory. The cache is keyed by the path, size and modification
+time of the file and the requested size, so a changed file gets new
+thumbnails. Once per run, the cache is pruned on the pool: thumbnails older
+than ToxThumbnails::MaxCacheAge days are removed, then the oldest ones until
+the cache fits into ToxThumbnails::MaxCacheSize bytes.
+
+The most recent request runs first. The items a view creates last are the
+ones scrolled into sight, while QML cancels the requests of items that
+were scrolled out of sight before they are decoded.
+
+
+@var ToxThumbnails::MaxDimension
+@brief The maximum width and height of an image decoded without a size.
+
+@var ToxThumbnails::MaxCacheSize
+@brief The maximum size of the thumbnail cache in bytes.
+
+@var ToxThumbnails::MaxCacheAge
+@brief The number of days a cached thumbnail is kept.
+
+
+@class ToxImageResponse
+@brief The asynchronous result of a ToxThumbnails request.
+
+The decoded image and the cancelled flag live in a State shared with the
+worker. The worker only reaches the response through the state, which drops
+it when the request is cancelled or the response is destroyed. QML may
+therefore delete a cancelled response while its image is still decoded.
+A cancelled response still emits finished(), which lets the engine delete
+it.
+
+
+@class ToxThumbnailProvider
+@brief Serves image file thumbnails to QML.
+
+The image id is the hex encoded UTF-8 path of the file as returned by
+Toxer::thumbnailUrl.
+*/
+
+constexpr int ToxThumbnails::MaxDimension;
+constexpr qint64 ToxThumbnails::MaxCacheSize;
+constexpr qint64 ToxThumbnails::MaxCacheAge;
+
+namespace {
+
+class DecodeJob final : public QRunnable
+{
+public:
+    DecodeJob(const std::shared_ptr<ToxImageResponse::State>& state,
+              const ToxThumbnails::Decoder& decode, const QSize& size)
+        : state_(state)
+        , decode_(decode)
+        , size_(size)
+    {
+    }
+
+    void run() final
+    {
+        if (state_->cancelled.load()) {
+            return;
+        }
+
+        const QImage image = decode_(size_);
+
+        QMutexLocker lock(&state_->mutex);
+        if (state_->response) {
+            state_->image = image;
+            QMetaObject::invokeMethod(state_->response, "finish",
+                                      Qt::QueuedConnection);
+        }
+    }
+
+private:
+    const std::shared_ptr<ToxImageResponse::State> state_;
+    const ToxThumbnails::Decoder decode_;
+    const QSize size_;
+};
+
+class PruneJob final : public QRunnable
+{
+public:
+    void run() final
+    {
+        ToxThumbnails::prune();
+    }
+};
+
+}
+
+/**
+@brief constructor
+*/
+ToxImageResponse::ToxImageResponse()
+    : QQuickImageResponse()
+    , state_(std::make_shared<State>())
+    , finished_(false)
+{
+    state_->response = this;
+}
+
+/**
+@brief destructor
+
+Detaches the response from a request that may still be decoded.
+*/
+ToxImageResponse::~ToxImageResponse()
+{
+    QMutexLocker lock(&state_->mutex);
+    state_->response = nullptr;
+}
+
+QQuickTextureFactory* ToxImageResponse::textureFactory() const
+{
+    QMutexLocker lock(&state_->mutex);
+    return QQuickTextureFactory::textureFactoryForImage(state_->image);
+}
+
+QString ToxImageResponse::errorString() const
+{
+    QMutexLocker lock(&state_->mutex);
+    return state_->image.isNull() && !state_->cancelled.load()
+            ? QStringLiteral("Image not available.")
+            : QString();
+}
+
+/**
+@brief Skips decoding, if the request did not start yet.
+
+The worker never reports to a cancelled response, the response finishes
+on its own.
+*/
+void ToxImageResponse::cancel()
+{
+    QMutexLocker lock(&state_->mutex);
+    state_->cancelled.store(1);
+    state_->response = nullptr;
+    lock.unlock();
+
+    QMetaObject::invokeMethod(this, "finish", Qt::QueuedConnection);
+}
+
+void ToxImageResponse::finish()
+{
+    if (!finished_) {
+        finished_ = true;
+        emit finished();
+    }
+}
+
+ToxThumbnails& ToxThumbnails::instance()
+{
+    static ToxThumbnails thumbnails;
+    return thumbnails;
+}
+
+ToxThumbnails::ToxThumbnails()
+    : sequence_(0)
+{
+    pool_.setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1));
+    pool_.start(new PruneJob(), -1);
+}
+
+/**
+@brief destructor
+
+Waits for running requests.
+*/
+ToxThumbnails::~ToxThumbnails()
+{
+    pool_.clear();
+    pool_.waitForDone();
+}
+
+/**
+@brief Decodes an image in the background.
+@param[in] decode   the function decoding the image at a size
+@param[in] size     the requested size
+@return the response; owned by the caller
+*/
+QQuickImageResponse* ToxThumbnails::request(const Decoder& decode,
+                                            const QSize& size)
+{
+    ToxImageResponse* response = new ToxImageResponse();
+    pool_.start(new DecodeJob(response->state_, decode, size),
+                sequence_.fetchAndAddRelaxed(1));
+    return response;
+}
+
+/**
+@brief Returns the thumbnail of an image file.
+@param[in] fileName     the image file
+@param[in] size         the size to fit the image in
+@return the thumbnail; a null image on failure
+
+Runs on a worker thread. The thumbnail is read from the cache or decoded
+and added to the cache.
+*/
+QImage ToxThumbnails::thumbnail(const QString& fileName, const QSize& size)
+{
+    QImageReader reader(fileName);
+    const QSize full = reader.size();
+    const QSize bounds = size.width() > 0 || size.height() > 0
+            ? size : QSize(MaxDimension, MaxDimension);
+    const QSize scaled = full.isValid() ? fit(full, bounds) : QSize();
+    if (scaled.isValid() && scaled != full) {
+        const QString cached = cacheName(fileName, scaled);
+        QImage image(cached);
+        if (!image.isNull()) {
+            return image;
+        }
+
+        reader.setScaledSize(scaled);
+        image = reader.read();
+        if (!image.isNull()) {
+            QByteArray data;
+            QBuffer buffer(&data);
+            buffer.open(QIODevice::WriteOnly);
+            image.save(&buffer, "PNG");
+            QDir().mkpath(QFileInfo(cached).absolutePath());
+            ToxerPrivate::writeCache(cached, data);
+        }
+        return image;
+    }
+
+    return reader.read();
+}
+
+/**
+@brief Fits a size into bounds without enlarging it.
+@param[in] size     the size of the image
+@param[in] bounds   the bounds; a 0 dimension is not bounded
+@return the scaled size keeping the aspect ratio
+*/
+QSize ToxThumbnails::fit(const QSize& size, const QSize& bounds)
+{
+    QSize limit(bounds.width() > 0 ? bounds.width() : size.width(),
+                bounds.height() > 0 ? bounds.height() : size.height());
+    if (size.width() <= limit.width() && size.height() <= limit.height()) {
+        return size;
+    }
+
+    return size.scaled(limit, Qt::KeepAspectRatio);
+}
+
+/**
+@brief Returns the directory of the thumbnail cache.
+*/
+QString ToxThumbnails::cacheDir()
+{
+    return ToxerPrivate::profilesDir() % QStringLiteral("/thumbnails");
+}
+
+/**
+@brief Returns the cache file of a thumbnail.
+@param[in] fileName     the image file
+@param[in] size         the thumbnail size
+*/
+QString ToxThumbnails::cacheName(const QString& fileName, const QSize& size)
+{
+    const QFileInfo info(fileName);
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(info.absoluteFilePath().toUtf8());
+    hash.addData(QByteArray::number(info.size()));
+    hash.addData(QByteArray::number(info.lastModified().toMSecsSinceEpoch()));
+
+    return cacheDir() % QLatin1Char('/') %
+            QString::fromLatin1(hash.result().toHex()) % QLatin1Char('-') %
+            QString::number(size.width()) % QLatin1Char('x') %
+            QString::number(size.height()) % QStringLiteral(".png");
+}
+
+/**
+@brief Removes old thumbnails and keeps the cache within its size limit.
+
+Runs on a worker thread. The thumbnails are removed oldest first.
+*/
+void ToxThumbnails::prune()
+{
+    const QDir dir(cacheDir());
+    const QFileInfoList files =
+            dir.entryInfoList(QDir::Files, QDir::Time | QDir::Reversed);
+    const QDateTime expiry =
+            QDateTime::currentDateTimeUtc().addDays(-MaxCacheAge);
+    qint64 total = 0;
+    for (const QFileInfo& info : files) {
+        total += info.size();
+    }
+
+    for (const QFileInfo& info : files) {
+        if (total <= MaxCacheSize && info.lastModified() >= expiry) {
+            break;
+        }
+        if (QFile::remove(info.absoluteFilePath())) {
+            total -= info.size();
+        }
+    }
+}
+
+QQuickImageResponse* ToxThumbnailProvider::requestImageResponse(
+        const QString& id, const QSize& requestedSize)
+{
+    const QString fileName =
+            QString::fromUtf8(QByteArray::fromHex(id.toLatin1()));
+    return ToxThumbnails::instance().request([fileName](const QSize& size) {
+        return ToxThumbnails::thumbnail(fileName, size);
+    }, requestedSize);
+}
@@ -0,0 +1,106 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef TOXER_PRIVATE_TOXTHUMBNAILS_H
+#define TOXER_PRIVATE_TOXTHUMBNAILS_H
+
+#include <QAtomicInt>
+#include <QImage>
+#include <QMutex>
+#include <QQuickAsyncImageProvider>
+#include <QThreadPool>
+
+#include <functional>
+#include <memory>
+
+class ToxImageResponse final : public QQuickImageResponse
+{
+    Q_OBJECT
+
+public:
+    struct State {
+        QMutex mutex;
+        ToxImageResponse* response = nullptr;
+        QImage image;
+        QAtomicInt cancelled;
+    };
+
+public:
+    ToxImageResponse();
+    ~ToxImageResponse() override;
+
+    QQuickTextureFactory* textureFactory() const override;
+    QString errorString() const override;
+    void cancel() override;
+
+private slots:
+    void finish();
+
+private:
+    const std::shared_ptr<State> state_;
+    bool finished_;
+
+    friend class ToxThumbnails;
+};
+
+class ToxThumbnails final
+{
+public:
+    using Decoder = std::function<QImage(const QSize&)>;
+
+    static constexpr int MaxDimension = 2048;
+    static constexpr qint64 MaxCacheSize = 64 * 1024 * 1024;
+    static constexpr qint64 MaxCacheAge = 30;
+
+public:
+    static ToxThumbnails& instance();
+
+    QQuickImageResponse* request(const Decoder& decode, const QSize& size);
+    static QImage thumbnail(const QString& fileName, const QSize& size);
+    static QSize fit(const QSize& size, const QSize& bounds);
+    static void prune();
+
+private:
+    ToxThumbnails();
+    ~ToxThumbnails();
+
+    static QString cacheDir();
+    static QString cacheName(const QString& fileName, const QSize& size);
+
+private:
+    QThreadPool pool_;
+    QAtomicInt sequence_;
+};
+
+class ToxThumbnailProvider final : public QQuickAsyncImageProvider
+{
+public:
+    QQuickImageResponse* requestImageResponse(
+            const QString& id, const QSize& requestedSize) override;
+};
+
+#endif
@@ -0,0 +1,1054 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "ToxTransfers.h"
+
+#include "ToxAvatars.h"
+#include "ToxProfile.h"
+#include "IToxNotify.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QVector>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/**
+@class ToxTransfers
+@brief The file transfer engine of a profile.
+
+Files to send are memory mapped. Toxcore pulls the file through chunk
+requests, which are answered straight from the mapping without copying the
+data first. The kernel is advised to read the next ToxTransfers::ReadAhead
+bytes of a file ahead, so answering a request does not block the event loop
+on disk reads. While transfers are active, the event loop iterates every
+ToxTransfers::BusyInterval milliseconds to keep several chunks in flight.
+
+Chunk requests are queued per transfer and answered by schedule() after
+each iteration. Chat and control traffic has strict priority. Toxcore sends
+all packets of a friend through one queue, so at most
+ToxTransfers::MaxInFlight bytes of file data are handed to it per friend and
+iteration. The queue therefore stays shallow enough for a message to pass
+within a few iterations. After a message was sent, the next round of chunks
+is held back, so the message leaves ahead of new bulk data. The queued
+requests are
+served by deficit round robin with a quantum of ToxTransfers::Quantum bytes,
+so small transfers complete quickly next to large ones. A token bucket for
+all transfers and one per friend enforce the configured rate limits, with
+bursts of up to ToxTransfers::BurstWindow milliseconds of data.
+
+Received chunks are collected into blocks of ToxTransfers::CoalesceSize
+bytes, which the ToxFileWriter writes on its own thread. When the disk falls
+behind by more than ToxTransfers::MaxBacklog bytes, the incoming transfers
+are paused until the writer caught up. Offered files are announced to the
+observers and received once accepted. A file that was interrupted before is
+resumed right away at the position recorded in the journal of the writer.
+The journal is keyed by the public key of the sender and the file id, so two
+friends offering the same file id never resume each other's data. A file
+that cannot be written is canceled and reported as failed. A complete file is
+reported once the writer gave it its final name.
+Outgoing files get a file id derived from their path, size and modification
+time, so a receiver can resume them as well.
+
+Avatars are received in memory and handed to ToxAvatars. An avatar that is
+stored already is not transferred again.
+
+The throughput of each transfer is reported to the IToxTransferNotifier
+observers at most every ToxTransfers::ReportInterval milliseconds.
+
+Transfers are identified by the friend number and the file number toxcore
+assigned. The chunk functions are called on the event loop thread, the
+others with the Tox instance locked.
+
+
+@var ToxTransfers::ReadAhead
+@brief The number of bytes advised to be read ahead of a chunk request.
+
+@var ToxTransfers::CoalesceSize
+@brief The size of the blocks handed to the writer.
+
+@var ToxTransfers::MaxBacklog
+@brief The number of unwritten bytes at which incoming transfers pause.
+
+@var ToxTransfers::Quantum
+@brief The number of bytes a transfer may send per scheduling round.
+
+@var ToxTransfers::MaxInFlight
+@brief The number of bytes handed to toxcore per friend and iteration.
+
+@var ToxTransfers::BurstWindow
+@brief The time in milliseconds a rate limit may be exceeded in a burst.
+
+@var ToxTransfers::MaxChunkSize
+@brief The largest chunk toxcore requests; a bucket always holds one.
+
+@fn ToxTransfers::capacity
+@brief Returns the tokens a bucket of a rate limit holds at most.
+
+@var ToxTransfers::ReportInterval
+@brief The minimum time in milliseconds between two progress reports.
+
+@var ToxTransfers::BusyInterval
+@brief The iteration interval in milliseconds while transfers are active.
+*/
+
+constexpr quint64 ToxTransfers::ReadAhead;
+constexpr int ToxTransfers::CoalesceSize;
+constexpr quint64 ToxTransfers::MaxBacklog;
+constexpr quint64 ToxTransfers::Quantum;
+constexpr quint64 ToxTransfers::MaxInFlight;
+constexpr qint64 ToxTransfers::BurstWindow;
+constexpr qint64 ToxTransfers::MaxChunkSize;
+constexpr qint64 ToxTransfers::ReportInterval;
+constexpr unsigned long ToxTransfers::BusyInterval;
+
+// a full chunk must fit into the bucket of a low limit
+static_assert(ToxTransfers::capacity(1024) >=
+              ToxTransfers::MaxChunkSize * 1000,
+              "A 1 KiB/s limit never allows a chunk.");
+
+/**
+@brief constructor
+@param[in] profile  the profile that owns the Tox instance
+*/
+ToxTransfers::ToxTransfers(ToxProfilePrivate* profile)
+    : profile_(profile)
+    , friendRate_(0)
+{
+    clock_.start();
+}
+
+/**
+@brief destructor
+
+Unmaps the files of unfinished outgoing transfers and suspends the incoming
+transfers.
+*/
+ToxTransfers::~ToxTransfers()
+{
+    for (const Outgoing& t : outgoing_) {
+        delete t.file;
+    }
+
+    for (auto it = incoming_.begin(); it != incoming_.end(); ++it) {
+        flush(it.key(), *it);
+        writer_.close(it.key(), ToxFileWriter::Outcome::Suspend);
+    }
+}
+
+/**
+@brief Offers a file to a friend.
+@param[in] tox          the locked Tox instance
+@param[in] friendNo     the friend number
+@param[in] fileName     the absolute path of the file
+@return the file number of the transfer; UINT32_MAX on failure
+*/
+quint32 ToxTransfers::send(Tox* tox, quint32 friendNo,
+                           const QString& fileName)
+{
+    Outgoing t;
+    t.file = new QFile(fileName);
+    t.size = static_cast<quint64>(t.file->size());
+    if (!t.file->open(QFile::ReadOnly)) {
+        qWarning("Cannot send file %s: %s", qUtf8Printable(fileName),
+                 qUtf8Printable(t.file->errorString()));
+        delete t.file;
+        return UINT32_MAX;
+    }
+
+    if (t.size > 0) {
+        t.data = t.file->map(0, static_cast<qint64>(t.size));
+        if (!t.data) {
+            qWarning("Cannot map file %s: %s", qUtf8Printable(fileName),
+                     qUtf8Printable(t.file->errorString()));
+            delete t.file;
+            return UINT32_MAX;
+        }
+#ifdef Q_OS_UNIX
+        madvise(const_cast<uint8_t*>(t.data), t.size, MADV_SEQUENTIAL);
+#endif
+    }
+
+    const QFileInfo info(fileName);
+    QByteArray key = info.absoluteFilePath().toUtf8();
+    key += QByteArray::number(t.size);
+    key += QByteArray::number(info.lastModified().toMSecsSinceEpoch());
+    uint8_t fileId[TOX_FILE_ID_LENGTH];
+    const bool stableId =
+            tox_hash(fileId, reinterpret_cast<const uint8_t*>(key.constData()),
+                     static_cast<size_t>(key.size()));
+
+    const QByteArray name = info.fileName().toUtf8();
+    TOX_ERR_FILE_SEND err = TOX_ERR_FILE_SEND_OK;
+    const quint32 fileNo = tox_file_send(
+                tox, friendNo, TOX_FILE_KIND_DATA, t.size,
+                stableId ? fileId : nullptr,
+                reinterpret_cast<const uint8_t*>(name.constData()),
+                static_cast<size_t>(name.size()), &err);
+    if (err != TOX_ERR_FILE_SEND_OK) {
+        qWarning("Sending file %s to friend %u failed. Code: %d",
+                 qUtf8Printable(fileName), friendNo, err);
+        delete t.file;
+        return UINT32_MAX;
+    }
+
+    advise(t, 0);
+    t.clock.start();
+
+    const quint64 id = transferId(friendNo, fileNo);
+    QMutexLocker lock(&mutex_);
+    outgoing_.insert(id, t);
+    lock.unlock();
+
+    notifyStarted(id, QString::fromUtf8(name), t.size, false);
+    return fileNo;
+}
+
+/**
+@brief Accepts a file offered by a friend.
+@param[in] tox          the locked Tox instance
+@param[in] friendNo     the friend number
+@param[in] fileNo       the file number
+@param[in] fileName     the absolute path to store the file at
+@return true, if the transfer started
+*/
+bool ToxTransfers::accept(Tox* tox, quint32 friendNo, quint32 fileNo,
+                          const QString& fileName)
+{
+    const quint64 id = transferId(friendNo, fileNo);
+    QMutexLocker lock(&mutex_);
+    auto it = incoming_.find(id);
+    if (it == incoming_.end() || it->accepted) {
+        return false;
+    }
+
+    it->accepted = true;
+    it->clock.start();
+    writer_.open(id, fileName, it->journalKey, it->size, 0);
+    lock.unlock();
+
+    TOX_ERR_FILE_CONTROL err = TOX_ERR_FILE_CONTROL_OK;
+    tox_file_control(tox, friendNo, fileNo, TOX_FILE_CONTROL_RESUME, &err);
+    if (err != TOX_ERR_FILE_CONTROL_OK) {
+        qWarning("Accepting file %u of friend %u failed. Code: %d",
+                 fileNo, friendNo, err);
+        finishIncoming(id, ToxFileWriter::Outcome::Discard);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+@brief Cancels a transfer or rejects an offered file.
+@param[in] tox          the locked Tox instance
+@param[in] friendNo     the friend number
+@param[in] fileNo       the file number
+*/
+void ToxTransfers::cancel(Tox* tox, quint32 friendNo, quint32 fileNo)
+{
+    tox_file_control(tox, friendNo, fileNo, TOX_FILE_CONTROL_CANCEL, nullptr);
+    finish(transferId(friendNo, fileNo), false);
+    finishIncoming(transferId(friendNo, fileNo),
+                   ToxFileWriter::Outcome::Discard);
+}
+
+/**
+@brief Returns, if any transfer is moving data.
+
+Chunk requests waiting to be sent and accepted incoming transfers that are
+not paused count. Offers not accepted yet and paused transfers do not, so
+they don't keep the event loop at ToxTransfers::BusyInterval.
+*/
+bool ToxTransfers::isBusy() const
+{
+    QMutexLocker lock(&mutex_);
+    if (!active_.isEmpty()) {
+        return true;
+    }
+
+    for (const Incoming& t : incoming_) {
+        if (t.accepted && !t.paused) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+@brief Resumes paused incoming transfers once the writer caught up.
+@param[in] tox  the Tox instance
+
+The results of the writer are handled first. Called on the event loop thread
+before each iteration.
+*/
+void ToxTransfers::poll(Tox* tox)
+{
+    collectResults(tox);
+
+    if (!paused_.load() || writer_.backlog() > MaxBacklog / 2) {
+        return;
+    }
+
+    QMutexLocker lock(&mutex_);
+    for (auto it = incoming_.begin(); it != incoming_.end(); ++it) {
+        if (it->paused) {
+            tox_file_control(tox, static_cast<quint32>(it.key() >> 32),
+                             static_cast<quint32>(it.key()),
+                             TOX_FILE_CONTROL_RESUME, nullptr);
+            it->paused = false;
+        }
+    }
+    paused_.store(0);
+}
+
+/**
+@brief Sends the queued chunks.
+@param[in] tox  the Tox instance
+
+Called on the event loop thread after each iteration.
+*/
+void ToxTransfers::schedule(Tox* tox)
+{
+    if (interactive_.fetchAndStoreRelaxed(0)) {
+        return;
+    }
+
+    QMutexLocker lock(&mutex_);
+    if (active_.isEmpty()) {
+        return;
+    }
+
+    const qint64 now = clock_.elapsed();
+    refill(total_, now);
+
+    QVector<quint32> blocked;
+    QHash<quint32, quint64> inFlight;
+    bool served = true;
+    while (served && !active_.isEmpty() && allows(total_, 1)) {
+        served = false;
+        for (auto it = active_.begin(); it != active_.end();) {
+            const quint64 id = *it;
+            const quint32 friendNo = static_cast<quint32>(id >> 32);
+            if (blocked.contains(friendNo)) {
+                ++it;
+                continue;
+            }
+
+            Bucket& limit = friends_[friendNo];
+            limit.rate = friendRate_;
+            refill(limit, now);
+
+            Outgoing& t = outgoing_[id];
+            bool full = false;
+            served |= serve(tox, id, t, limit, inFlight[friendNo], &full);
+            if (full) {
+                blocked << friendNo;
+            }
+
+            if (t.requests.isEmpty()) {
+                t.deficit = 0;
+                it = active_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+/**
+@brief Lets chat and control traffic pass the queued chunks.
+
+Thread-safe; called whenever a message or a change is sent.
+*/
+void ToxTransfers::interactive()
+{
+    interactive_.store(1);
+}
+
+/**
+@brief Sets the rate limits of the outgoing transfers.
+@param[in] total        the limit of all transfers in bytes per second
+@param[in] perFriend    the limit per friend in bytes per second
+
+A limit of 0 disables the limit.
+*/
+void ToxTransfers::setRateLimits(quint64 total, quint64 perFriend)
+{
+    QMutexLocker lock(&mutex_);
+    total_.rate = total;
+    friendRate_ = perFriend;
+}
+
+/**
+@brief Returns the number of queued chunk requests of all transfers.
+*/
+int ToxTransfers::queueDepth() const
+{
+    QMutexLocker lock(&mutex_);
+    int depth = 0;
+    for (const Outgoing& t : outgoing_) {
+        depth += t.requests.count();
+    }
+    return depth;
+}
+
+/**
+@brief Returns the number of queued chunk requests of a friend.
+@param[in] friendNo     the friend number
+*/
+int ToxTransfers::queueDepth(quint32 friendNo) const
+{
+    QMutexLocker lock(&mutex_);
+    int depth = 0;
+    for (auto it = outgoing_.cbegin(); it != outgoing_.cend(); ++it) {
+        if ((it.key() >> 32) == friendNo) {
+            depth += it->requests.count();
+        }
+    }
+    return depth;
+}
+
+/**
+@brief Queues a chunk request of toxcore.
+@param[in] tox          the Tox instance
+@param[in] friendNo     the friend number
+@param[in] fileNo       the file number
+@param[in] position     the file offset of the chunk
+@param[in] length       the chunk length; 0 when the transfer is complete
+*/
+void ToxTransfers::chunkRequest(Tox* tox, quint32 friendNo, quint32 fileNo,
+                                quint64 position, size_t length)
+{
+    Q_UNUSED(tox);
+
+    const quint64 id = transferId(friendNo, fileNo);
+    QMutexLocker lock(&mutex_);
+    auto it = outgoing_.find(id);
+    if (it == outgoing_.end()) {
+        return;
+    }
+
+    if (length == 0) {
+        lock.unlock();
+        finish(id, true);
+        return;
+    }
+
+    Outgoing& t = *it;
+    if (position > t.size || length > t.size - position) {
+        qWarning("Invalid chunk request for file %u of friend %u.",
+                 fileNo, friendNo);
+        return;
+    }
+
+    if (t.requests.isEmpty()) {
+        active_ << id;
+    }
+    t.requests.enqueue({ position, length });
+}
+
+/**
+@brief Handles a file offered by a friend.
+@param[in] tox          the Tox instance
+@param[in] friendNo     the friend number
+@param[in] fileNo       the file number
+@param[in] kind         the TOX_FILE_KIND of the file
+@param[in] size         the file size; UINT64_MAX if unknown
+@param[in] name         the file name proposed by the friend
+
+A file that was interrupted before is resumed right away. Other files wait
+to be accepted.
+*/
+void ToxTransfers::receive(Tox* tox, quint32 friendNo, quint32 fileNo,
+                           quint32 kind, quint64 size, const QString& name)
+{
+    if (kind == TOX_FILE_KIND_AVATAR) {
+        receiveAvatar(tox, friendNo, fileNo, size);
+        return;
+    } else if (kind != TOX_FILE_KIND_DATA) {
+        return;
+    }
+
+    Incoming t;
+    t.size = size;
+    QByteArray key(TOX_PUBLIC_KEY_SIZE + TOX_FILE_ID_LENGTH, 0);
+    uint8_t* k = reinterpret_cast<uint8_t*>(key.data());
+    if (tox_friend_get_public_key(tox, friendNo, k, nullptr) &&
+        tox_file_get_file_id(tox, friendNo, fileNo, k + TOX_PUBLIC_KEY_SIZE,
+                             nullptr))
+    {
+        t.journalKey = key;
+    }
+
+    QString fileName;
+    quint64 position = 0;
+    const quint64 id = transferId(friendNo, fileNo);
+    if (!t.journalKey.isEmpty() &&
+        writer_.resumable(t.journalKey, size, &fileName, &position))
+    {
+        TOX_ERR_FILE_SEEK err = TOX_ERR_FILE_SEEK_OK;
+        if (position > 0) {
+            tox_file_seek(tox, friendNo, fileNo, position, &err);
+        }
+        if (err == TOX_ERR_FILE_SEEK_OK) {
+            t.accepted = true;
+            t.sent = position;
+            t.lastSent = position;
+            t.bufferPos = position;
+            t.clock.start();
+            writer_.open(id, fileName, t.journalKey, size, position);
+            tox_file_control(tox, friendNo, fileNo, TOX_FILE_CONTROL_RESUME,
+                             nullptr);
+        }
+    }
+
+    QMutexLocker lock(&mutex_);
+    incoming_.insert(id, t);
+    lock.unlock();
+
+    notifyStarted(id, name, size, true);
+}
+
+/**
+@brief Collects a received chunk.
+@param[in] tox          the Tox instance
+@param[in] friendNo     the friend number
+@param[in] fileNo       the file number
+@param[in] position     the file offset of the chunk
+@param[in] data         the chunk data
+@param[in] length       the chunk length; 0 when the transfer is complete
+
+Full blocks are handed to the writer. The transfer is paused while the
+writer is behind by more than ToxTransfers::MaxBacklog bytes.
+*/
+void ToxTransfers::chunkReceived(Tox* tox, quint32 friendNo, quint32 fileNo,
+                                 quint64 position, const uint8_t* data,
+                                 size_t length)
+{
+    const quint64 id = transferId(friendNo, fileNo);
+    QMutexLocker lock(&mutex_);
+    auto avatar = avatars_.find(id);
+    if (avatar != avatars_.end()) {
+        if (length > 0) {
+            avatar->data.append(reinterpret_cast<const char*>(data),
+                                static_cast<int>(length));
+            return;
+        }
+
+        const Avatar a = *avatar;
+        avatars_.erase(avatar);
+        lock.unlock();
+        if (static_cast<quint64>(a.data.size()) == a.size) {
+            avatarChanged(friendNo, a.publicKey,
+                          ToxAvatars::instance().store(a.data));
+        }
+        return;
+    }
+
+    auto it = incoming_.find(id);
+    if (it == incoming_.end() || !it->accepted) {
+        return;
+    }
+
+    if (length == 0) {
+        lock.unlock();
+        finishIncoming(id, ToxFileWriter::Outcome::Complete);
+        return;
+    }
+
+    Incoming& t = *it;
+    if (position != t.bufferPos + static_cast<quint64>(t.buffer.size())) {
+        flush(id, t);
+        t.bufferPos = position;
+    }
+
+    if (t.buffer.isEmpty()) {
+        t.buffer.reserve(CoalesceSize);
+    }
+    t.buffer.append(reinterpret_cast<const char*>(data),
+                    static_cast<int>(length));
+    t.sent = position + length;
+    if (t.buffer.size() >= CoalesceSize) {
+        flush(id, t);
+    }
+
+    if (!t.paused && writer_.backlog() > MaxBacklog) {
+        tox_file_control(tox, friendNo, fileNo, TOX_FILE_CONTROL_PAUSE,
+                         nullptr);
+        t.paused = true;
+        paused_.store(1);
+    }
+
+    report(id, t, false);
+}
+
+/**
+@brief Handles a file control sent by a friend.
+@param[in] friendNo     the friend number
+@param[in] fileNo       the file number
+@param[in] control      the file control
+*/
+void ToxTransfers::control(quint32 friendNo, quint32 fileNo,
+                           TOX_FILE_CONTROL control)
+{
+    if (control == TOX_FILE_CONTROL_CANCEL) {
+        const quint64 id = transferId(friendNo, fileNo);
+        QMutexLocker lock(&mutex_);
+        avatars_.remove(id);
+        lock.unlock();
+
+        finish(id, false);
+        finishIncoming(id, ToxFileWriter::Outcome::Discard);
+    }
+}
+
+/**
+@brief Ends all transfers of a friend that went offline.
+@param[in] friendNo     the friend number
+
+Toxcore drops the transfers of offline friends. Incoming files are
+suspended, so they resume when the friend offers them again.
+*/
+void ToxTransfers::friendOffline(quint32 friendNo)
+{
+    QMutexLocker lock(&mutex_);
+    QVector<quint64> outgoing;
+    for (auto it = outgoing_.cbegin(); it != outgoing_.cend(); ++it) {
+        if ((it.key() >> 32) == friendNo) {
+            outgoing << it.key();
+        }
+    }
+    QVector<quint64> incoming;
+    for (auto it = incoming_.cbegin(); it != incoming_.cend(); ++it) {
+        if ((it.key() >> 32) == friendNo) {
+            incoming << it.key();
+        }
+    }
+    for (auto it = avatars_.begin(); it != avatars_.end();) {
+        if ((it.key() >> 32) == friendNo) {
+            it = avatars_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    friends_.remove(friendNo);
+    lock.unlock();
+
+    for (quint64 id : outgoing) {
+        finish(id, false);
+    }
+    for (quint64 id : incoming) {
+        finishIncoming(id, ToxFileWriter::Outcome::Suspend);
+    }
+}
+
+/**
+@brief Ends all transfers.
+
+Used when the Tox instance is replaced, which drops all transfers. Incoming
+files are suspended.
+*/
+void ToxTransfers::abortAll()
+{
+    QMutexLocker lock(&mutex_);
+    const QList<quint64> outgoing = outgoing_.keys();
+    const QList<quint64> incoming = incoming_.keys();
+    avatars_.clear();
+    lock.unlock();
+
+    for (quint64 id : outgoing) {
+        finish(id, false);
+    }
+    for (quint64 id : incoming) {
+        finishIncoming(id, ToxFileWriter::Outcome::Suspend);
+    }
+}
+
+/**
+@brief Sends the queued chunks of a transfer for one round.
+@param[in] tox          the Tox instance
+@param[in] id           the transfer id
+@param[in] t            the transfer
+@param[in] limit        the rate limit of the friend
+@param[in,out] inFlight the bytes handed to toxcore for the friend this round
+@param[out] blocked     set, if no more chunks can be sent to the friend
+@return true, if a chunk was sent
+
+The chunks are passed to toxcore straight from the file mapping.
+*/
+bool ToxTransfers::serve(Tox* tox, quint64 id, Outgoing& t, Bucket& limit,
+                         quint64& inFlight, bool* blocked)
+{
+    const quint32 friendNo = static_cast<quint32>(id >> 32);
+    const quint32 fileNo = static_cast<quint32>(id);
+    bool served = false;
+
+    t.deficit += Quantum;
+    while (!t.requests.isEmpty()) {
+        const Chunk c = t.requests.head();
+        if (c.length > t.deficit || !allows(total_, c.length)) {
+            break;
+        }
+        if (!allows(limit, c.length) || inFlight + c.length > MaxInFlight) {
+            *blocked = true;
+            break;
+        }
+
+        TOX_ERR_FILE_SEND_CHUNK err = TOX_ERR_FILE_SEND_CHUNK_OK;
+        tox_file_send_chunk(tox, friendNo, fileNo, c.position,
+                            t.data + c.position, c.length, &err);
+        if (err == TOX_ERR_FILE_SEND_CHUNK_SENDQ) {
+            *blocked = true;
+            break;
+        }
+
+        t.requests.dequeue();
+        if (err != TOX_ERR_FILE_SEND_CHUNK_OK) {
+            qWarning("Sending chunk of file %u to friend %u failed. Code: %d",
+                     fileNo, friendNo, err);
+            continue;
+        }
+
+        t.deficit -= c.length;
+        inFlight += c.length;
+        consume(total_, c.length);
+        consume(limit, c.length);
+        t.sent += c.length;
+        advise(t, c.position + c.length);
+        served = true;
+    }
+
+    if (served) {
+        report(id, t, false);
+    }
+    return served;
+}
+
+/**
+@brief Adds the tokens earned since the last refill to a bucket.
+@param[in] b    the bucket
+@param[in] now  the current time in milliseconds
+
+The tokens are counted in thousandths of a byte, so slow rates do not
+round down to nothing at short intervals. A bucket holds at least one chunk
+of ToxTransfers::MaxChunkSize bytes, so slow rates still make progress.
+*/
+void ToxTransfers::refill(Bucket& b, qint64 now)
+{
+    const qint64 rate = static_cast<qint64>(b.rate);
+    b.tokens = qMin(b.tokens + rate * (now - b.last), capacity(rate));
+    b.last = now;
+}
+
+/**
+@brief Returns, if a bucket has tokens for a chunk.
+@param[in] b        the bucket
+@param[in] length   the chunk length
+*/
+bool ToxTransfers::allows(const Bucket& b, size_t length)
+{
+    return b.rate == 0 || b.tokens >= static_cast<qint64>(length) * 1000;
+}
+
+/**
+@brief Takes the tokens of a sent chunk from a bucket.
+@param[in] b        the bucket
+@param[in] length   the chunk length
+*/
+void ToxTransfers::consume(Bucket& b, size_t length)
+{
+    if (b.rate > 0) {
+        b.tokens -= static_cast<qint64>(length) * 1000;
+    }
+}
+
+/**
+@brief Advises the kernel to read the file ahead of a position.
+@param[in] t            the transfer
+@param[in] position     the file position sent next
+
+The read ahead window is renewed once half of it was sent.
+*/
+void ToxTransfers::advise(Outgoing& t, quint64 position)
+{
+    if (t.advised >= t.size || t.advised > position + ReadAhead / 2) {
+        return;
+    }
+
+    const quint64 end = qMin(position + ReadAhead, t.size);
+#ifdef Q_OS_UNIX
+    static const quint64 pageSize =
+            static_cast<quint64>(sysconf(_SC_PAGESIZE));
+    const quint64 start = t.advised - t.advised % pageSize;
+    madvise(const_cast<uint8_t*>(t.data) + start, end - start,
+            MADV_WILLNEED);
+#endif
+    t.advised = end;
+}
+
+/**
+@brief Hands the collected chunks of an incoming transfer to the writer.
+@param[in] id   the transfer id
+@param[in] t    the transfer
+*/
+void ToxTransfers::flush(quint64 id, Incoming& t)
+{
+    if (t.buffer.isEmpty()) {
+        return;
+    }
+
+    writer_.write(id, t.bufferPos, t.buffer);
+    t.bufferPos += static_cast<quint64>(t.buffer.size());
+    t.buffer = QByteArray();
+}
+
+/**
+@brief Reports the progress and throughput of a transfer.
+@param[in] id       the transfer id
+@param[in] t        the transfer
+@param[in] force    true to ignore the report interval
+*/
+void ToxTransfers::report(quint64 id, Progress& t, bool force)
+{
+    const qint64 now = t.clock.elapsed();
+    const qint64 elapsed = now - t.lastReport;
+    if (!force && elapsed < ReportInterval) {
+        return;
+    }
+
+    if (elapsed > 0) {
+        const quint64 rate = (t.sent - t.lastSent) * 1000 /
+                             static_cast<quint64>(elapsed);
+        t.rate = t.rate == 0 ? rate : (t.rate * 3 + rate) / 4;
+    }
+    t.lastReport = now;
+    t.lastSent = t.sent;
+
+    const int friendIndex = static_cast<int>(id >> 32);
+    const quint32 fileIndex = static_cast<quint32>(id);
+    for (auto n : profile_->transferNotifiers) {
+        n->on_transfer_progress(friendIndex, fileIndex, t.sent, t.size,
+                                t.rate);
+    }
+}
+
+/**
+@brief Ends an outgoing transfer and releases its file.
+@param[in] id           the transfer id
+@param[in] completed    true, if the file was transferred completely
+*/
+void ToxTransfers::finish(quint64 id, bool completed)
+{
+    QMutexLocker lock(&mutex_);
+    auto it = outgoing_.find(id);
+    if (it == outgoing_.end()) {
+        return;
+    }
+
+    report(id, *it, true);
+    delete it->file;
+    outgoing_.erase(it);
+    active_.removeOne(id);
+    lock.unlock();
+
+    const int friendIndex = static_cast<int>(id >> 32);
+    const quint32 fileIndex = static_cast<quint32>(id);
+    for (auto n : profile_->transferNotifiers) {
+        n->on_transfer_finished(friendIndex, fileIndex, completed);
+    }
+}
+
+/**
+@brief Ends an incoming transfer.
+@param[in] id       the transfer id
+@param[in] outcome  the way to close the file
+
+A complete file is reported by collectResults() once the writer renamed it.
+*/
+void ToxTransfers::finishIncoming(quint64 id, ToxFileWriter::Outcome outcome)
+{
+    QMutexLocker lock(&mutex_);
+    auto it = incoming_.find(id);
+    if (it == incoming_.end()) {
+        return;
+    }
+
+    const bool accepted = it->accepted;
+    if (accepted) {
+        flush(id, *it);
+        writer_.close(id, outcome);
+        report(id, *it, true);
+    }
+    incoming_.erase(it);
+    if (accepted && outcome == ToxFileWriter::Outcome::Complete) {
+        completing_.insert(id);
+        return;
+    }
+    lock.unlock();
+
+    notifyFinished(id, false);
+}
+
+/**
+@brief Handles the files the writer finished or gave up.
+@param[in] tox  the Tox instance
+
+A completed transfer is reported with the result of its file. A transfer
+whose file failed while data is still arriving is canceled.
+*/
+void ToxTransfers::collectResults(Tox* tox)
+{
+    const QVector<QPair<quint64, bool>> results = writer_.takeResults();
+    for (const auto& r : results) {
+        const quint64 id = r.first;
+        QMutexLocker lock(&mutex_);
+        if (completing_.remove(id)) {
+            lock.unlock();
+            notifyFinished(id, r.second);
+            continue;
+        }
+
+        auto it = incoming_.constFind(id);
+        if (r.second || it == incoming_.cend() || !it->accepted) {
+            continue;
+        }
+        lock.unlock();
+
+        tox_file_control(tox, static_cast<quint32>(id >> 32),
+                         static_cast<quint32>(id), TOX_FILE_CONTROL_CANCEL,
+                         nullptr);
+        finishIncoming(id, ToxFileWriter::Outcome::Discard);
+    }
+}
+
+/**
+@brief Tells the observers that an incoming transfer ended.
+@param[in] id           the transfer id
+@param[in] completed    true, if the file was stored completely
+*/
+void ToxTransfers::notifyFinished(quint64 id, bool completed)
+{
+    const int friendIndex = static_cast<int>(id >> 32);
+    const quint32 fileIndex = static_cast<quint32>(id);
+    for (auto n : profile_->transferNotifiers) {
+        n->on_transfer_finished(friendIndex, fileIndex, completed);
+    }
+}
+
+/**
+@brief Tells the observers about a new transfer.
+@param[in] id           the transfer id
+@param[in] name         the file name
+@param[in] size         the file size
+@param[in] incoming     true for received files
+
+An offer received in standby is kept until the profile is active again.
+*/
+void ToxTransfers::notifyStarted(quint64 id, const QString& name,
+                                 quint64 size, bool incoming)
+{
+    const int friendIndex = static_cast<int>(id >> 32);
+    const quint32 fileIndex = static_cast<quint32>(id);
+    ToxProfilePrivate* p = profile_;
+    p->deliver([p, friendIndex, fileIndex, name, size, incoming]() {
+        for (auto n : p->transferNotifiers) {
+            n->on_transfer_started(friendIndex, fileIndex, name, size,
+                                   incoming);
+        }
+    });
+}
+
+/**
+@brief Handles an avatar offered by a friend.
+@param[in] tox          the Tox instance
+@param[in] friendNo     the friend number
+@param[in] fileNo       the file number
+@param[in] size         the avatar size; 0 if the friend has no avatar
+
+The file id of an avatar is its hash. Avatars stored already are taken
+from the store and the transfer is cancelled.
+*/
+void ToxTransfers::receiveAvatar(Tox* tox, quint32 friendNo, quint32 fileNo,
+                                 quint64 size)
+{
+    const QByteArray publicKey =
+            ToxerPrivate::pk(tox, static_cast<int>(friendNo));
+    QByteArray hash(TOX_FILE_ID_LENGTH, 0);
+    if (!tox_file_get_file_id(tox, friendNo, fileNo,
+                              reinterpret_cast<uint8_t*>(hash.data()),
+                              nullptr))
+    {
+        hash.clear();
+    }
+
+    if (size == 0 || size > ToxAvatars::MaxSize ||
+        ToxAvatars::instance().contains(hash))
+    {
+        tox_file_control(tox, friendNo, fileNo, TOX_FILE_CONTROL_CANCEL,
+                         nullptr);
+        if (size <= ToxAvatars::MaxSize) {
+            avatarChanged(friendNo, publicKey,
+                          size == 0 ? QByteArray() : hash);
+        }
+        return;
+    }
+
+    Avatar a;
+    a.publicKey = publicKey;
+    a.size = size;
+    a.data.reserve(static_cast<int>(size));
+
+    QMutexLocker lock(&mutex_);
+    avatars_.insert(transferId(friendNo, fileNo), a);
+    lock.unlock();
+
+    tox_file_control(tox, friendNo, fileNo, TOX_FILE_CONTROL_RESUME, nullptr);
+}
+
+/**
+@brief Records the avatar of a friend and tells the observers.
+@param[in] friendNo     the friend number
+@param[in] publicKey    the public key of the friend
+@param[in] hash         the hash of the avatar; empty for no avatar
+*/
+void ToxTransfers::avatarChanged(quint32 friendNo,
+                                 const QByteArray& publicKey,
+                                 const QByteArray& hash)
+{
+    if (!ToxAvatars::instance().setAvatar(publicKey, hash)) {
+        return;
+    }
+
+    const int index = static_cast<int>(friendNo);
+    for (auto n : profile_->friendNotifiers) {
+        n->on_avatar_changed(index);
+    }
+}
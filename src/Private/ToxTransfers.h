@@ -0,0 +1,174 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef TOXER_PRIVATE_TOXTRANSFERS_H
+#define TOXER_PRIVATE_TOXTRANSFERS_H
+
+#include "ToxFileWriter.h"
+
+#include <tox/tox.h>
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QQueue>
+#include <QSet>
+#include <QString>
+
+class QFile;
+class ToxProfilePrivate;
+
+class ToxTransfers final
+{
+public:
+    static constexpr quint64 ReadAhead = 1024 * 1024;
+    static constexpr int CoalesceSize = 512 * 1024;
+    static constexpr quint64 MaxBacklog = 32 * 1024 * 1024;
+    static constexpr quint64 Quantum = 16 * 1024;
+    static constexpr quint64 MaxInFlight = 32 * 1024;
+    static constexpr qint64 BurstWindow = 100;
+    static constexpr qint64 MaxChunkSize = 1371;
+    static constexpr qint64 ReportInterval = 250;
+    static constexpr unsigned long BusyInterval = 2;
+
+public:
+    static constexpr qint64 capacity(qint64 rate) {
+        return qMax(rate * BurstWindow, MaxChunkSize * 1000);
+    }
+
+public:
+    explicit ToxTransfers(ToxProfilePrivate* profile);
+    ~ToxTransfers();
+
+    quint32 send(Tox* tox, quint32 friendNo, const QString& fileName);
+    bool accept(Tox* tox, quint32 friendNo, quint32 fileNo,
+                const QString& fileName);
+    void cancel(Tox* tox, quint32 friendNo, quint32 fileNo);
+    bool isBusy() const;
+    void poll(Tox* tox);
+    void schedule(Tox* tox);
+    void interactive();
+    void setRateLimits(quint64 total, quint64 perFriend);
+    int queueDepth() const;
+    int queueDepth(quint32 friendNo) const;
+
+    void chunkRequest(Tox* tox, quint32 friendNo, quint32 fileNo,
+                      quint64 position, size_t length);
+    void receive(Tox* tox, quint32 friendNo, quint32 fileNo, quint32 kind,
+                 quint64 size, const QString& name);
+    void chunkReceived(Tox* tox, quint32 friendNo, quint32 fileNo,
+                       quint64 position, const uint8_t* data, size_t length);
+    void control(quint32 friendNo, quint32 fileNo, TOX_FILE_CONTROL control);
+    void friendOffline(quint32 friendNo);
+    void abortAll();
+
+private:
+    struct Progress {
+        quint64 size = 0;
+        quint64 sent = 0;
+        QElapsedTimer clock;
+        qint64 lastReport = 0;
+        quint64 lastSent = 0;
+        quint64 rate = 0;
+    };
+
+    struct Chunk {
+        quint64 position;
+        size_t length;
+    };
+
+    struct Outgoing : Progress {
+        QFile* file = nullptr;
+        const uint8_t* data = nullptr;
+        quint64 advised = 0;
+        QQueue<Chunk> requests;
+        quint64 deficit = 0;
+    };
+
+    struct Avatar {
+        QByteArray publicKey;
+        QByteArray data;
+        quint64 size = 0;
+    };
+
+    struct Bucket {
+        quint64 rate = 0;
+        qint64 tokens = 0;
+        qint64 last = 0;
+    };
+
+    struct Incoming : Progress {
+        QByteArray journalKey;
+        QByteArray buffer;
+        quint64 bufferPos = 0;
+        bool accepted = false;
+        bool paused = false;
+    };
+
+private:
+    bool serve(Tox* tox, quint64 id, Outgoing& t, Bucket& limit,
+               quint64& inFlight, bool* blocked);
+    void advise(Outgoing& t, quint64 position);
+    void flush(quint64 id, Incoming& t);
+    void report(quint64 id, Progress& t, bool force);
+    void finish(quint64 id, bool completed);
+    void finishIncoming(quint64 id, ToxFileWriter::Outcome outcome);
+    void collectResults(Tox* tox);
+    void notifyFinished(quint64 id, bool completed);
+    void receiveAvatar(Tox* tox, quint32 friendNo, quint32 fileNo,
+                       quint64 size);
+    void avatarChanged(quint32 friendNo, const QByteArray& publicKey,
+                       const QByteArray& hash);
+    void notifyStarted(quint64 id, const QString& name, quint64 size,
+                       bool incoming);
+
+    static void refill(Bucket& b, qint64 now);
+    static bool allows(const Bucket& b, size_t length);
+    static void consume(Bucket& b, size_t length);
+
+    static inline quint64 transferId(quint32 friendNo, quint32 fileNo) {
+        return (static_cast<quint64>(friendNo) << 32) | fileNo;
+    }
+
+private:
+    ToxProfilePrivate* profile_;
+    mutable QMutex mutex_;
+    QHash<quint64, Outgoing> outgoing_;
+    QHash<quint64, Incoming> incoming_;
+    QHash<quint64, Avatar> avatars_;
+    QSet<quint64> completing_;
+    QList<quint64> active_;
+    QElapsedTimer clock_;
+    Bucket total_;
+    quint64 friendRate_;
+    QHash<quint32, Bucket> friends_;
+    QAtomicInt interactive_;
+    QAtomicInt paused_;
+    ToxFileWriter writer_;
+};
+
+#endif
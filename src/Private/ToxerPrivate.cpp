@@ -26,6 +26,8 @@
 
 #include "ToxerPrivate.h"
 
+#include <QSaveFile>
+
 /**
 @class ToxerPrivate
 
@@ -43,6 +45,11 @@
 @return the public key as raw data or an empty byte array
 
 The profile's public key can be returned by passing -1 as the friendIndex.
+
+
+@fn ToxerPrivate::profilePath
+@brief Absolute path to the file of a Tox profile.
+@param[in] profileName  the profile name
 */
 
 /**
@@ -98,6 +105,42 @@ bool ToxerPrivate::isEncrypted(const char* data)
     return tox_is_data_encrypted(c_data);
 }
 
+/**
+@brief Atomically replaces a cache file with the given data.
+@param[in] fileName     the file to replace
+@param[in] data         the new file content
+@return true on success; false otherwise
+
+Unlike ToxProfileSaver::write, the file is not synced to disk. A crash may
+lose the new content, which a cache recreates, but never leaves a partial
+file behind.
+*/
+bool ToxerPrivate::writeCache(const QString& fileName, const QByteArray& data)
+{
+    QSaveFile f(fileName);
+    if (!f.open(QIODevice::WriteOnly) || f.write(data) != data.length() ||
+        !f.commit())
+    {
+        qWarning("Failed to write cache file %s: %s",
+                 qUtf8Printable(fileName), qUtf8Printable(f.errorString()));
+        return false;
+    }
+    return true;
+}
+
+/**
+@brief Derives an encryption key from a passphrase.
+@param[in] data     the passphrase
+@param[in] len      the passphrase length
+@param[in] salt     the salt; pass nullptr to generate a random salt
+@return the derived key or nullptr on failure
+
+Key derivation is deliberately expensive. Derive a key once and keep the
+returned pointer for as long as the key is needed.
+
+@note Tox_Pass_Key is opaque and allocated by toxcore, so its memory is not
+locked here; only toxcore knows its size.
+*/
 ToxerPrivate::PassKeyPtr ToxerPrivate::createKey(const char* data, int len,
                                                  const char* salt)
 {
@@ -107,6 +150,11 @@ ToxerPrivate::PassKeyPtr ToxerPrivate::createKey(const char* data, int len,
     Tox_Pass_Key* k =
             salt ? tox_pass_key_derive_with_salt(c_data, c_len, c_salt, nullptr)
                  : tox_pass_key_derive(c_data, c_len, nullptr);
+    if (!k) {
+        qWarning("Key derivation failed!");
+        return {};
+    }
+
     return PassKeyPtr(k, tox_pass_key_free);
 }
 
@@ -156,24 +204,58 @@ QByteArray ToxerPrivate::decrypt(const char* encrypted, int len,
 }
 
 /**
-@brief Decrypts a data array using a salted encryption key.
+@brief Derives the encryption key of an encrypted data array.
+@param[in] password     the password
+@param[in] encrypted    the encrypted data providing the salt
+@return the derived key
 
 The encryption key is generated from the UTF-8 encoded password.
 */
-QByteArray ToxerPrivate::decrypt(const char* encrypted, int len,
-                                 const QString& password)
+ToxerPrivate::PassKeyPtr ToxerPrivate::createKey(const QString& password,
+                                                 const char* encrypted)
 {
     char salt[TOX_PASS_SALT_LENGTH];
     const uint8_t* c_encrypted = reinterpret_cast<const uint8_t*>(encrypted);
     uint8_t* c_salt = reinterpret_cast<uint8_t*>(salt);
     tox_get_salt(c_encrypted, c_salt, nullptr);
 
-    const QByteArray pw = password.toUtf8();
-    const ToxerPrivate::PassKeyPtr generated_key = createKey(pw.constData(),
-                                                             pw.length(),
-                                                             salt);
+    QByteArray pw = password.toUtf8();
+    const PassKeyPtr key = createKey(pw.constData(), pw.length(), salt);
+    pw.fill('\0');
+    return key;
+}
+
+/**
+@brief Decrypts a data array into secure memory.
+@param[in] encrypted    the encrypted data
+@param[in] len          the length of the encrypted data
+@param[in] key          the encryption key
+@return the decrypted data or a null buffer on failure
+
+The plain data is written straight into a SecureBuffer and never touches
+unprotected memory.
+*/
+SecureBuffer ToxerPrivate::decryptSecure(const uint8_t* encrypted, size_t len,
+                                         const PassKeyPtr key)
+{
+    if (len < TOX_PASS_ENCRYPTION_EXTRA_LENGTH) {
+        qWarning("Decryption failed!");
+        return {};
+    }
+
+    SecureBuffer decrypted(len - TOX_PASS_ENCRYPTION_EXTRA_LENGTH);
+    if (decrypted.isNull()) {
+        return {};
+    }
+
+    if (!tox_pass_key_decrypt(key.get(), encrypted, len, decrypted.data(),
+                              nullptr))
+    {
+        qWarning("Decryption failed!");
+        return {};
+    }
 
-    return decrypt(encrypted, len, generated_key);
+    return decrypted;
 }
 
 /**
@@ -236,3 +318,31 @@ TOX_USER_STATUS ToxerPrivate::toTox(ToxTypes::UserStatus enumeration)
     assert(false);
     return TOX_USER_STATUS_AWAY;
 }
+
+/**
+@brief conversion from Tox to Qt
+*/
+ToxTypes::MessageType ToxerPrivate::fromTox(TOX_MESSAGE_TYPE enumeration)
+{
+    switch (enumeration) {
+    case TOX_MESSAGE_TYPE_NORMAL: return ToxTypes::MessageType::Normal;
+    case TOX_MESSAGE_TYPE_ACTION: return ToxTypes::MessageType::Action;
+    }
+
+    assert(false);
+    return ToxTypes::MessageType::Normal;
+}
+
+/**
+@brief conversion from Qt to Tox
+*/
+TOX_MESSAGE_TYPE ToxerPrivate::toTox(ToxTypes::MessageType enumeration)
+{
+    switch (enumeration) {
+    case ToxTypes::MessageType::Normal: return TOX_MESSAGE_TYPE_NORMAL;
+    case ToxTypes::MessageType::Action: return TOX_MESSAGE_TYPE_ACTION;
+    }
+
+    assert(false);
+    return TOX_MESSAGE_TYPE_NORMAL;
+}
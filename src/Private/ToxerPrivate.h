@@ -27,6 +27,8 @@
 #ifndef TOXER_PRIVATE_H
 #define TOXER_PRIVATE_H
 
+#include "SecureBuffer.h"
+
 #include <ToxTypes.h>
 
 #include <tox/tox.h>
@@ -70,6 +72,12 @@ public:
                 QStringLiteral("/tox");
     }
 
+    inline static QString profilePath(const QString& profileName)
+    {
+        return profilesDir() % QStringLiteral("/") % profileName %
+                QStringLiteral(".tox");
+    }
+
     inline static QByteArray pk(const Tox* tox, int friendIndex)
     {
         if (tox) {
@@ -95,13 +103,16 @@ public:
 public:
     static const char* toxErrStr(int err, ToxContext ctx = ToxContext::Common);
     static bool isEncrypted(const char* data);
+    static bool writeCache(const QString& fileName, const QByteArray& data);
     static PassKeyPtr createKey(const char* data, int len, const char* salt);
+    static PassKeyPtr createKey(const QString& password,
+                                const char* encrypted);
     static QByteArray encrypt(const char* rawData, int len,
                               const PassKeyPtr key);
     static QByteArray decrypt(const char* encrypted, int len,
                               const PassKeyPtr key);
-    static QByteArray decrypt(const char* encrypted, int len,
-                              const QString& password);
+    static SecureBuffer decryptSecure(const uint8_t* encrypted, size_t len,
+                                      const PassKeyPtr key);
 
 public:
     static ToxTypes::Proxy fromTox(TOX_PROXY_TYPE enumeration);
@@ -112,6 +123,9 @@ public:
 
     static ToxTypes::UserStatus fromTox(TOX_USER_STATUS enumeration);
     static TOX_USER_STATUS toTox(ToxTypes::UserStatus enumeration);
+
+    static ToxTypes::MessageType fromTox(TOX_MESSAGE_TYPE enumeration);
+    static TOX_MESSAGE_TYPE toTox(ToxTypes::MessageType enumeration);
 };
 
 #endif
@@ -26,8 +26,46 @@
 
 #include "Settings.h"
 
-QVector<ToxSettings*> ToxSettings::notifiers = {};
-QVector<UiSettings*> UiSettings::notifiers = {};
+#include <Private/SettingsStore.h>
+
+namespace {
+
+template<typename O, typename A, typename T>
+inline void emitChanged(O* o, void (O::*signal)(A), const T& value)
+{
+    emit (o->*signal)(static_cast<typename std::decay<A>::type>(value));
+}
+
+template<typename O>
+struct Notify
+{
+    O* object;
+    const SettingsStore* store;
+    int id;
+
+    template<typename S>
+    void operator()(S) const
+    {
+        if (S::id() == id) {
+            emitChanged(object, S::signal(), store->get<S>());
+        }
+    }
+};
+
+}
+
+/**
+@class Settings
+@brief Base class of the Toxer settings.
+
+All instances of a scope share a SettingsStore, which keeps the settings in
+memory and writes changes to the file in the background. Constructing and
+reading settings is cheap therefore. Changes made through any instance are
+reported by the signals of all instances of the scope.
+
+The keys, types, defaults and signals of the settings are declared in the
+SettingsSchema.
+*/
 
 void Settings::registerQmlTypes()
 {
@@ -36,8 +74,9 @@ void Settings::registerQmlTypes()
     qmlRegisterType<UiSettings>(qmlModule, 1, 0, "UiSettings");
 }
 
-Settings::Settings(QSettings::Scope scope, const QString& filename)
-    : QSettings(QSettings::IniFormat, scope, QStringLiteral("Toxer"), filename)
+Settings::Settings(QSettings::Scope scope)
+    : QObject()
+    , store_(SettingsStore::instance(scope))
 {
     switch (scope) {
     case QSettings::SystemScope:
@@ -52,106 +91,167 @@ Settings::Settings(QSettings::Scope scope, const QString& filename)
 ToxSettings::ToxSettings(QSettings::Scope scope)
     : Settings(scope)
 {
-    ToxSettings::notifiers.append(this);
+    connect(store_, &SettingsStore::changed, this, &ToxSettings::notify);
 }
 
 ToxSettings::~ToxSettings()
 {
-    ToxSettings::notifiers.removeAll(this);
+}
+
+/**
+@brief Emits the change signal of a setting.
+@param[in] id   the SettingsSchema::Id of the setting
+*/
+void ToxSettings::notify(int id)
+{
+    Notify<ToxSettings> n = { this, store_, id };
+    SettingsSchema::forEach(SettingsSchema::ToxSettingsList(), n);
 }
 
 bool ToxSettings::ipv6_enabled() const {
-    return value(QLatin1String("tox/ipv6_enabled"), true).toBool();
+    return store_->get<SettingsSchema::Ipv6Enabled>();
 }
 
 void ToxSettings::set_ipv6_enabled(bool enabled) {
-    if (set(QLatin1String("tox/ipv6_enabled"), enabled, ipv6_enabled())) {
-        foreach (ToxSettings* n, ToxSettings::notifiers) {
-            emit n->ipv6_enabled_changed(enabled);
-        }
-    }
+    store_->set<SettingsSchema::Ipv6Enabled>(enabled);
 }
 
 bool ToxSettings::udp_enabled() const {
-    return value(QLatin1String("tox/udp_enabled"), false).toBool();
+    return store_->get<SettingsSchema::UdpEnabled>();
 }
 
 void ToxSettings::set_udp_enabled(bool enabled) {
-    if (set(QLatin1String("tox/udp_enabled"), enabled, udp_enabled())) {
-        foreach (ToxSettings* n, ToxSettings::notifiers) {
-            emit n->udp_enabled_changed(enabled);
-        }
-    }
+    store_->set<SettingsSchema::UdpEnabled>(enabled);
 }
 
 ToxTypes::Proxy ToxSettings::proxy_type() const {
-    return value(QLatin1String("tox/proxy_type"),
-                 ToxTypes::toQVariant(ToxTypes::Proxy::None))
-            .value<ToxTypes::Proxy>();
+    return store_->get<SettingsSchema::ProxyType>();
 }
 
 void ToxSettings::set_proxy_type(ToxTypes::Proxy type) {
-    if (set(QLatin1String("tox/proxy_type"), ToxTypes::toQVariant(type),
-            ToxTypes::toQVariant(proxy_type())))
-    {
-        foreach (ToxSettings* n, ToxSettings::notifiers) {
-            emit proxy_type_changed(type);
-        }
-    }
+    store_->set<SettingsSchema::ProxyType>(type);
 }
 
 quint16 ToxSettings::proxy_port() const {
-    return static_cast<quint16>(
-                value(QLatin1String("tox/proxy_port"), 0).toUInt());
+    return store_->get<SettingsSchema::ProxyPort>();
 }
 
 void ToxSettings::set_proxy_port(quint16 port) {
-    if (set(QLatin1String("tox/proxy_port"), port, proxy_port())) {
-        foreach (ToxSettings* n, ToxSettings::notifiers) {
-            emit n->proxy_port_changed(port);
-        }
-    }
+    store_->set<SettingsSchema::ProxyPort>(port);
 }
 
 QString ToxSettings::proxy_addr() const {
-    return value(QLatin1String("tox/proxy_addr")).toString();
+    return store_->get<SettingsSchema::ProxyAddr>();
 }
 
 void ToxSettings::set_proxy_addr(const QString& ip) {
-    if (set(QLatin1String("tox/proxy_addr"), ip, proxy_addr())) {
-        foreach (ToxSettings* n, ToxSettings::notifiers) {
-            emit n->proxy_addr_changed(ip);
-        }
-    }
+    store_->set<SettingsSchema::ProxyAddr>(ip);
+}
+
+/**
+@brief Returns the number of closed profiles kept online in standby.
+@return the number of standby profiles; 0 disables standby
+*/
+quint8 ToxSettings::standby_profiles() const {
+    return store_->get<SettingsSchema::StandbyProfiles>();
+}
+
+void ToxSettings::set_standby_profiles(quint8 count) {
+    store_->set<SettingsSchema::StandbyProfiles>(count);
+}
+
+/**
+@brief Returns the rate limit of all outgoing file transfers.
+@return the limit in KiB per second; 0 for no limit
+*/
+quint32 ToxSettings::transfer_rate_limit() const {
+    return store_->get<SettingsSchema::TransferRateLimit>();
+}
+
+void ToxSettings::set_transfer_rate_limit(quint32 kibPerSecond) {
+    store_->set<SettingsSchema::TransferRateLimit>(kibPerSecond);
+}
+
+/**
+@brief Returns the rate limit of the outgoing file transfers to a friend.
+@return the limit in KiB per second; 0 for no limit
+*/
+quint32 ToxSettings::friend_rate_limit() const {
+    return store_->get<SettingsSchema::FriendRateLimit>();
+}
+
+void ToxSettings::set_friend_rate_limit(quint32 kibPerSecond) {
+    store_->set<SettingsSchema::FriendRateLimit>(kibPerSecond);
+}
+
+/**
+@brief Returns the audio source of calls.
+@return "default" or "device:<name>" for an audio device, "null" for
+silence or "wav:<file>" to play a WAV file in a loop
+@see ToxAudio::createSource
+*/
+QString ToxSettings::audio_input() const {
+    return store_->get<SettingsSchema::AudioInput>();
+}
+
+void ToxSettings::set_audio_input(const QString& device) {
+    store_->set<SettingsSchema::AudioInput>(device);
+}
+
+/**
+@brief Returns the audio sink of calls.
+@return "default" or "device:<name>" for an audio device, "null" to discard
+the audio or "wav:<file>" to record it
+@see ToxAudio::createSink
+*/
+QString ToxSettings::audio_output() const {
+    return store_->get<SettingsSchema::AudioOutput>();
+}
+
+void ToxSettings::set_audio_output(const QString& device) {
+    store_->set<SettingsSchema::AudioOutput>(device);
+}
+
+/**
+@brief Returns the audio sink of notification sounds.
+@return a device string like audio_output(); "null" disables the sounds
+*/
+QString ToxSettings::notification_output() const {
+    return store_->get<SettingsSchema::NotificationOutput>();
+}
+
+void ToxSettings::set_notification_output(const QString& device) {
+    store_->set<SettingsSchema::NotificationOutput>(device);
 }
 
 UiSettings::UiSettings(QSettings::Scope scope)
     : Settings(scope)
 {
-    UiSettings::notifiers.append(this);
+    connect(store_, &SettingsStore::changed, this, &UiSettings::notify);
 }
 
 UiSettings::~UiSettings()
 {
-    UiSettings::notifiers.removeAll(this);
+}
+
+/**
+@brief Emits the change signal of a setting.
+@param[in] id   the SettingsSchema::Id of the setting
+*/
+void UiSettings::notify(int id)
+{
+    Notify<UiSettings> n = { this, store_, id };
+    SettingsSchema::forEach(SettingsSchema::UiSettingsList(), n);
 }
 
 UiSettings::AppLayout UiSettings::app_layout() const
 {
-    QVariant v = value(QLatin1String("ui/app_layout"),
-                       ToxTypes::enumKey(AppLayout::Split));
-    return ToxTypes::enumValue<AppLayout>(v.toByteArray());
+    return store_->get<SettingsSchema::AppLayout>();
 }
 
 void UiSettings::set_app_layout(UiSettings::AppLayout layout)
 {
-    if (set(QLatin1String("ui/app_layout"), ToxTypes::enumKey(layout),
-            ToxTypes::enumKey(app_layout())))
-    {
-        foreach (UiSettings* n, UiSettings::notifiers) {
-            emit n->appLayoutChanged(static_cast<quint8>(layout));
-        }
-    }
+    store_->set<SettingsSchema::AppLayout>(layout);
 }
 
 quint8 UiSettings::app_layout_int() const
@@ -166,28 +266,20 @@ void UiSettings::set_app_layout(quint8 layout)
 
 bool UiSettings::fullscreen() const
 {
-    return value(QLatin1String("ui/fullscreen")).toBool();
+    return store_->get<SettingsSchema::Fullscreen>();
 }
 
 void UiSettings::set_fullscreen(bool enabled)
 {
-    if (set(QLatin1String("ui/fullscreen"), enabled, fullscreen())) {
-        foreach (UiSettings* n, UiSettings::notifiers) {
-            emit n->fullscreenChanged(enabled);
-        }
-    }
+    store_->set<SettingsSchema::Fullscreen>(enabled);
 }
 
 QRect UiSettings::geometry() const
 {
-    return value(QLatin1String("ui/geometry")).toRect();
+    return store_->get<SettingsSchema::Geometry>();
 }
 
 void UiSettings::set_geometry(const QRect& rect)
 {
-    if (set(QLatin1String("ui/geometry"), rect, geometry())) {
-        foreach (UiSettings* n, UiSettings::notifiers) {
-            emit geometryChanged(rect);
-        }
-    }
+    store_->set<SettingsSchema::Geometry>(rect);
 }
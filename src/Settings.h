@@ -31,34 +31,26 @@
 
 #include <QSettings>
 #include <QRect>
-#include <QVector>
 
-class Settings : public QSettings
+class SettingsStore;
+
+class Settings : public QObject
 {
 public:
     static void registerQmlTypes();
 
 protected:
-    Settings(Scope scope, const QString& filename = QStringLiteral("Settings"));
-
-    inline bool set(const QLatin1String& key, const QVariant& newValue,
-                    const QVariant& oldValue)
-    {
-        if (newValue == oldValue) {
-            // unchanged
-            return false;
-        } else {
-            setValue(key, newValue);
-            return true;
-        }
-    }
+    Settings(QSettings::Scope scope);
+
+protected:
+    SettingsStore* store_;
 };
 
 class ToxSettings : public Settings
 {
     Q_OBJECT
 public:
-    ToxSettings(Scope scope = UserScope);
+    ToxSettings(QSettings::Scope scope = QSettings::UserScope);
     ~ToxSettings();
 
     Q_INVOKABLE bool ipv6_enabled() const;
@@ -76,15 +68,39 @@ public:
     Q_INVOKABLE QString proxy_addr() const;
     Q_INVOKABLE void set_proxy_addr(const QString& ip);
 
+    Q_INVOKABLE quint8 standby_profiles() const;
+    Q_INVOKABLE void set_standby_profiles(quint8 count);
+
+    Q_INVOKABLE quint32 transfer_rate_limit() const;
+    Q_INVOKABLE void set_transfer_rate_limit(quint32 kibPerSecond);
+
+    Q_INVOKABLE quint32 friend_rate_limit() const;
+    Q_INVOKABLE void set_friend_rate_limit(quint32 kibPerSecond);
+
+    Q_INVOKABLE QString audio_input() const;
+    Q_INVOKABLE void set_audio_input(const QString& device);
+
+    Q_INVOKABLE QString audio_output() const;
+    Q_INVOKABLE void set_audio_output(const QString& device);
+
+    Q_INVOKABLE QString notification_output() const;
+    Q_INVOKABLE void set_notification_output(const QString& device);
+
 signals:
     void ipv6_enabled_changed(bool);
     void udp_enabled_changed(bool);
     void proxy_type_changed(ToxTypes::Proxy);
     void proxy_port_changed(quint16);
     void proxy_addr_changed(QString);
-
-private:
-    static QVector<ToxSettings*> notifiers;
+    void standby_profiles_changed(quint8);
+    void transfer_rate_limit_changed(quint32);
+    void friend_rate_limit_changed(quint32);
+    void audio_input_changed(QString);
+    void audio_output_changed(QString);
+    void notification_output_changed(QString);
+
+private slots:
+    void notify(int id);
 };
 
 class UiSettings : public Settings
@@ -95,7 +111,7 @@ public:
     Q_ENUM(AppLayout)
 
 public:
-    UiSettings(Scope scope = UserScope);
+    UiSettings(QSettings::Scope scope = QSettings::UserScope);
     ~UiSettings();
 
     UiSettings::AppLayout app_layout() const;
@@ -114,8 +130,8 @@ signals:
     void fullscreenChanged(bool fullscreen);
     void geometryChanged(const QRect& rect);
 
-private:
-    static QVector<UiSettings*> notifiers;
+private slots:
+    void notify(int id);
 };
 
 #endif
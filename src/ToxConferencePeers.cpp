@@ -0,0 +1,278 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include "ToxConferencePeers.h"
+
+#include <Private/ToxProfile.h>
+
+#include <algorithm>
+#include <functional>
+
+/**
+@class ToxConferencePeers
+@brief Model of the peers of a conference.
+
+The model is filled from the peer table of the profile once and then
+follows the changes reported by ToxConferenceQuery. A change carries the
+added and removed peers only, so joins and leaves in a large conference
+update a few rows instead of resetting the model. Removed peers are taken
+out in contiguous ranges and added peers are appended in one batch. The
+rows are found through a hash of the public keys.
+
+Changes arrive queued from the event loop, some of them may already be
+part of the initial table. Applying a change twice has no effect therefore.
+
+The peers are kept in the order they joined. Sort them with a proxy model,
+if needed.
+
+
+@enum ToxConferencePeers::Roles
+@brief The model roles exposed to QML.
+@var PublicKeyRole  the public key of the peer as hex string
+@var NameRole       the name of the peer
+
+
+@fn ToxConferencePeers::conferenceChanged
+@brief Emitted when the model shows another conference.
+
+
+@fn ToxConferencePeers::countChanged
+@brief Emitted when peers were added or removed.
+*/
+
+/**
+@brief constructor
+*/
+ToxConferencePeers::ToxConferencePeers(QObject* parent)
+    : QAbstractListModel(parent)
+    , conference_(-1)
+{
+    connect(&query_, &ToxConferenceQuery::peersChanged,
+            this, &ToxConferencePeers::applyDiff, Qt::QueuedConnection);
+    connect(&query_, &ToxConferenceQuery::peerNameChanged,
+            this, &ToxConferencePeers::rename, Qt::QueuedConnection);
+}
+
+/**
+@brief Returns the conference index shown by the model.
+@return the conference index; -1 for none
+*/
+int ToxConferencePeers::conference() const
+{
+    return conference_;
+}
+
+/**
+@brief Shows the peers of a conference.
+@param[in] index    the conference index
+*/
+void ToxConferencePeers::setConference(int index)
+{
+    if (conference_ != index) {
+        conference_ = index;
+        reload();
+        emit conferenceChanged();
+    }
+}
+
+/**
+@brief Returns the number of peers.
+*/
+int ToxConferencePeers::count() const
+{
+    return peers_.count();
+}
+
+int ToxConferencePeers::rowCount(const QModelIndex& parent) const
+{
+    return parent.isValid() ? 0 : peers_.count();
+}
+
+QVariant ToxConferencePeers::data(const QModelIndex& index, int role) const
+{
+    if (!index.isValid() || index.row() >= peers_.count()) {
+        return {};
+    }
+
+    const Peer& p = peers_.at(index.row());
+    switch (role) {
+    case Qt::DisplayRole:
+    case NameRole: return p.name;
+    case PublicKeyRole: return p.key;
+    }
+
+    return {};
+}
+
+QHash<int, QByteArray> ToxConferencePeers::roleNames() const
+{
+    return {
+        { PublicKeyRole, QByteArrayLiteral("publicKey") },
+        { NameRole, QByteArrayLiteral("name") }
+    };
+}
+
+/**
+@brief Applies a change of the peer list.
+@param[in] index    the conference index
+@param[in] added    the public keys of the added peers
+@param[in] names    the names of the added peers
+@param[in] removed  the public keys of the removed peers
+*/
+void ToxConferencePeers::applyDiff(int index, const QStringList& added,
+                                   const QStringList& names,
+                                   const QStringList& removed)
+{
+    if (index != conference_) {
+        return;
+    }
+
+    const int oldCount = peers_.count();
+
+    QVector<int> rows;
+    rows.reserve(removed.count());
+    for (const QString& key : removed) {
+        const auto it = rows_.constFind(key);
+        if (it != rows_.constEnd()) {
+            rows << *it;
+        }
+    }
+    dropRows(rows);
+
+    QVector<Peer> append;
+    for (int i = 0; i < added.count(); ++i) {
+        const QString& key = added.at(i);
+        const QString& name = names.value(i);
+        const auto it = rows_.constFind(key);
+        if (it == rows_.constEnd()) {
+            rows_.insert(key, peers_.count() + append.count());
+            append.append({ key, name });
+        } else if (*it < peers_.count()) {
+            rename(index, key, name);
+        }
+    }
+
+    if (!append.isEmpty()) {
+        const int first = peers_.count();
+        beginInsertRows({}, first, first + append.count() - 1);
+        peers_ += append;
+        endInsertRows();
+    }
+
+    if (oldCount != peers_.count()) {
+        emit countChanged();
+    }
+}
+
+/**
+@brief Applies the new name of a peer.
+@param[in] index    the conference index
+@param[in] peerKey  the public key of the peer
+@param[in] name     the new name
+*/
+void ToxConferencePeers::rename(int index, const QString& peerKey,
+                                const QString& name)
+{
+    if (index != conference_) {
+        return;
+    }
+
+    const auto it = rows_.constFind(peerKey);
+    if (it != rows_.constEnd() && peers_.at(*it).name != name) {
+        peers_[*it].name = name;
+        const QModelIndex i = this->index(*it);
+        emit dataChanged(i, i, { Qt::DisplayRole, NameRole });
+    }
+}
+
+/**
+@brief Fills the model from the peer table of the profile.
+*/
+void ToxConferencePeers::reload()
+{
+    beginResetModel();
+    peers_.clear();
+    rows_.clear();
+
+    const ToxProfilePrivate* p = ToxProfilePrivate::current();
+    if (p && conference_ >= 0) {
+        const auto peers = p->conferencePeers(conference_);
+        peers_.reserve(peers.count());
+        rows_.reserve(peers.count());
+        for (const auto& peer : peers) {
+            const QString key = QString::fromLatin1(peer.first.toHex());
+            rows_.insert(key, peers_.count());
+            peers_.append({ key, peer.second });
+        }
+    }
+    endResetModel();
+
+    emit countChanged();
+}
+
+/**
+@brief Removes rows in contiguous ranges.
+@param[in] rows     the rows to remove in any order
+*/
+void ToxConferencePeers::dropRows(QVector<int> rows)
+{
+    if (rows.isEmpty()) {
+        return;
+    }
+
+    for (int row : rows) {
+        rows_.remove(peers_.at(row).key);
+    }
+
+    std::sort(rows.begin(), rows.end(), std::greater<int>());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+    int i = 0;
+    while (i < rows.count()) {
+        const int last = rows.at(i);
+        int first = last;
+        while (++i < rows.count() && rows.at(i) == first - 1) {
+            first--;
+        }
+
+        beginRemoveRows({}, first, last);
+        peers_.remove(first, last - first + 1);
+        endRemoveRows();
+    }
+
+    reindex(rows.last());
+}
+
+/**
+@brief Updates the row hash from a row on.
+@param[in] from     the first row that moved
+*/
+void ToxConferencePeers::reindex(int from)
+{
+    for (int row = from; row < peers_.count(); ++row) {
+        rows_[peers_.at(row).key] = row;
+    }
+}
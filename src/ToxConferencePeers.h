@@ -0,0 +1,92 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef TOXER_TOXCONFERENCEPEERS_H
+#define TOXER_TOXCONFERENCEPEERS_H
+
+#include "Toxer.h"
+
+#include <QAbstractListModel>
+#include <QHash>
+#include <QVector>
+
+class ToxConferencePeers final : public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(int conference
+               READ conference
+               WRITE setConference
+               NOTIFY conferenceChanged)
+    Q_PROPERTY(int count
+               READ count
+               NOTIFY countChanged)
+
+public:
+    enum Roles {
+        PublicKeyRole = Qt::UserRole + 1,
+        NameRole
+    };
+
+public:
+    explicit ToxConferencePeers(QObject* parent = nullptr);
+
+    int conference() const;
+    void setConference(int index);
+    int count() const;
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+signals:
+    void conferenceChanged();
+    void countChanged();
+
+private slots:
+    void applyDiff(int index, const QStringList& added,
+                   const QStringList& names, const QStringList& removed);
+    void rename(int index, const QString& peerKey, const QString& name);
+
+private:
+    struct Peer {
+        QString key;
+        QString name;
+    };
+
+private:
+    void reload();
+    void dropRows(QVector<int> rows);
+    void reindex(int from);
+
+private:
+    ToxConferenceQuery query_;
+    int conference_;
+    QVector<Peer> peers_;
+    QHash<QString, int> rows_;
+};
+
+#endif
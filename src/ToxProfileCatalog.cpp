@@ -0,0 +1,293 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "ToxProfileCatalog.h"
+
+#include <Private/ToxerPrivate.h>
+
+#include <QDir>
+#include <QFile>
+
+#include <algorithm>
+
+/**
+@class ToxProfileCatalog
+@brief Model of the Tox profiles found in the profiles directory.
+
+The catalog scans the profiles directory once and then keeps itself up to
+date through a file system watcher (inotify on Linux). The directory is
+watched for added and removed profiles and each profile file is watched for
+changes of its own.
+
+Saving a profile creates and renames a temporary file next to it every few
+seconds. These changes of the directory are debounced and the directory is
+merged again only if the set of profile names changed, so temporary files
+never cause a full rescan. A changed profile file refreshes its own entry.
+The encryption header is probed again only if the file size changed, as
+encrypting or decrypting a profile always changes its size.
+
+
+@enum ToxProfileCatalog::Roles
+@brief The model roles exposed to QML.
+@var NameRole       the profile name (the base name of the '.tox' file)
+@var SizeRole       the file size in bytes
+@var ModifiedRole   the last modification time
+@var EncryptedRole  true for password protected profiles
+
+
+@var ToxProfileCatalog::RescanDelay
+@brief Delay in milliseconds before the directory is merged again.
+
+
+@fn ToxProfileCatalog::countChanged
+@brief Emitted when profiles were added or removed.
+*/
+
+constexpr int ToxProfileCatalog::RescanDelay;
+
+/**
+@brief Returns the process wide profile catalog.
+@return the catalog instance
+*/
+ToxProfileCatalog* ToxProfileCatalog::instance()
+{
+    static ToxProfileCatalog catalog;
+    return &catalog;
+}
+
+/**
+@brief constructor
+
+Watches the profiles directory and performs the initial scan.
+*/
+ToxProfileCatalog::ToxProfileCatalog()
+    : QAbstractListModel()
+{
+    const QString dir = ToxerPrivate::profilesDir();
+    QDir().mkpath(dir);
+    watcher_.addPath(dir);
+
+    rescanTimer_.setSingleShot(true);
+    rescanTimer_.setInterval(RescanDelay);
+    connect(&rescanTimer_, &QTimer::timeout,
+            this, &ToxProfileCatalog::rescan);
+    connect(&watcher_, &QFileSystemWatcher::directoryChanged, this, [this]() {
+        // not restarted, so a steady stream of changes cannot starve it
+        if (!rescanTimer_.isActive()) {
+            rescanTimer_.start();
+        }
+    });
+    connect(&watcher_, &QFileSystemWatcher::fileChanged,
+            this, &ToxProfileCatalog::refresh);
+
+    rescan();
+}
+
+/**
+@brief Returns the number of profiles.
+*/
+int ToxProfileCatalog::count() const
+{
+    return entries_.count();
+}
+
+/**
+@brief Returns the names of all profiles.
+@return the profile names sorted by name
+*/
+QStringList ToxProfileCatalog::names() const
+{
+    QStringList out;
+    out.reserve(entries_.count());
+    for (const Entry& e : entries_) {
+        out << e.name;
+    }
+
+    return out;
+}
+
+int ToxProfileCatalog::rowCount(const QModelIndex& parent) const
+{
+    return parent.isValid() ? 0 : entries_.count();
+}
+
+QVariant ToxProfileCatalog::data(const QModelIndex& index, int role) const
+{
+    if (!index.isValid() || index.row() >= entries_.count()) {
+        return {};
+    }
+
+    const Entry& e = entries_.at(index.row());
+    switch (role) {
+    case Qt::DisplayRole:
+    case NameRole: return e.name;
+    case SizeRole: return e.size;
+    case ModifiedRole: return e.modified;
+    case EncryptedRole: return e.encrypted;
+    }
+
+    return {};
+}
+
+QHash<int, QByteArray> ToxProfileCatalog::roleNames() const
+{
+    return {
+        { NameRole, QByteArrayLiteral("name") },
+        { SizeRole, QByteArrayLiteral("size") },
+        { ModifiedRole, QByteArrayLiteral("modified") },
+        { EncryptedRole, QByteArrayLiteral("encrypted") }
+    };
+}
+
+/**
+@brief Synchronizes the catalog with the profiles directory.
+
+The directory listing is sorted like the catalog, so a single merge pass
+yields the rows to insert, update or remove. Temporary files never match the
+name filter and nothing is done while the set of profile names is unchanged.
+*/
+void ToxProfileCatalog::rescan()
+{
+    QDir dir(ToxerPrivate::profilesDir());
+    dir.setFilter(QDir::Files | QDir::NoDotAndDotDot);
+    dir.setNameFilters(QStringList() << QStringLiteral("*.tox"));
+    QStringList fileNames = dir.entryList(QDir::NoSort);
+    if (fileNames.count() == entries_.count()) {
+        for (QString& fileName : fileNames) {
+            fileName.chop(4); // ".tox"
+        }
+        std::sort(fileNames.begin(), fileNames.end());
+        if (fileNames == names()) {
+            return;
+        }
+    }
+
+    QFileInfoList list = dir.entryInfoList(QDir::NoSort);
+    std::sort(list.begin(), list.end(),
+              [](const QFileInfo& a, const QFileInfo& b) {
+        return a.completeBaseName() < b.completeBaseName();
+    });
+
+    const int oldCount = entries_.count();
+    int row = 0;
+    for (const QFileInfo& info : list) {
+        const QString name = info.completeBaseName();
+        while (row < entries_.count() && entries_.at(row).name < name) {
+            beginRemoveRows({}, row, row);
+            entries_.remove(row);
+            endRemoveRows();
+        }
+
+        if (row < entries_.count() && entries_.at(row).name == name) {
+            update(row, info);
+        } else {
+            const Entry e = { name, info.size(), info.lastModified(),
+                              probeEncrypted(info.filePath()) };
+            beginInsertRows({}, row, row);
+            entries_.insert(row, e);
+            endInsertRows();
+            watcher_.addPath(info.filePath());
+        }
+
+        row++;
+    }
+
+    if (row < entries_.count()) {
+        beginRemoveRows({}, row, entries_.count() - 1);
+        entries_.remove(row, entries_.count() - row);
+        endRemoveRows();
+    }
+
+    if (oldCount != entries_.count()) {
+        emit countChanged();
+    }
+}
+
+/**
+@brief Refreshes the entry of a changed profile file.
+@param[in] fileName     the changed profile file
+
+Removed profiles are left to the directory rescan. A profile replaced by a
+rename drops out of the watcher, so it is watched again.
+*/
+void ToxProfileCatalog::refresh(const QString& fileName)
+{
+    const QFileInfo info(fileName);
+    if (!info.exists()) {
+        return;
+    }
+
+    const QString name = info.completeBaseName();
+    const auto it = std::lower_bound(entries_.cbegin(), entries_.cend(), name,
+                                     [](const Entry& e, const QString& n) {
+        return e.name < n;
+    });
+    if (it == entries_.cend() || it->name != name) {
+        return;
+    }
+
+    if (!watcher_.files().contains(fileName)) {
+        watcher_.addPath(fileName);
+    }
+    update(static_cast<int>(it - entries_.cbegin()), info);
+}
+
+/**
+@brief Updates an entry from the state of its file.
+@param[in] row      the entry row
+@param[in] info     the profile file
+*/
+void ToxProfileCatalog::update(int row, const QFileInfo& info)
+{
+    Entry& e = entries_[row];
+    if (e.size == info.size() && e.modified == info.lastModified()) {
+        return;
+    }
+
+    if (e.size != info.size()) {
+        e.encrypted = probeEncrypted(info.filePath());
+    }
+    e.size = info.size();
+    e.modified = info.lastModified();
+    const QModelIndex i = index(row);
+    emit dataChanged(i, i);
+}
+
+/**
+@brief Checks whether a profile file is encrypted.
+@param[in] fileName     the profile file
+@return true, if the file starts with the Tox encryption header
+*/
+bool ToxProfileCatalog::probeEncrypted(const QString& fileName)
+{
+    char header[TOX_PASS_ENCRYPTION_EXTRA_LENGTH] = {};
+    QFile f(fileName);
+    if (!f.open(QFile::ReadOnly) || f.read(header, sizeof(header)) <= 0) {
+        return false;
+    }
+
+    return ToxerPrivate::isEncrypted(header);
+}
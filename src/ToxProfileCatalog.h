@@ -0,0 +1,90 @@
+/*
+ * This file is part of the Toxer application, a Tox messenger client.
+ *
+ * Copyright (c) 2017 Nils Fenner <nils@macgitver.org>
+ *
+ * This software is licensed under the terms of the MIT license:
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef TOXER_TOXPROFILECATALOG_H
+#define TOXER_TOXPROFILECATALOG_H
+
+#include <QAbstractListModel>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QTimer>
+#include <QVector>
+
+class ToxProfileCatalog final : public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(int count
+               READ count
+               NOTIFY countChanged)
+
+public:
+    static constexpr int RescanDelay = 1000;
+
+    enum Roles {
+        NameRole = Qt::UserRole + 1,
+        SizeRole,
+        ModifiedRole,
+        EncryptedRole
+    };
+
+public:
+    static ToxProfileCatalog* instance();
+
+public:
+    int count() const;
+    QStringList names() const;
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+signals:
+    void countChanged();
+
+private:
+    struct Entry {
+        QString name;
+        qint64 size;
+        QDateTime modified;
+        bool encrypted;
+    };
+
+private:
+    ToxProfileCatalog();
+
+    void rescan();
+    void refresh(const QString& fileName);
+    void update(int row, const QFileInfo& info);
+    static bool probeEncrypted(const QString& fileName);
+
+private:
+    QVector<Entry> entries_;
+    QFileSystemWatcher watcher_;
+    QTimer rescanTimer_;
+};
+
+#endif
@@ -41,6 +41,9 @@
 @enum ToxTypes::UserStatus
 @brief Qt abstraction of TOX_USER_STATUS
 
+@enum ToxTypes::ActivationStage
+@brief The stages of a background profile activation in execution order.
+
 @fn ToxTypes::toQVariant
 @brief casts a C++0x enum class type to QVariant
 */
@@ -46,6 +46,14 @@ public:
     enum class UserStatus : quint8 { Unknown, Ready, Away, Busy };
     Q_ENUM(UserStatus)
 
+    enum class MessageType : quint8 { Normal, Action };
+    Q_ENUM(MessageType)
+
+    enum class ActivationStage : quint8 {
+        Read, DeriveKey, Decrypt, CreateTox, Bootstrap
+    };
+    Q_ENUM(ActivationStage)
+
 public:
     inline static void registerQmlTypes() {
         qmlRegisterUncreatableType<ToxTypes>(
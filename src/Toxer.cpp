@@ -26,18 +26,59 @@
 
 #include "Toxer.h"
 
+#include <Private/ToxAvatars.h>
+#include <Private/ToxIconAtlas.h>
+#include <Private/ToxMetrics.h>
 #include <Private/ToxProfile.h>
+#include <Private/ToxProfileLoader.h>
+#include <Private/ToxSounds.h>
+#include <Private/ToxStartupTrace.h>
+#include <Private/ToxThumbnails.h>
 #include <Settings.h>
+#include <ToxConferencePeers.h>
+#include <ToxProfileCatalog.h>
 
-#include <QDir>
 #include <QFileInfo>
 #include <QGuiApplication>
+#include <QScreen>
+
+#include <sodium.h>
 
 void Toxer::registerQmlTypes() {
     constexpr const char* modComponents = { "com.tox.qmlcomponents" };
     qmlRegisterType<ToxProfileQuery>(modComponents, 1, 0, "ToxProfileQuery");
     qmlRegisterType<ToxFriendQuery>(modComponents, 1, 0, "ToxFriendQuery");
     qmlRegisterType<ToxMessenger>(modComponents, 1, 0, "ToxMessenger");
+    qmlRegisterType<ToxTransferQuery>(modComponents, 1, 0,
+                                      "ToxTransferQuery");
+    qmlRegisterType<ToxConferenceQuery>(modComponents, 1, 0,
+                                        "ToxConferenceQuery");
+    qmlRegisterType<ToxConferencePeers>(modComponents, 1, 0,
+                                        "ToxConferencePeers");
+    qmlRegisterType<ToxCallQuery>(modComponents, 1, 0, "ToxCallQuery");
+    qmlRegisterSingletonType<ToxProfileCatalog>(
+                modComponents, 1, 0, "ToxProfileCatalog",
+                [](QQmlEngine*, QJSEngine*) -> QObject* {
+        QObject* o = ToxProfileCatalog::instance();
+        QQmlEngine::setObjectOwnership(o, QQmlEngine::CppOwnership);
+        return o;
+    });
+}
+
+/**
+@brief Adds the Toxer image providers to a QML engine.
+@param[in] engine   the QML engine; takes ownership of the providers
+
+Avatars are served as "image://avatars/<hash>", thumbnails of image files
+as "image://thumbnails/<id>" and theme icons as "image://icons/<theme>/<name>".
+*/
+void Toxer::registerImageProviders(QQmlEngine* engine)
+{
+    engine->addImageProvider(QStringLiteral("icons"), new ToxIconProvider());
+    engine->addImageProvider(QStringLiteral("avatars"),
+                             new ToxAvatarProvider());
+    engine->addImageProvider(QStringLiteral("thumbnails"),
+                             new ToxThumbnailProvider());
 }
 
 QString Toxer::qmlLocation()
@@ -56,8 +97,10 @@ QUrl Toxer::profileSelector()
 
 QUrl Toxer::mainView()
 {
+    ToxStartupTrace::instance().begin("settings");
     UiSettings s;
     UiSettings::AppLayout l = s.app_layout();
+    ToxStartupTrace::instance().end("settings");
     switch (l) {
     case UiSettings::AppLayout::Split:
         return QUrl(qmlLocation() % QStringLiteral("/MainViewSplit.qml"));
@@ -68,13 +111,38 @@ QUrl Toxer::mainView()
     return QUrl(qmlLocation() % QStringLiteral("/MainViewSlim.qml"));
 }
 
+/**
+@brief constructor
+
+Initializes libsodium before anything allocates secure memory.
+*/
 Toxer::Toxer()
     : QObject()
 {
+    if (sodium_init() < 0) {
+        qFatal("Failed to initialize libsodium.");
+    }
+    ToxStartupTrace::instance().mark("toxer");
+
+    QVector<int> iconSizes;
+    for (const QScreen* screen : QGuiApplication::screens()) {
+        const int size = qRound(ToxIconAtlas::IconSize *
+                                screen->devicePixelRatio());
+        if (!iconSizes.contains(size)) {
+            iconSizes << size;
+        }
+    }
+    if (iconSizes.isEmpty()) {
+        iconSizes << ToxIconAtlas::IconSize;
+    }
+    ToxIconAtlas::instance().prepare(iconSizes);
+    ToxSounds::instance();
 }
 
 Toxer::~Toxer() {
-    delete ToxProfilePrivate::current();
+    ToxStartupTrace::instance().finish();
+    cancelActivation();
+    ToxProfilePrivate::closeAll();
 }
 
 QString Toxer::toxVersionString()
@@ -94,36 +162,69 @@ QString Toxer::profileLocation() const
     return ToxerPrivate::profilesDir();
 }
 
+/**
+@brief Returns the names of the Tox profiles in the profile location.
+@return the profile names
+*/
 QStringList Toxer::availableProfiles() const
 {
-    QDir dir(ToxerPrivate::profilesDir());
-    dir.setFilter(QDir::Files | QDir::NoDotAndDotDot);
-    dir.setNameFilters(QStringList() << QStringLiteral("*.tox"));
-    QFileInfoList list = dir.entryInfoList();
-
-    QStringList out;
-    for (QFileInfo info : list)
-    {
-        out << info.completeBaseName();
-    }
-
-    return out;
+    ToxStartupTrace::Scope trace("available_profiles");
+    return ToxProfileCatalog::instance()->names();
 }
 
 /**
 @brief Activates a Tox profile.
 @param[in] profileName  the profile name
+@param[in] password     the profile password
+
+The profile is loaded in the background. Progress is reported through
+activationProgress and profileChanged is emitted once the profile is active.
+On failure activationFailed is emitted and the current profile stays active.
+Activating another profile cancels a pending activation.
 */
 void Toxer::activateProfile(const QString& profileName,
                             const QString& password)
 {
-    const ToxProfilePrivate* old = ToxProfilePrivate::current();
-    ToxProfilePrivate::activate(profileName, password);
-    if (old != ToxProfilePrivate::current()) {
-        emit profileChanged();
+    cancelActivation();
+
+    const ToxProfilePrivate* p = ToxProfilePrivate::current();
+    if (p && p->name() == profileName) {
+        return;
+    }
+
+    mLoader = new ToxProfileLoader(profileName);
+    connect(mLoader, &ToxProfileLoader::progress,
+            this, &Toxer::activationProgress);
+    connect(mLoader, &ToxProfileLoader::activated,
+            this, &Toxer::profileChanged);
+    connect(mLoader, &ToxProfileLoader::failed,
+            this, [this, profileName](const QString& reason) {
+        emit activationFailed(profileName, reason);
+    });
+    mLoader->start(password);
+}
+
+/**
+@brief Cancels a pending profile activation.
+*/
+void Toxer::cancelActivation()
+{
+    if (mLoader) {
+        mLoader->disconnect(this);
+        mLoader->cancel();
+        mLoader = nullptr;
     }
 }
 
+/**
+@brief Returns, if a profile activation is pending.
+@return true while a profile is loaded in the background; false otherwise
+*/
+bool Toxer::isActivating() const
+{
+    return !mLoader.isNull();
+}
+
 /**
 @brief Creates a Tox profile.
 @param profileName  the profile name
@@ -138,9 +239,10 @@ void Toxer::createProfile(const QString& profileName, const QString& password)
 @brief Closes the current Tox profile
 */
 void Toxer::closeProfile() {
-    ToxProfilePrivate* p = ToxProfilePrivate::current();
-    if (p) {
-        delete p;
+    cancelActivation();
+
+    if (ToxProfilePrivate::current()) {
+        ToxProfilePrivate::close();
         emit profileChanged();
     }
 }
@@ -163,6 +265,43 @@ QUrl Toxer::avatarsUrl() const
                                QStringLiteral("/avatars"));
 }
 
+/**
+@brief Returns the URL to a thumbnail of a local image file.
+@param[in] file     the local image file
+@return the thumbnail image URL
+
+The thumbnail is decoded in the background at the sourceSize of the image
+item and cached on disk.
+*/
+QUrl Toxer::thumbnailUrl(const QUrl& file) const
+{
+    return QUrl(QStringLiteral("image://thumbnails/") +
+                QString::fromLatin1(file.toLocalFile().toUtf8().toHex()));
+}
+
+/**
+@brief Returns the URL to the theme icon atlas for an icon size.
+@param[in] pixelSize    the icon size in device pixels
+@see Toxer::iconRect
+*/
+QUrl Toxer::iconAtlasUrl(int pixelSize) const
+{
+    return QUrl(QStringLiteral("image://icons/atlas/") +
+                QString::number(pixelSize));
+}
+
+/**
+@brief Returns the rectangle of a theme icon in the icon atlas.
+@param[in] name         the icon name, e.g. "dark/dot_online"
+@param[in] pixelSize    the icon size in device pixels
+@return the rectangle to clip from the image of Toxer::iconAtlasUrl; an
+invalid rectangle while the atlas is prepared
+*/
+QRect Toxer::iconRect(const QString& name, int pixelSize) const
+{
+    return ToxIconAtlas::instance().rect(name, pixelSize);
+}
+
 /**
 @brief Checks, if a URL points to an existing local file or directory.
 @param url     the URL to check
@@ -173,6 +312,30 @@ bool Toxer::exists(const QUrl& url) const
     return QFileInfo::exists(url.toLocalFile());
 }
 
+/**
+@brief Returns the current state of the runtime metrics.
+@return a map from the metric name, e.g. "network.recovery_ms", to a map
+with the keys "count", "last", "min", "max" and "total"
+@see ToxMetrics
+*/
+QVariantMap Toxer::metrics() const
+{
+    QVariantMap out;
+    const auto values = ToxMetrics::instance().snapshot();
+    for (auto it = values.cbegin(); it != values.cend(); ++it) {
+        const ToxMetrics::Value& v = it.value();
+        QVariantMap m;
+        m.insert(QStringLiteral("count"), v.count);
+        m.insert(QStringLiteral("last"), v.last);
+        m.insert(QStringLiteral("min"), v.min);
+        m.insert(QStringLiteral("max"), v.max);
+        m.insert(QStringLiteral("total"), v.total);
+        out.insert(QString::fromLatin1(it.key()), m);
+    }
+
+    return out;
+}
+
 /**
 @brief ToxProfileQuery constructor
 @param[in] parent
@@ -630,6 +793,31 @@ bool ToxFriendQuery::isTyping(int index) const
     }
 }
 
+/**
+@brief Returns the avatar of a friend.
+@param[in] index    the friend index
+@return the avatar image URL; empty if the friend has no avatar
+
+The URL changes with the avatar, so QML does not show a stale image. The
+lookup does not touch the file system.
+*/
+QUrl ToxFriendQuery::avatar(int index) const
+{
+    const ToxProfilePrivate* p = ToxProfilePrivate::current();
+    if (!p) {
+        return QUrl();
+    }
+
+    const QByteArray pk = p->toxQuery([&index](const Tox* tox) -> QVariant {
+        return ToxerPrivate::pk(tox, index);
+    }).toByteArray();
+    const QByteArray hash = ToxAvatars::instance().avatar(pk);
+    return hash.isEmpty()
+            ? QUrl()
+            : QUrl(QStringLiteral("image://avatars/") +
+                   QString::fromLatin1(hash.toHex()));
+}
+
 /**
 @brief friend added notifier
 @param index    the friend index
@@ -704,6 +892,15 @@ void ToxFriendQuery::on_message(int index, const QString& message)
     emit this->message(index, message);
 }
 
+/**
+@brief friend avatar changed notifier
+@param index    the friend index
+*/
+void ToxFriendQuery::on_avatar_changed(int index)
+{
+    emit avatarChanged(index);
+}
+
 /**
 @brief ToxMessenger constructor
 */
@@ -721,7 +918,7 @@ void ToxMessenger::sendMessage(int friendIndex, const QString& message)
 {
     ToxProfilePrivate* p = ToxProfilePrivate::current();
     if (p) {
-        p->toxSet([&friendIndex, &message](Tox* tox) {
+        p->toxSend([&friendIndex, &message](Tox* tox) {
             uint32_t c_index = static_cast<uint32_t>(friendIndex);
             QByteArray str = message.toUtf8();
             const uint8_t* c_str =
@@ -737,3 +934,432 @@ void ToxMessenger::sendMessage(int friendIndex, const QString& message)
         });
     }
 }
+
+/**
+@brief ToxTransferQuery constructor
+*/
+ToxTransferQuery::ToxTransferQuery(QObject* parent)
+    : QObject(parent)
+{
+}
+
+/**
+@brief Sends a file to a friend.
+@param[in] friendIndex  the friend index of the receiver
+@param[in] file         the local file
+@return the file index of the transfer; -1 on failure
+*/
+int ToxTransferQuery::sendFile(int friendIndex, const QUrl& file)
+{
+    ToxProfilePrivate* p = ToxProfilePrivate::current();
+    if (!p || !file.isLocalFile()) {
+        return -1;
+    }
+
+    const quint32 fileIndex = p->sendFile(friendIndex, file.toLocalFile());
+    return fileIndex == UINT32_MAX ? -1 : static_cast<int>(fileIndex);
+}
+
+/**
+@brief Accepts a file offered by a friend.
+@param[in] friendIndex  the friend index of the sender
+@param[in] fileIndex    the file index of the transfer
+@param[in] file         the local file to store the received file at
+@return true, if the transfer started
+*/
+bool ToxTransferQuery::accept(int friendIndex, int fileIndex,
+                              const QUrl& file)
+{
+    ToxProfilePrivate* p = ToxProfilePrivate::current();
+    return p && file.isLocalFile() &&
+            p->acceptFile(friendIndex, static_cast<quint32>(fileIndex),
+                          file.toLocalFile());
+}
+
+/**
+@brief Cancels a file transfer.
+@param[in] friendIndex  the friend index
+@param[in] fileIndex    the file index of the transfer
+*/
+void ToxTransferQuery::cancel(int friendIndex, int fileIndex)
+{
+    ToxProfilePrivate* p = ToxProfilePrivate::current();
+    if (p) {
+        p->cancelTransfer(friendIndex, static_cast<quint32>(fileIndex));
+    }
+}
+
+/**
+@brief Returns the number of file chunks waiting to be sent.
+@param[in] friendIndex  the friend index; -1 for all friends
+*/
+int ToxTransferQuery::queueDepth(int friendIndex) const
+{
+    const ToxProfilePrivate* p = ToxProfilePrivate::current();
+    return p ? p->transferQueueDepth(friendIndex) : 0;
+}
+
+/**
+@brief file transfer started notifier
+@param index    the friend index
+*/
+void ToxTransferQuery::on_transfer_started(int index, quint32 fileIndex,
+                                           const QString& fileName,
+                                           quint64 size, bool incoming)
+{
+    emit started(index, static_cast<int>(fileIndex), fileName, size,
+                 incoming);
+}
+
+/**
+@brief file transfer progress notifier
+@param index    the friend index
+*/
+void ToxTransferQuery::on_transfer_progress(int index, quint32 fileIndex,
+                                            quint64 bytes, quint64 size,
+                                            quint64 bytesPerSecond)
+{
+    emit progress(index, static_cast<int>(fileIndex), bytes, size,
+                  bytesPerSecond);
+}
+
+/**
+@brief file transfer finished notifier
+@param index    the friend index
+*/
+void ToxTransferQuery::on_transfer_finished(int index, quint32 fileIndex,
+                                            bool completed)
+{
+    emit finished(index, static_cast<int>(fileIndex), completed);
+}
+
+/**
+@brief ToxConferenceQuery constructor
+*/
+ToxConferenceQuery::ToxConferenceQuery(QObject* parent)
+    : QObject(parent)
+{
+}
+
+/**
+@brief Returns the conference numbers of the active profile.
+*/
+QList<int> ToxConferenceQuery::conferences() const
+{
+    QList<int> l;
+    const ToxProfilePrivate* p = ToxProfilePrivate::current();
+    if (p) {
+        l = p->toxQuery([](const Tox* tox) -> QVariant {
+            const size_t cnt = tox_conference_get_chatlist_size(tox);
+            std::vector<uint32_t> ids(cnt);
+            tox_conference_get_chatlist(tox, ids.data());
+
+            QList<int> out;
+            for (uint32_t id : ids) {
+                out << static_cast<int>(id);
+            }
+
+            return QVariant::fromValue(out);
+        }).value<QList<int>>();
+    }
+
+    return l;
+}
+
+/**
+@brief Returns the title of a conference.
+@param[in] index    the conference index
+*/
+QString ToxConferenceQuery::title(int index) const
+{
+    const ToxProfilePrivate* p = ToxProfilePrivate::current();
+    if (!p) {
+        return {};
+    }
+
+    return p->toxQuery([&index](const Tox* tox) -> QVariant {
+        const uint32_t c_index = static_cast<uint32_t>(index);
+        const size_t len = tox_conference_get_title_size(tox, c_index,
+                                                         nullptr);
+        QByteArray out(static_cast<int>(len), Qt::Uninitialized);
+        if (len > 0 &&
+            !tox_conference_get_title(tox, c_index,
+                                      reinterpret_cast<uint8_t*>(out.data()),
+                                      nullptr))
+        {
+            return QString();
+        }
+        return QString::fromUtf8(out);
+    }).toString();
+}
+
+/**
+@brief Changes the title of a conference.
+@param[in] index    the conference index
+@param[in] title    the new title
+*/
+void ToxConferenceQuery::setTitle(int index, const QString& title)
+{
+    ToxProfilePrivate* p = ToxProfilePrivate::current();
+    if (p) {
+        p->toxSet([&index, &title](Tox* tox) {
+            const QByteArray str = title.toUtf8();
+            TOX_ERR_CONFERENCE_TITLE err = TOX_ERR_CONFERENCE_TITLE_OK;
+            tox_conference_set_title(
+                        tox, static_cast<uint32_t>(index),
+                        reinterpret_cast<const uint8_t*>(str.constData()),
+                        static_cast<size_t>(str.length()), &err);
+            if (err != TOX_ERR_CONFERENCE_TITLE_OK) {
+                qWarning("Setting title of conference %d failed: error %d",
+                         index, static_cast<int>(err));
+            }
+        });
+    }
+}
+
+/**
+@brief Returns the number of peers of a conference.
+@param[in] index    the conference index
+*/
+int ToxConferenceQuery::peerCount(int index) const
+{
+    const ToxProfilePrivate* p = ToxProfilePrivate::current();
+    return p ? p->conferencePeerCount(index) : 0;
+}
+
+/**
+@brief Creates a new text conference.
+@return the conference index; -1 on failure
+*/
+int ToxConferenceQuery::create()
+{
+    ToxProfilePrivate* p = ToxProfilePrivate::current();
+    return p ? p->createConference() : -1;
+}
+
+/**
+@brief Joins the conference a friend invited to.
+@param[in] friendIndex  the friend index of the inviter
+@param[in] cookie       the invite cookie as hex string
+@return the conference index; -1 on failure
+*/
+int ToxConferenceQuery::join(int friendIndex, const QString& cookie)
+{
+    ToxProfilePrivate* p = ToxProfilePrivate::current();
+    return p ? p->joinConference(friendIndex,
+                                 QByteArray::fromHex(cookie.toLatin1()))
+             : -1;
+}
+
+/**
+@brief Leaves a conference.
+@param[in] index    the conference index
+@return true, if the conference was left
+*/
+bool ToxConferenceQuery::leave(int index)
+{
+    ToxProfilePrivate* p = ToxProfilePrivate::current();
+    return p && p->leaveConference(index);
+}
+
+/**
+@brief Invites a friend to a conference.
+@param[in] index        the conference index
+@param[in] friendIndex  the friend index
+@return true, if the invite was sent
+*/
+bool ToxConferenceQuery::invite(int index, int friendIndex)
+{
+    ToxProfilePrivate* p = ToxProfilePrivate::current();
+    bool ok = false;
+    if (p) {
+        p->toxSend([&index, &friendIndex, &ok](Tox* tox) {
+            ok = tox_conference_invite(tox,
+                                       static_cast<uint32_t>(friendIndex),
+                                       static_cast<uint32_t>(index),
+                                       nullptr);
+        });
+    }
+    return ok;
+}
+
+/**
+@brief Sends a message to a conference.
+@param[in] index    the conference index
+@param[in] message  the message
+*/
+void ToxConferenceQuery::sendMessage(int index, const QString& message)
+{
+    ToxProfilePrivate* p = ToxProfilePrivate::current();
+    if (p) {
+        p->toxSend([&index, &message](Tox* tox) {
+            const QByteArray str = message.toUtf8();
+            TOX_ERR_CONFERENCE_SEND_MESSAGE err =
+                    TOX_ERR_CONFERENCE_SEND_MESSAGE_OK;
+            tox_conference_send_message(
+                        tox, static_cast<uint32_t>(index),
+                        TOX_MESSAGE_TYPE_NORMAL,
+                        reinterpret_cast<const uint8_t*>(str.constData()),
+                        static_cast<size_t>(str.length()), &err);
+            if (err != TOX_ERR_CONFERENCE_SEND_MESSAGE_OK) {
+                qWarning("Sending message to conference %d failed: error %d",
+                         index, static_cast<int>(err));
+            }
+        });
+    }
+}
+
+/**
+@brief conference invite notifier
+@param friendIndex  the friend index of the inviter
+*/
+void ToxConferenceQuery::on_conference_invited(int friendIndex,
+                                               const QString& cookie)
+{
+    emit invited(friendIndex, cookie);
+}
+
+/**
+@brief conference added notifier
+@param index    the conference index
+*/
+void ToxConferenceQuery::on_conference_added(int index)
+{
+    emit added(index);
+}
+
+/**
+@brief conference removed notifier
+@param index    the conference index
+*/
+void ToxConferenceQuery::on_conference_removed(int index)
+{
+    emit removed(index);
+}
+
+/**
+@brief conference title notifier
+@param index    the conference index
+*/
+void ToxConferenceQuery::on_conference_title_changed(int index,
+                                                     const QString& title)
+{
+    emit titleChanged(index, title);
+}
+
+/**
+@brief conference message notifier
+@param index    the conference index
+@param type     the ToxTypes::MessageType of the message
+*/
+void ToxConferenceQuery::on_conference_message(int index,
+                                               const QString& peerKey,
+                                               const QString& peerName,
+                                               const QString& message,
+                                               quint8 type)
+{
+    emit this->message(index, peerKey, peerName, message, type);
+}
+
+/**
+@brief conference peer list notifier
+@param index    the conference index
+*/
+void ToxConferenceQuery::on_conference_peers_changed(
+        int index, const QStringList& added, const QStringList& names,
+        const QStringList& removed)
+{
+    emit peersChanged(index, added, names, removed);
+}
+
+/**
+@brief conference peer name notifier
+@param index    the conference index
+*/
+void ToxConferenceQuery::on_conference_peer_name_changed(
+        int index, const QString& peerKey, const QString& name)
+{
+    emit peerNameChanged(index, peerKey, name);
+}
+
+/**
+@brief ToxCallQuery constructor
+*/
+ToxCallQuery::ToxCallQuery(QObject* parent)
+    : QObject(parent)
+{
+}
+
+/**
+@brief Starts an audio call with a friend.
+@param[in] friendIndex  the friend index
+@return true, if the call was placed
+*/
+bool ToxCallQuery::call(int friendIndex)
+{
+    ToxProfilePrivate* p = ToxProfilePrivate::current();
+    return p && p->startCall(friendIndex);
+}
+
+/**
+@brief Answers the call of a friend.
+@param[in] friendIndex  the friend index
+@return true, if the call was answered
+*/
+bool ToxCallQuery::answer(int friendIndex)
+{
+    ToxProfilePrivate* p = ToxProfilePrivate::current();
+    return p && p->answerCall(friendIndex);
+}
+
+/**
+@brief Ends or rejects the call of a friend.
+@param[in] friendIndex  the friend index
+*/
+void ToxCallQuery::hangup(int friendIndex)
+{
+    ToxProfilePrivate* p = ToxProfilePrivate::current();
+    if (p) {
+        p->endCall(friendIndex);
+    }
+}
+
+/**
+@brief Mutes the microphone in calls.
+@param[in] muted    true to send no audio
+*/
+void ToxCallQuery::setMuted(bool muted)
+{
+    ToxProfilePrivate* p = ToxProfilePrivate::current();
+    if (p) {
+        p->setCallMuted(muted);
+    }
+}
+
+/**
+@brief incoming call notifier
+@param index    the friend index
+*/
+void ToxCallQuery::on_call_incoming(int index)
+{
+    emit incoming(index);
+}
+
+/**
+@brief call state notifier
+@param index    the friend index
+@param state    the TOXAV_FRIEND_CALL_STATE flags
+*/
+void ToxCallQuery::on_call_state_changed(int index, quint32 state)
+{
+    emit stateChanged(index, state);
+}
+
+/**
+@brief call finished notifier
+@param index    the friend index
+*/
+void ToxCallQuery::on_call_finished(int index)
+{
+    emit finished(index);
+}
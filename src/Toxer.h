@@ -31,14 +31,20 @@
 #include "IToxNotify.h"
 
 #include <QObject>
+#include <QPointer>
+#include <QRect>
 #include <QUrl>
 
+class QQmlEngine;
+class ToxProfileLoader;
+
 class Toxer : public QObject
 {
     Q_OBJECT
 
 public:
     static void registerQmlTypes();
+    static void registerImageProviders(QQmlEngine* engine);
     static QString qmlLocation();
     static QUrl profileSelector();
     static QUrl mainView();
@@ -53,16 +59,27 @@ public:
     Q_INVOKABLE QStringList availableProfiles() const;
     Q_INVOKABLE void activateProfile(const QString& profileName,
                                      const QString& password);
+    Q_INVOKABLE void cancelActivation();
+    Q_INVOKABLE bool isActivating() const;
     Q_INVOKABLE void createProfile(const QString& profileName,
                                    const QString& password);
     Q_INVOKABLE void closeProfile();
     Q_INVOKABLE bool hasProfile() const;
 
     Q_INVOKABLE QUrl avatarsUrl() const;
+    Q_INVOKABLE QUrl thumbnailUrl(const QUrl& file) const;
+    Q_INVOKABLE QUrl iconAtlasUrl(int pixelSize) const;
+    Q_INVOKABLE QRect iconRect(const QString& name, int pixelSize) const;
     Q_INVOKABLE bool exists(const QUrl& url) const;
+    Q_INVOKABLE QVariantMap metrics() const;
 
 signals:
     void profileChanged();
+    void activationProgress(quint8 stage, quint8 stageCount);
+    void activationFailed(const QString& profileName, const QString& reason);
+
+private:
+    QPointer<ToxProfileLoader> mLoader;
 };
 
 class ToxProfileQuery : public QObject, IToxProfileNotifier
@@ -119,6 +136,7 @@ public:
     ToxTypes::UserStatus status(int index) const;
     Q_INVOKABLE quint8 statusInt(int index) const;
     Q_INVOKABLE bool isTyping(int index) const;
+    Q_INVOKABLE QUrl avatar(int index) const;
 
 signals:
     void countChanged();
@@ -130,6 +148,7 @@ signals:
     void isOnlineChanged(int index, bool online);
     void isTypingChanged(int index, bool typing);
     void message(int index, const QString& message);
+    void avatarChanged(int index);
 
 private:
     // IToxFriendNotifier interface
@@ -141,6 +160,7 @@ private:
     void on_is_online_changed(int index, bool online) override;
     void on_is_typing_changed(int index, bool typing) override;
     void on_message(int index, const QString& message) override;
+    void on_avatar_changed(int index) override;
 };
 
 class ToxMessenger : public ToxFriendQuery
@@ -153,4 +173,107 @@ public:
     Q_INVOKABLE void sendMessage(int friendIndex, const QString& message);
 };
 
+class ToxTransferQuery : public QObject, IToxTransferNotifier
+{
+    Q_OBJECT
+public:
+    ToxTransferQuery(QObject* parent = nullptr);
+
+public:
+    Q_INVOKABLE int sendFile(int friendIndex, const QUrl& file);
+    Q_INVOKABLE bool accept(int friendIndex, int fileIndex,
+                            const QUrl& file);
+    Q_INVOKABLE void cancel(int friendIndex, int fileIndex);
+    Q_INVOKABLE int queueDepth(int friendIndex = -1) const;
+
+signals:
+    void started(int friendIndex, int fileIndex, const QString& fileName,
+                 quint64 size, bool incoming);
+    void progress(int friendIndex, int fileIndex, quint64 bytes,
+                  quint64 size, quint64 bytesPerSecond);
+    void finished(int friendIndex, int fileIndex, bool completed);
+
+private:
+    // IToxTransferNotifier interface
+    void on_transfer_started(int index, quint32 fileIndex,
+                             const QString& fileName, quint64 size,
+                             bool incoming) override;
+    void on_transfer_progress(int index, quint32 fileIndex, quint64 bytes,
+                              quint64 size, quint64 bytesPerSecond) override;
+    void on_transfer_finished(int index, quint32 fileIndex,
+                              bool completed) override;
+};
+
+class ToxConferenceQuery : public QObject, IToxConferenceNotifier
+{
+    Q_OBJECT
+public:
+    ToxConferenceQuery(QObject* parent = nullptr);
+
+public:
+    Q_INVOKABLE QList<int> conferences() const;
+    Q_INVOKABLE QString title(int index) const;
+    Q_INVOKABLE void setTitle(int index, const QString& title);
+    Q_INVOKABLE int peerCount(int index) const;
+    Q_INVOKABLE int create();
+    Q_INVOKABLE int join(int friendIndex, const QString& cookie);
+    Q_INVOKABLE bool leave(int index);
+    Q_INVOKABLE bool invite(int index, int friendIndex);
+    Q_INVOKABLE void sendMessage(int index, const QString& message);
+
+signals:
+    void invited(int friendIndex, const QString& cookie);
+    void added(int index);
+    void removed(int index);
+    void titleChanged(int index, const QString& title);
+    void message(int index, const QString& peerKey, const QString& peerName,
+                 const QString& message, quint8 type);
+    void peersChanged(int index, const QStringList& added,
+                      const QStringList& names, const QStringList& removed);
+    void peerNameChanged(int index, const QString& peerKey,
+                         const QString& name);
+
+private:
+    // IToxConferenceNotifier interface
+    void on_conference_invited(int friendIndex,
+                               const QString& cookie) override;
+    void on_conference_added(int index) override;
+    void on_conference_removed(int index) override;
+    void on_conference_title_changed(int index,
+                                     const QString& title) override;
+    void on_conference_message(int index, const QString& peerKey,
+                               const QString& peerName,
+                               const QString& message,
+                               quint8 type) override;
+    void on_conference_peers_changed(int index, const QStringList& added,
+                                     const QStringList& names,
+                                     const QStringList& removed) override;
+    void on_conference_peer_name_changed(int index, const QString& peerKey,
+                                         const QString& name) override;
+};
+
+class ToxCallQuery : public QObject, IToxCallNotifier
+{
+    Q_OBJECT
+public:
+    ToxCallQuery(QObject* parent = nullptr);
+
+public:
+    Q_INVOKABLE bool call(int friendIndex);
+    Q_INVOKABLE bool answer(int friendIndex);
+    Q_INVOKABLE void hangup(int friendIndex);
+    Q_INVOKABLE void setMuted(bool muted);
+
+signals:
+    void incoming(int friendIndex);
+    void stateChanged(int friendIndex, quint32 state);
+    void finished(int friendIndex);
+
+private:
+    // IToxCallNotifier interface
+    void on_call_incoming(int index) override;
+    void on_call_state_changed(int index, quint32 state) override;
+    void on_call_finished(int index) override;
+};
+
 #endif